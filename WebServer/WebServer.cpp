@@ -3,11 +3,14 @@
 #include "../sql_conn_pool/sql_connection_pool.h"
 #include "../lock/locker.h"
 #include "../threadpool/threadpool.hpp"
+#include "../threadpool/io_pool.h"
+#include "../coro/coro_loop.h"
 
-WebServer::WebServer() {
-    /* http_conn 类对象 */
-    users = new http_conn[MAX_FD];
+/* 过载时的应答：预先渲染好，不经过 http_conn，发完即关闭连接 */
+static const char overload_503[] = "HTTP/1.1 503 Service Unavailable\r\nRetry-After: 1\r\nContent-Type: text/plain\r\n"
+                                   "Content-Length: 20\r\nConnection: close\r\n\r\nService Unavailable\n";
 
+WebServer::WebServer() {
     /* root 文件夹路径 */
     char server_path[200];
     /* getcwd()会将当前工作目录的绝对路径复制到参数buffer所指的内存空间中,参数size为buf的空间大小。 */
@@ -16,9 +19,7 @@ WebServer::WebServer() {
     m_root = (char*) malloc (strlen(server_path) + strlen(root) + 1);
     strcpy(m_root, server_path);
     strcat(m_root, root);
-
-    /* 定时器 */
-    users_timer = new client_data[MAX_FD];
+    m_argv = nullptr;
 }
 
 WebServer::~WebServer() {
@@ -26,46 +27,464 @@ WebServer::~WebServer() {
     close(m_listenfd);
     close(m_pipefd[1]);
     close(m_pipefd[0]);
-    delete[] users;
     delete m_pool;
 }
 
 void WebServer::init(int port, string users, string passWord, string dataBaseName, 
               int log_write, int opt_linger, int trigMode, int sql_num,
-              int thread_num, int close_log, int actor_model) {
+              int thread_num, int close_log, int actor_model, string upload_dir,
+              int gzip_cache_mb, int cache_file_kb, int cache_mb,
+              string bundle, int io_threads, int max_queue,
+              int conn_rate, int req_rate, int max_conns,
+              int backlog, int defer_accept, int fastopen, string cpus,
+              int workers, int drain_sec, int co_threads) {
     m_port = port;
     m_user = users;
     m_passWord = passWord;
     m_dataBaseName = dataBaseName;
     m_sql_num = sql_num;
     m_thread_num = thread_num;
+    m_io_threads = io_threads;
+    m_co_threads = co_threads;
+    m_max_queue = max_queue > 0 ? max_queue : 1;
+    m_accept_paused = false;
     m_log_write = log_write;
     m_OPT_LINGER = opt_linger;
+    m_backlog = backlog > 0 ? backlog : SOMAXCONN;
+    m_defer_accept = defer_accept;
+    m_fastopen = fastopen;
+    m_loop = 0;
+    m_listenfd = -1;
+    m_workers = workers > 0 ? workers : 0;
+    if (m_workers > RC_MAX_PROCS) {
+        fprintf(stderr, "at most %d worker processes, using %d\n", RC_MAX_PROCS, RC_MAX_PROCS);
+        m_workers = RC_MAX_PROCS;
+    }
+    m_ready_pipe[0] = m_ready_pipe[1] = -1;
+    m_drain_sec = drain_sec > 0 ? drain_sec : 0;
+    m_draining = false;
+    m_drain_deadline = 0;
+    m_upgrade_fd = -1;
+    m_upgrade_pid = 0;
     m_TRIGMode = trigMode;
     m_close_log = close_log;
     m_actormodel = actor_model;
+    m_upload_dir = upload_dir;
+    http_conn::m_upload_dir = upload_dir;
+    gzip_cache::get_instance()->init((size_t)(gzip_cache_mb > 0 ? gzip_cache_mb : 0) << 20);
+    response_cache::get_instance()->init((off_t)(cache_file_kb > 0 ? cache_file_kb : 0) << 10,
+                                         (size_t)(cache_mb > 0 ? cache_mb : 0) << 20);
+    rate_limiter::get_instance()->init(conn_rate, req_rate, max_conns, m_workers > 0 ? m_workers : 1);
+    /* 之后创建的线程(日志、线程池、I/O 线程)继承这组 CPU；多进程时每个工作进程是一个事件循环，fork 之后再绑定 */
+    cpu_affinity* cpu = cpu_affinity::get_instance();
+    if (!cpu->init(cpus.c_str(), m_workers > 0 ? m_workers : 1) || (m_workers == 0 && !cpu->bind_loop_cpus(m_loop))) {
+        fprintf(stderr, "invalid cpu list %s\n", cpus.c_str());
+        exit(1);
+    }
+    /* 连接表按 RLIMIT_NOFILE 分配 */
+    m_conns = conn_table::get_instance();
+    if (!m_conns->init()) {
+        fprintf(stderr, "cannot allocate connection table\n");
+        exit(1);
+    }
+    /* 指定了资源包却无法加载时直接退出，不静默地退回文件系统 */
+    if (!bundle.empty() && !static_bundle::get_instance()->open(bundle.c_str())) {
+        fprintf(stderr, "cannot load static bundle %s\n", bundle.c_str());
+        exit(1);
+    }
+    inherit();
+}
+
+void WebServer::set_command(char* argv[]) {
+    m_argv = argv;
+}
+
+/* 由旧进程平滑升级而来：从环境变量给出的 fd 接收旧进程的监听 socket 和它最近使用的缓存键，
+    在开始 accept 之前把这些响应渲染进缓存。数据库连接池在 sql_pool 中一次建好，也在监听之前。
+    监听 socket 的个数由 -w 和 -A 决定，与旧进程不一致时无法接手，退出后旧进程照常服务 */
+void WebServer::inherit() {
+    const char* env = getenv(UPGRADE_ENV);
+    if (!env) {
+        return;
+    }
+    m_upgrade_fd = atoi(env);
+    unsetenv(UPGRADE_ENV);
+    fcntl(m_upgrade_fd, F_SETFD, FD_CLOEXEC);
+
+    uint32_t keys_len = 0;
+    char control[CMSG_SPACE(sizeof(int) * RC_MAX_PROCS)];
+    struct iovec iov = {&keys_len, sizeof(keys_len)};
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    if (recvmsg(m_upgrade_fd, &msg, MSG_WAITALL | MSG_CMSG_CLOEXEC) != sizeof(keys_len)) {
+        fprintf(stderr, "cannot receive listening sockets from the old process\n");
+        exit(1);
+    }
+    for (struct cmsghdr* cm = CMSG_FIRSTHDR(&msg); cm; cm = CMSG_NXTHDR(&msg, cm)) {
+        if (cm->cmsg_level == SOL_SOCKET && cm->cmsg_type == SCM_RIGHTS) {
+            int* fds = (int*)CMSG_DATA(cm);
+            for (size_t i = 0; i < (cm->cmsg_len - CMSG_LEN(0)) / sizeof(int); i++) {
+                m_inherited.push_back(fds[i]);
+            }
+        }
+    }
+    string keys(keys_len, '\0');
+    if (keys_len > 0 && recv(m_upgrade_fd, &keys[0], keys_len, MSG_WAITALL) != (ssize_t)keys_len) {
+        fprintf(stderr, "cannot receive cache keys from the old process\n");
+        exit(1);
+    }
+    int need = m_workers > 0 && cpu_affinity::get_instance()->enabled() ? m_workers : 1;
+    if ((int)m_inherited.size() != need) {
+        fprintf(stderr, "the old process has %d listening sockets, need %d; change -w/-A with a full restart\n",
+                (int)m_inherited.size(), need);
+        exit(1);
+    }
+    http_conn::prewarm(keys.data(), keys.size());
+}
+
+/* 收到 SIGUSR2：以同样的命令行 exec 新程序，经 Unix socket 把监听 socket(SCM_RIGHTS)和热点缓存键交给它。
+    新程序预热完、开始监听后回一个字节，旧进程这时才停止 accept 并排空已有连接；
+    新程序启动失败则 socket 被关闭，旧进程照常服务。监听 socket 始终打开，升级期间新连接不会被拒绝 */
+bool WebServer::start_upgrade(const vector<int>& listeners) {
+    if (m_upgrade_fd >= 0 || m_draining || !m_argv) {
+        return false;
+    }
+    string keys;
+    response_cache::get_instance()->hot_keys(keys, UPGRADE_KEYS_MAX);
+    int sv[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sv) < 0) {
+        LOG_ERROR("upgrade: socketpair failed: errno is: %d", errno);
+        return false;
+    }
+    /* fork 之后子进程里只能调用异步信号安全的函数，环境变量先准备好 */
+    string fd_env = string(UPGRADE_ENV) + "=" + to_string(UPGRADE_FD);
+    vector<char*> envp(1, &fd_env[0]);
+    for (char** e = environ; *e; e++) {
+        if (strncmp(*e, fd_env.c_str(), sizeof(UPGRADE_ENV)) != 0) {
+            envp.push_back(*e);
+        }
+    }
+    envp.push_back(nullptr);
+
+    pid_t pid = fork();
+    if (pid == 0) {
+        if (m_workers > 0) {
+            sigprocmask(SIG_SETMASK, &m_sigmask, nullptr);
+        }
+        if (sv[1] == UPGRADE_FD) {
+            fcntl(sv[1], F_SETFD, 0);
+        }
+        else {
+            dup2(sv[1], UPGRADE_FD);
+        }
+        /* 连接、epoll 等不是以 CLOEXEC 打开的 fd 不带进新程序 */
+        if (syscall(SYS_close_range, UPGRADE_FD + 1, ~0U, 0) < 0) {
+            for (int fd = UPGRADE_FD + 1; fd < sysconf(_SC_OPEN_MAX); fd++) {
+                close(fd);
+            }
+        }
+        execvpe(m_argv[0], m_argv, envp.data());
+        _exit(127);
+    }
+    close(sv[1]);
+    if (pid < 0) {
+        LOG_ERROR("upgrade: fork failed: errno is: %d", errno);
+        close(sv[0]);
+        return false;
+    }
+
+    uint32_t keys_len = keys.size();
+    char control[CMSG_SPACE(sizeof(int) * RC_MAX_PROCS)];
+    memset(control, 0, sizeof(control));
+    struct iovec iov = {&keys_len, sizeof(keys_len)};
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = CMSG_SPACE(sizeof(int) * listeners.size());
+    struct cmsghdr* cm = CMSG_FIRSTHDR(&msg);
+    cm->cmsg_level = SOL_SOCKET;
+    cm->cmsg_type = SCM_RIGHTS;
+    cm->cmsg_len = CMSG_LEN(sizeof(int) * listeners.size());
+    memcpy(CMSG_DATA(cm), listeners.data(), sizeof(int) * listeners.size());
+    if (sendmsg(sv[0], &msg, MSG_NOSIGNAL) != sizeof(keys_len) ||
+        (keys_len > 0 && send(sv[0], keys.data(), keys_len, MSG_NOSIGNAL) != (ssize_t)keys_len)) {
+        LOG_ERROR("upgrade: cannot hand over listening sockets: errno is: %d", errno);
+        close(sv[0]);
+        kill(pid, SIGKILL);
+        if (m_workers == 0) {
+            waitpid(pid, nullptr, 0);
+        }
+        return false;
+    }
+    m_upgrade_fd = sv[0];
+    m_upgrade_pid = pid;
+    LOG_INFO("upgrade: started pid %d with %d cache keys", pid, (int)count(keys.begin(), keys.end(), '\0'));
+    return true;
+}
+
+/* 新程序的回应：1 表示它已开始监听，-1 表示它没能启动(socket 已关闭)，0 表示还没有回应 */
+int WebServer::upgrade_reply() {
+    char c;
+    ssize_t n = recv(m_upgrade_fd, &c, 1, MSG_DONTWAIT);
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) {
+        return 0;
+    }
+    close(m_upgrade_fd);
+    m_upgrade_fd = -1;
+    if (n == 1) {
+        LOG_INFO("upgrade: pid %d is listening", m_upgrade_pid);
+        return 1;
+    }
+    LOG_ERROR("upgrade: pid %d failed to start, keep serving", m_upgrade_pid);
+    /* 多进程时由主进程的 SIGCHLD 处理统一回收 */
+    if (m_workers == 0) {
+        waitpid(m_upgrade_pid, nullptr, 0);
+    }
+    m_upgrade_pid = 0;
+    return -1;
+}
+
+/* 新程序已在监听，通知旧进程可以停止 accept 了 */
+void WebServer::upgrade_ready() {
+    if (m_upgrade_fd < 0) {
+        return;
+    }
+    char c = 'R';
+    send(m_upgrade_fd, &c, 1, MSG_NOSIGNAL);
+    close(m_upgrade_fd);
+    m_upgrade_fd = -1;
+}
+
+/* 平滑退出(SIGQUIT，或升级后的旧进程)：关闭监听 socket，之后的连接都由新进程(或其他工作进程)接收；
+    正在处理的请求照常完成，之后的响应都以 Connection: close 结束，空闲的长连接由 close_idle 关闭。
+    所有连接关闭或超过 m_drain_sec 秒后事件循环退出 */
+void WebServer::drain() {
+    if (m_draining) {
+        return;
+    }
+    m_draining = true;
+    m_drain_deadline = time(nullptr) + m_drain_sec;
+    http_conn::m_draining = true;
+    if (m_accept_paused) {
+        m_accept_paused = false;
+        METRIC_ADD(M_ACCEPT_PAUSED, -1);
+    }
+    else {
+        epoll_ctl(m_epollfd, EPOLL_CTL_DEL, m_listenfd, 0);
+    }
+    close(m_listenfd);
+    m_listenfd = -1;
+    LOG_INFO("draining %d connections", http_conn::m_user_count);
+}
+
+/* 关闭没有请求在处理、也没有响应在发送，且 1 秒以上没有活动的连接。
+    还在连续发请求的客户端会在下一个响应里收到 Connection: close，不去和它正在发来的请求抢着关闭 */
+void WebServer::close_idle() {
+    time_t quiet = time(nullptr) + 3 * TIMESLOT - 1;
+    util_timer* timer = utils.m_timer_lst.first();
+    while (timer) {
+        util_timer* next = timer->next;
+        int sockfd = timer->user_data->sockfd;
+        connection* c = m_conns->get(sockfd);
+        if (c && c->conn.idle() && timer->expire <= quiet) {
+            deal_timer(timer, sockfd);
+        }
+        timer = next;
+    }
+}
+
+/* 多进程模式：主进程创建监听 socket，把指标槽位池移到共享内存(响应缓存和限流表在 init 中已建在共享内存里)，
+    然后 fork 出 m_workers 个工作进程，自己只负责监管：
+    工作进程退出就清掉它在共享内存中的引用、连接计数和仪表并重新拉起，启动不到 1 秒就退出的隔 1 秒再拉，避免崩溃循环；
+    收到 SIGTERM/SIGINT 转发给所有工作进程，等它们都退出后主进程退出；SIGQUIT 同样转发，工作进程排空连接后退出。
+    收到 SIGUSR2 时由主进程启动新程序并交出监听 socket，新程序的工作进程都开始监听后让旧的工作进程排空退出。
+    工作进程从这里返回，再各自创建日志、数据库连接池、线程池并进入事件循环，一个进程崩溃不影响其他进程 */
+void WebServer::prefork() {
+    if (m_workers == 0) {
+        return;
+    }
+    cpu_affinity* cpu = cpu_affinity::get_instance();
+    vector<int> listeners = m_inherited;
+    if (listeners.empty()) {
+        for (int i = 0; i < (cpu->enabled() ? m_workers : 1); i++) {
+            listeners.push_back(open_listener(i));
+        }
+    }
+    /* 由旧进程升级而来：工作进程开始监听后各写一个字节 */
+    if (m_upgrade_fd >= 0 && pipe2(m_ready_pipe, O_CLOEXEC | O_NONBLOCK) < 0) {
+        fprintf(stderr, "cannot create ready pipe\n");
+        exit(1);
+    }
+    int ready = 0;
+    if (!Metrics::get_instance()->share()) {
+        fprintf(stderr, "cannot map shared metrics\n");
+        exit(1);
+    }
+
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGCHLD);
+    sigaddset(&mask, SIGTERM);
+    sigaddset(&mask, SIGINT);
+    sigaddset(&mask, SIGQUIT);
+    sigaddset(&mask, SIGUSR2);
+    sigprocmask(SIG_BLOCK, &mask, &m_sigmask);
+    pid_t master = getpid();
+    vector<pid_t> pids(m_workers, 0);
+    vector<time_t> started(m_workers, 0);
+    vector<time_t> restart_at(m_workers, 0);  /* 重新拉起的时刻 */
+    bool stopping = false;
+    for (;;) {
+        time_t now = time(nullptr);
+        int alive = 0;
+        for (int i = 0; i < m_workers; i++) {
+            if (pids[i] == 0 && !stopping && restart_at[i] <= now) {
+                pid_t pid = fork();
+                if (pid == 0) {
+                    sigprocmask(SIG_SETMASK, &m_sigmask, nullptr);
+                    /* 主进程被 SIGKILL 时工作进程也退出，不留下没人监管的进程 */
+                    prctl(PR_SET_PDEATHSIG, SIGTERM);
+                    if (getppid() != master) {
+                        exit(0);
+                    }
+                    m_loop = i;
+                    Metrics::get_instance()->forked();
+                    response_cache::get_instance()->set_process(i);
+                    rate_limiter::get_instance()->set_process(i);
+                    m_listenfd = listeners[listeners.size() > 1 ? i : 0];
+                    for (size_t j = 0; j < listeners.size(); j++) {
+                        if (listeners[j] != m_listenfd) {
+                            close(listeners[j]);
+                        }
+                    }
+                    /* 与旧进程或新程序之间的通知由主进程负责 */
+                    if (m_upgrade_fd >= 0) {
+                        close(m_upgrade_fd);
+                        m_upgrade_fd = -1;
+                    }
+                    if (m_ready_pipe[0] >= 0) {
+                        close(m_ready_pipe[0]);
+                        m_ready_pipe[0] = -1;
+                    }
+                    if (!cpu->bind_loop_cpus(m_loop)) {
+                        fprintf(stderr, "cannot bind worker %d to its cpus\n", i);
+                    }
+                    return;
+                }
+                if (pid < 0) {
+                    restart_at[i] = now + 1;
+                    continue;
+                }
+                pids[i] = pid;
+                started[i] = now;
+                METRIC_ADD(M_WORKERS, 1);
+            }
+            alive += pids[i] != 0;
+        }
+        if (stopping && alive == 0) {
+            exit(0);
+        }
+
+        /* 升级进行中时更频繁地检查对方的通知 */
+        struct timespec wait = {1, 0};
+        if (m_upgrade_fd >= 0) {
+            wait.tv_sec = 0;
+            wait.tv_nsec = 100 * 1000 * 1000;
+        }
+        int sig = sigtimedwait(&mask, nullptr, &wait);
+        if (sig == SIGTERM || sig == SIGINT || sig == SIGQUIT) {
+            stopping = true;
+            for (int i = 0; i < m_workers; i++) {
+                if (pids[i] != 0) {
+                    kill(pids[i], sig == SIGQUIT ? SIGQUIT : SIGTERM);
+                }
+            }
+        }
+        else if (sig == SIGUSR2 && !stopping) {
+            start_upgrade(listeners);
+        }
+        else if (sig == SIGCHLD) {
+            pid_t pid;
+            int status;
+            while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+                int i = find(pids.begin(), pids.end(), pid) - pids.begin();
+                if (i == m_workers) {
+                    continue;
+                }
+                pids[i] = 0;
+                METRIC_ADD(M_WORKERS, -1);
+                Metrics::get_instance()->release(pid);
+                if (response_cache::get_instance()->release_process(i)) {
+                    fprintf(stderr, "worker %d (pid %d) died holding the response cache lock, cache index rebuilt\n", i, pid);
+                }
+                rate_limiter::get_instance()->release_process(i);
+                if (stopping) {
+                    continue;
+                }
+                if (WIFSIGNALED(status)) {
+                    fprintf(stderr, "worker %d (pid %d) killed by signal %d, restarting\n", i, pid, WTERMSIG(status));
+                }
+                else {
+                    fprintf(stderr, "worker %d (pid %d) exited with status %d, restarting\n", i, pid, WEXITSTATUS(status));
+                }
+                METRIC_ADD(M_WORKER_RESTARTS, 1);
+                now = time(nullptr);
+                restart_at[i] = now - started[i] < 1 ? now + 1 : now;
+            }
+        }
+
+        /* 新程序：所有工作进程都开始监听后通知旧进程 */
+        if (m_ready_pipe[0] >= 0) {
+            char buf[RC_MAX_PROCS];
+            ssize_t n;
+            while ((n = read(m_ready_pipe[0], buf, sizeof(buf))) > 0) {
+                ready += n;
+            }
+            if (ready >= m_workers) {
+                close(m_ready_pipe[0]);
+                close(m_ready_pipe[1]);
+                m_ready_pipe[0] = m_ready_pipe[1] = -1;
+                upgrade_ready();
+            }
+        }
+        /* 旧进程：新程序已在监听，工作进程排空连接后退出 */
+        else if (m_upgrade_fd >= 0 && upgrade_reply() == 1) {
+            stopping = true;
+            for (int i = 0; i < m_workers; i++) {
+                if (pids[i] != 0) {
+                    kill(pids[i], SIGQUIT);
+                }
+            }
+        }
+    }
 }
 
 void WebServer::trig_mode() {
     /* 监听触发机制 和 连接触发机制 */
     /*  LT + LT */
     if (m_TRIGMode == 0) {
-        m_LISTENTrigmode == 0;
+        m_LISTENTrigmode = 0;
         m_CONNTrigmode = 0;
     }
     /* LT + ET */
     else if (m_TRIGMode == 1) {
-        m_LISTENTrigmode == 0;
+        m_LISTENTrigmode = 0;
         m_CONNTrigmode = 1;
     }
     /* ET + LT */
     else if (m_TRIGMode == 2) {
-        m_LISTENTrigmode == 1;
-        m_CONNTrigmode == 0;
+        m_LISTENTrigmode = 1;
+        m_CONNTrigmode = 0;
     }
     else if (m_TRIGMode == 3) {
-        m_LISTENTrigmode == 1;
-        m_CONNTrigmode == 1;
+        m_LISTENTrigmode = 1;
+        m_CONNTrigmode = 1;
     }
 }
 
@@ -88,29 +507,39 @@ void WebServer::sql_pool() {
     m_connPool = connection_pool::GetInstance();
     m_connPool->init("localhost", m_user, m_passWord, m_dataBaseName, 3306, m_sql_num, m_close_log);
     /* 初始化数据库读取表 */
-    users->initmysql_result(m_connPool);
+    http_conn::initmysql_result(m_connPool);
 }
 
 void WebServer::thread_pool() {
     /* 创建线程池 */
-    m_pool = new threadpool<http_conn>(m_actormodel, m_connPool, m_thread_num);  /* 模板类 */
+    m_pool = new threadpool<http_conn>(m_actormodel, m_connPool, m_thread_num, m_max_queue);  /* 模板类 */
+    /* reactor 模式下文件由工作线程发送，缺页只阻塞工作线程，不需要预读线程 */
+    if (m_actormodel == 0 && m_io_threads > 0) {
+        http_conn::m_io_offload = io_pool::get_instance()->init(m_io_threads);
+    }
+    /* 表单请求由事件循环启动的协程处理，数据库查询在阻塞调用线程中进行 */
+    if (m_actormodel == 0 && m_co_threads > 0 && !coro_loop::get_instance()->init(m_connPool, m_co_threads)) {
+        LOG_ERROR("%s", "cannot start coroutine threads, forms are handled by the thread pool");
+    }
 }
 
-void WebServer::eventListen() {
+/* 创建、配置监听 socket，loop 为它服务的事件循环(工作进程)的序号。
+    单进程时由 eventListen 创建；多进程时主进程在 fork 之前创建，固定 CPU 时每个工作进程一个，否则共用一个 */
+int WebServer::open_listener(int loop) {
     /* 网络编程基本步骤 */
-    m_listenfd = socket(PF_INET, SOCK_STREAM, 0);
-    assert(m_listenfd >= 0);
+    int fd = socket(PF_INET, SOCK_STREAM, 0);
+    assert(fd >= 0);
 
     /* 优雅关闭连接 */
     /* 在TCP连接中，recv等函数默认为阻塞模式(block)，即直到有数据到来之前函数不会返回，
        而我们有时则需要一种超时机制使其在一定时间后返回而不管是否有数据到来，这里我们就会用到setsockopt()函数： */
     if (m_OPT_LINGER == 0) {
         struct linger tmp = {0, 1};  /* struct linger */
-        setsockopt(m_listenfd, SOL_SOCKET, SO_LINGER, &tmp, sizeof(tmp)); 
+        setsockopt(fd, SOL_SOCKET, SO_LINGER, &tmp, sizeof(tmp)); 
     }
     else if (m_OPT_LINGER == 1) {
         struct linger tmp = {1, 1};
-        setsockopt(m_listenfd, SOL_SOCKET, SO_LINGER, &tmp, sizeof(tmp));
+        setsockopt(fd, SOL_SOCKET, SO_LINGER, &tmp, sizeof(tmp));
     }
 
     int ret = 0;
@@ -122,12 +551,58 @@ void WebServer::eventListen() {
 
     /* 忽略 TIME_SLOT */
     int flag = 1;
-    setsockopt(m_listenfd, SOL_SOCKET, SO_REUSEADDR, &flag, sizeof(flag));
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &flag, sizeof(flag));
+    /* 固定 CPU 时每个工作进程有自己的监听 socket，按创建顺序组成 reuseport 组。
+        组里只有一个 socket(单进程或 -w 1)时不设 SO_REUSEPORT：误启动的第二个实例应当 bind 失败，而不是悄悄分走连接 */
+    cpu_affinity* cpu = cpu_affinity::get_instance();
+    bool group = cpu->enabled() && m_workers > 1;
+    if (group) {
+        setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &flag, sizeof(flag));
+    }
     /* 绑定 ip 地址、端口号、开启监听 */
-    ret = bind(m_listenfd, (struct sockaddr*)&address, sizeof(address));
+    ret = bind(fd, (struct sockaddr*)&address, sizeof(address));
     assert(ret >= 0);
-    ret = listen(m_listenfd, 5);
+    /* 新连接交给收到它的 CPU 所属的事件循环；没有 BPF 程序时内核也优先选 SO_INCOMING_CPU 相同的 socket */
+    if (group) {
+        int incoming = cpu->loop_cpu(loop);
+        setsockopt(fd, SOL_SOCKET, SO_INCOMING_CPU, &incoming, sizeof(incoming));
+    }
+    /* 三次握手完成后等客户端的第一段数据到达才放进 accept 队列，accept 出来的连接马上就可读 */
+    if (m_defer_accept > 0 &&
+        setsockopt(fd, IPPROTO_TCP, TCP_DEFER_ACCEPT, &m_defer_accept, sizeof(m_defer_accept)) < 0) {
+        LOG_WARN("TCP_DEFER_ACCEPT failed: errno is: %d", errno);
+    }
+    /* SYN 中携带的请求在握手完成前就交给服务器；还需要 net.ipv4.tcp_fastopen 打开服务端(值含 2) */
+    if (m_fastopen > 0 &&
+        setsockopt(fd, IPPROTO_TCP, TCP_FASTOPEN, &m_fastopen, sizeof(m_fastopen)) < 0) {
+        LOG_WARN("TCP_FASTOPEN failed: errno is: %d", errno);
+    }
+    /* 连接队列太短时突发的连接被丢弃，客户端要等 1 秒以上重传 SYN；内核会截断到 net.core.somaxconn */
+    ret = listen(fd, m_backlog);
     assert(ret >= 0);
+    /* 程序挂在已经 listen 的 socket 上：先挂再 listen 时组里后面的 socket listen 会失败(EADDRINUSE) */
+    if (group && !cpu->attach_steering(fd)) {
+        LOG_WARN("SO_ATTACH_REUSEPORT_CBPF failed: errno is: %d", errno);
+    }
+    FILE* fp = fopen("/proc/sys/net/core/somaxconn", "r");
+    int somaxconn = 0;
+    if (fp) {
+        if (fscanf(fp, "%d", &somaxconn) != 1) {
+            somaxconn = 0;
+        }
+        fclose(fp);
+    }
+    if (somaxconn > 0 && somaxconn < m_backlog) {
+        LOG_WARN("listen backlog %d is capped by net.core.somaxconn %d", m_backlog, somaxconn);
+    }
+    return fd;
+}
+
+void WebServer::eventListen() {
+    if (m_listenfd < 0) {
+        m_listenfd = m_inherited.empty() ? open_listener(m_loop) : m_inherited[0];
+    }
+    int ret = 0;
 
     utils.init(TIMESLOT);
 
@@ -136,17 +611,31 @@ void WebServer::eventListen() {
     m_epollfd = epoll_create(5);
     assert(m_epollfd != -1);
 
-    utils.addfd(m_epollfd, m_listenfd, false, m_LISTENTrigmode);
+    watch_listener();
     http_conn::m_epollfd = m_epollfd;
+    http_conn::m_persistent = m_CONNTrigmode == 1 && m_actormodel == 0;
+    http_conn::m_worker_io = m_actormodel == 1;
 
     ret = socketpair(PF_UNIX, SOCK_STREAM, 0, m_pipefd);
     assert(ret != -1);
     utils.setNonBlocking(m_pipefd[1]);
     utils.addfd(m_epollfd, m_pipefd[0], false, 0);
+    /* 预读完成的通知 */
+    if (http_conn::m_io_offload) {
+        utils.addfd(m_epollfd, io_pool::get_instance()->notify_fd(), false, 0);
+    }
+    /* 协程等待的 socket 就绪、阻塞调用完成 */
+    coro_loop* coro = coro_loop::get_instance();
+    if (coro->enabled()) {
+        utils.addfd(m_epollfd, coro->poll_fd(), false, 0);
+        utils.addfd(m_epollfd, coro->notify_fd(), false, 0);
+    }
 
     utils.addsig(SIGPIPE, SIG_IGN);
     utils.addsig(SIGALRM, utils.sig_handler, false);
     utils.addsig(SIGTERM, utils.sig_handler, false);
+    utils.addsig(SIGQUIT, utils.sig_handler, false);
+    utils.addsig(SIGUSR2, utils.sig_handler, false);
 
     /* 设置信号传送闹钟， 及用来设置信号 SIGALARM 在经过参数 TIMESLOT 秒后发送给 目标进程(who？) */ 
     /* 如果没有设置信号 SIGALARM 的信号处理函数， 那么alarm() 默认处理终止进程 */
@@ -154,22 +643,38 @@ void WebServer::eventListen() {
 
     /* 工具类 */
     Utils::u_pipefd = m_pipefd;
-    Utils::u_epollfd;
+    Utils::u_epollfd = m_epollfd;
+
+    /* 其他线程都已创建，事件循环线程固定到自己的 CPU 上 */
+    cpu_affinity* cpu = cpu_affinity::get_instance();
+    if (!cpu->pin_loop_thread(m_loop)) {
+        LOG_WARN("cannot pin event loop to cpu %d", cpu->loop_cpu(m_loop));
+    }
+
+    /* 已经在监听：升级而来的单进程直接通知旧进程，工作进程通知主进程 */
+    if (m_ready_pipe[1] >= 0) {
+        char c = 'R';
+        write(m_ready_pipe[1], &c, 1);
+        close(m_ready_pipe[1]);
+        m_ready_pipe[1] = -1;
+    }
+    upgrade_ready();
 }
 
 /* 给新连接的客户创建一个定时器， 加入升序链表中 */
 void WebServer::timer(int connfd, struct sockaddr_in client_address) {
-    users[connfd].init(connfd, client_address, m_root, m_CONNTrigmode, m_close_log, m_user, m_passWord, m_dataBaseName);
+    connection* c = m_conns->open(connfd);            /* 从对象池取一个连接对象 */
+    c->conn.init(connfd, client_address, m_root, m_CONNTrigmode, m_close_log, m_user, m_passWord, m_dataBaseName);
 
     /* 初始化定时器数据 */
-    users_timer[connfd].address = client_address;     /* 客户端地址 */
-    users_timer[connfd].sockfd = connfd;              /* 客户端文件描述符 */
+    c->data.address = client_address;                 /* 客户端地址 */
+    c->data.sockfd = connfd;                          /* 客户端文件描述符 */
     util_timer* timer = new util_timer();             /* 创建一个定时器 */
-    timer->user_data = &users_timer[connfd];          /* 定时器的连接资源为刚连接的客户端 */
+    timer->user_data = &c->data;                      /* 定时器的连接资源为刚连接的客户端 */
     timer->cb_func = cb_func;                         /* 设置定时器的回调函数 */
     time_t cur = time(nullptr);                       /* 记录当前时间 */
     timer->expire = cur + 3 * TIMESLOT;               /* 将此定时器的超时时间设为 当前时间 + 3* TIMESLOT */
-    users_timer[connfd].timer = timer;                /* 设置当前客户端的定时器为刚设置好的定时器 */
+    c->data.timer = timer;                            /* 设置当前客户端的定时器为刚设置好的定时器 */
     utils.m_timer_lst.add_timer(timer);               /* 将此定时器添加到升序链表中 */
 }
 
@@ -182,48 +687,59 @@ void WebServer::adjust_timer(util_timer* timer) {
     LOG_INFO("%s", "adjust timer once");
 }
 
-/* 定时器到期，关闭连接 */
+/* 定时器到期，关闭连接；回调最后把连接对象还给对象池，之后不能再访问它 */
 void WebServer::deal_timer(util_timer* timer, int sockfd) {
-    timer->cb_func(&users_timer[sockfd]);
+    connection* c = m_conns->get(sockfd);
+    c->conn.abort_prefetch();
+    LOG_INFO("close fd %d", sockfd);
+    timer->cb_func(&c->data);
     if (timer) {
         utils.m_timer_lst.del_timer(timer);
     }
-    LOG_INFO("close fd %d", users_timer[sockfd].sockfd);
 }
 
 /* 处理客户端连接 */
+/* accept4 直接得到非阻塞、exec 时关闭的 fd，不再另外 fcntl。
+    ET 必须 accept 到 EAGAIN；LT 每次最多 ACCEPT_BATCH 个，剩下的下一轮 epoll_wait 还会通知，
+    连接突发时既不用每个连接一次 epoll_wait，也不会让已有连接的事件等太久 */
 bool WebServer::dealclientdata() {
     struct sockaddr_in client_address;
-    socklen_t client_addrlength = sizeof(client_address);
+    socklen_t client_addrlength;
 
-    if (m_LISTENTrigmode == 0) {  /* LT */
-        int connfd = accept(m_listenfd, (struct sockaddr*)&client_address, &client_addrlength);
+    for (int i = 0; m_LISTENTrigmode == 1 || i < ACCEPT_BATCH; i++) {
+        client_addrlength = sizeof(client_address);
+        int connfd = accept4(m_listenfd, (struct sockaddr*)&client_address, &client_addrlength,
+                             SOCK_NONBLOCK | SOCK_CLOEXEC);
         if (connfd < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                break;
+            }
             LOG_ERROR("accept error: errno is: %d", errno);
             return false;
         }
-        if (http_conn::m_user_count >= MAX_FD) {
-            utils.show_error(connfd, "Internal server busy");
-            LOG_ERROR("%s", "Internal server busy");
-            return false;
-        }
-        timer(connfd, client_address);  /* 连接成功， 初始化该连接并且创建定时器 */
-    }  
-    else {  /* ET */
-        while (1) {
-            int connfd = accept(m_listenfd, (struct sockaddr*)&client_address, &client_addrlength);
-            if (connfd < 0) {
-                LOG_ERROR("accept error: errno is: %d", errno);
-                break;
-            }
-            if (http_conn::m_user_count >= MAX_FD) {
-                utils.show_error(connfd, "Internal server busy");  /* send 到客户端 */
-                LOG_ERROR("%s", "Internal server busy");  /* log日志中 自定义的四组宏， 用来调用write_log函数 */
-                break;
+        METRIC_ADD(M_ACCEPTS, 1);
+        /* 处理 SYN 的 CPU 不属于本事件循环：引导没有生效(列表外的 CPU、组里只有一个 socket) */
+        if (cpu_affinity::get_instance()->enabled()) {
+            int incoming = -1;
+            socklen_t len = sizeof(incoming);
+            if (getsockopt(connfd, SOL_SOCKET, SO_INCOMING_CPU, &incoming, &len) == 0 &&
+                !cpu_affinity::get_instance()->owns(m_loop, incoming)) {
+                METRIC_ADD(M_ACCEPT_REMOTE_CPU, 1);
             }
-            timer(connfd, client_address);  /* 连接成功，创建定时器(fd, 客户数据) */
         }
-        return false;
+        /* fd 超出连接表(RLIMIT_NOFILE) */
+        if (connfd >= m_conns->capacity()) {
+            utils.show_error(connfd, overload_503);  /* send 到客户端 */
+            METRIC_ADD(M_SHED, 1);
+            LOG_ERROR("%s", "Internal server busy");  /* log日志中 自定义的四组宏， 用来调用write_log函数 */
+            continue;
+        }
+        /* 同一 IP 的连接速率和同时连接数 */
+        if (!rate_limiter::get_instance()->admit_connection(client_address.sin_addr.s_addr)) {
+            utils.show_error(connfd, too_many_429);
+            continue;
+        }
+        timer(connfd, client_address);  /* 连接成功， 初始化该连接并且创建定时器 */
     }
     return true;
 }
@@ -251,6 +767,17 @@ bool WebServer::dealwithsignal(bool& timeout, bool& stop_server) {
                     stop_server = true;  /* 地址传参 */
                     break;
                 }
+                case SIGQUIT: {
+                    drain();
+                    break;
+                }
+                /* 多进程时由主进程升级，工作进程忽略 */
+                case SIGUSR2: {
+                    if (m_workers == 0 && start_upgrade(vector<int>(1, m_listenfd))) {
+                        utils.addfd(m_epollfd, m_upgrade_fd, false, 0);
+                    }
+                    break;
+                }
             }   
         }
     }
@@ -259,7 +786,11 @@ bool WebServer::dealwithsignal(bool& timeout, bool& stop_server) {
 
 /* 两种事件处理模式， 处理 读数据 */
 void WebServer::dealwithread(int sockfd) {
-    util_timer* timer = users_timer[sockfd].timer;  /* client_data* */
+    connection* c = m_conns->get(sockfd);
+    if (!c) {
+        return;
+    }
+    util_timer* timer = c->data.timer;
 
     /* reactor 模式 */
     if (m_actormodel == 1) {
@@ -267,66 +798,128 @@ void WebServer::dealwithread(int sockfd) {
         if (timer) {
             adjust_timer(timer);
         }
-        /* 检测到读事件，将该事件放入请求队列 */
-        m_pool->append(users + sockfd, 0);
+        /* 超过请求速率的不入队 */
+        if (!c->conn.charge_request()) {
+            reject(sockfd, too_many_429, sizeof(too_many_429) - 1);
+            return;
+        }
+        /* 检测到读事件，将该事件放入请求队列；队列已满时没有线程会置 improv，不能等。
+            工作线程在置位 improv 之后还会处理请求，直到重新注册事件，这期间定时器不能关闭连接 */
+        c->conn.to_worker();
+        if (!m_pool->append(&c->conn, 0)) {
+            c->conn.from_worker();
+            shed(sockfd);
+            return;
+        }
 
         while (true) {
-            if (users[sockfd].improv == 1) {
-                if (users[sockfd].timer_flag == 1) {
+            if (c->conn.improv == 1) {
+                if (c->conn.timer_flag == 1) {
                     deal_timer(timer, sockfd);
-                    users[sockfd].timer_flag = 0;
+                    c->conn.timer_flag = 0;
                 }
-                users[sockfd].improv = 0;
+                c->conn.improv = 0;
                 break;
             }
         }
     }
     /* proactor */
     else {
-        if (users[sockfd].read()) {  /* 主读 */
-            LOG_INFO("deal with the client(%s)", inet_ntoa(users[sockfd].get_address()->sin_addr));  /* users是http_conn*类型 */
-            /* 读完之后将任务交给工作线程 */
-            m_pool->append_p(users + sockfd);   /* 业务逻辑 ： 请求解析 */
-            if (timer) {
-                adjust_timer(timer);
+        /* 常驻注册下读缓冲区满时 socket 里还有数据，不会再有边缘通知：请求处理完、响应发完后接着读 */
+        do {
+            if (!c->conn.read()) {  /* 主读 */
+                deal_timer(timer, sockfd);
+                return;
             }
-        }
-        else {
-            deal_timer(timer, sockfd);
+            LOG_INFO("deal with the client(%s)", inet_ntoa(c->conn.get_address()->sin_addr));
+            if (!c->conn.charge_request()) {
+                reject(sockfd, too_many_429, sizeof(too_many_429) - 1);
+                return;
+            }
+            /* 命中缓存等不需要文件 I/O 的请求直接在本线程处理，其余交给工作线程 */
+            http_conn::INLINE_STATUS status = c->conn.process_inline();
+            if (status == http_conn::INLINE_CLOSE) {
+                deal_timer(timer, sockfd);
+                return;
+            }
+            if (status == http_conn::INLINE_NONE) {
+                c->conn.to_worker();
+                if (!m_pool->append_p(&c->conn)) {   /* 业务逻辑 ： 请求解析 */
+                    c->conn.from_worker();
+                    shed(sockfd);
+                    return;
+                }
+            }
+        } while (http_conn::m_persistent && c->conn.read_ready() && !c->conn.sending() && !c->conn.in_worker());
+        if (timer) {
+            adjust_timer(timer);
         }
     }
 }
 
 /* 两种事件处理模式， 处理 写数据*/
 void WebServer::dealwithwrite(int sockfd) {
-    util_timer* timer = users_timer[sockfd].timer;
+    connection* c = m_conns->get(sockfd);
+    if (!c) {
+        return;
+    }
+    util_timer* timer = c->data.timer;
 
     /* reactor 模式 */
     if (m_actormodel == 1) {
         if (timer) {
             adjust_timer(timer);
         }
-        m_pool->append(users + sockfd, 1);  /* users + sockfd 定位users数组中请求的位置并被选择 */
+        c->conn.to_worker();
+        if (!m_pool->append(&c->conn, 1)) {
+            c->conn.from_worker();
+            shed(sockfd);
+            return;
+        }
 
         while (true) {
-            if (users[sockfd].improv == 1) {
-                if (users[sockfd].timer_flag) {
+            if (c->conn.improv == 1) {
+                if (c->conn.timer_flag) {
                     deal_timer(timer, sockfd);
-                    users[sockfd].timer_flag = 0;
+                    c->conn.timer_flag = 0;
                 }
-                users[sockfd].improv = 0;
+                c->conn.improv = 0;
                 break;
             }
         }
     }
     /* proactor 模式 */  /* 完成事件 */
     else {
-        if (users[sockfd].write()) {
-            LOG_INFO("send data to the client(%s)", inet_ntoa(users[sockfd].get_address()->sin_addr));
+        if (c->conn.write()) {
+            LOG_INFO("send data to the client(%s)", inet_ntoa(c->conn.get_address()->sin_addr));
+            /* 流水线中的下一个请求已经在读缓冲区里，先尝试快速路径，否则交给工作线程 */
+            if (c->conn.has_pending_request()) {
+                if (!c->conn.charge_request()) {
+                    reject(sockfd, too_many_429, sizeof(too_many_429) - 1);
+                    return;
+                }
+                http_conn::INLINE_STATUS status = c->conn.process_inline();
+                if (status == http_conn::INLINE_CLOSE) {
+                    deal_timer(timer, sockfd);
+                    return;
+                }
+                if (status == http_conn::INLINE_NONE) {
+                    c->conn.to_worker();
+                    if (!m_pool->append_p(&c->conn)) {
+                        c->conn.from_worker();
+                        shed(sockfd);
+                        return;
+                    }
+                }
+            }
 
             if (timer) {
                 adjust_timer(timer);
             }
+            /* 常驻注册：发送期间到达的数据已记下，响应发完再读 */
+            if (http_conn::m_persistent && c->conn.read_ready() && !c->conn.sending() && !c->conn.in_worker()) {
+                dealwithread(sockfd);
+            }
         }
         else {
             deal_timer(timer, sockfd);
@@ -334,12 +927,106 @@ void WebServer::dealwithwrite(int sockfd) {
     }
 }
 
+/* 常驻注册(ET + proactor)的连接上的事件：EPOLLIN 和 EPOLLOUT 同时关注，不再重新注册。
+    工作线程处理期间的事件忽略，hand_back 会让内核重新通知；
+    响应没发完时先发送(等待预读时等预读完成)，读事件记下来，发完再读 */
+void WebServer::dealwithevent(int sockfd, uint32_t events) {
+    connection* c = m_conns->get(sockfd);
+    if (!c || c->conn.in_worker()) {
+        return;
+    }
+    if (events & (EPOLLRDHUP | EPOLLHUP | EPOLLERR)) {
+        deal_timer(c->data.timer, sockfd);
+        return;
+    }
+    if (events & EPOLLIN) {
+        c->conn.set_read_ready();
+    }
+    if (c->conn.sending()) {
+        if (!c->conn.waiting_prefetch()) {
+            dealwithwrite(sockfd);
+        }
+        return;
+    }
+    if (c->conn.read_ready()) {
+        dealwithread(sockfd);
+    }
+}
+
+/* 线程池队列已满：回一个预先渲染的 503 并关闭连接，不让请求悄悄丢掉、连接挂到定时器超时 */
+void WebServer::shed(int sockfd) {
+    METRIC_ADD(M_SHED, 1);
+    LOG_WARN("%s", "work queue full, request shed");
+    reject(sockfd, overload_503, sizeof(overload_503) - 1);
+}
+
+/* 发送预先渲染的应答并关闭连接 */
+void WebServer::reject(int sockfd, const char* response, size_t len) {
+    send(sockfd, response, len, MSG_DONTWAIT | MSG_NOSIGNAL);
+    deal_timer(m_conns->get(sockfd)->data.timer, sockfd);
+}
+
+/* 队列深度超过高水位(3/4)时把 listenfd 移出 epoll，新连接留在内核的 accept 队列里；
+    降到低水位(1/4)以下再恢复。每轮事件处理完调用一次 */
+void WebServer::update_accept() {
+    if (m_draining) {
+        return;
+    }
+    int depth = m_pool->depth();
+    if (!m_accept_paused && depth >= m_max_queue - m_max_queue / 4) {
+        epoll_ctl(m_epollfd, EPOLL_CTL_DEL, m_listenfd, 0);
+        m_accept_paused = true;
+        METRIC_ADD(M_ACCEPT_PAUSES, 1);
+        METRIC_ADD(M_ACCEPT_PAUSED, 1);
+        LOG_WARN("accept paused, queue depth %d", depth);
+    }
+    else if (m_accept_paused && depth <= m_max_queue / 4) {
+        watch_listener();
+        m_accept_paused = false;
+        METRIC_ADD(M_ACCEPT_PAUSED, -1);
+        LOG_INFO("accept resumed, queue depth %d", depth);
+    }
+}
+
+/* 多个工作进程共用一个监听 socket 时以 EPOLLEXCLUSIVE 注册，新连接只唤醒其中一个进程，不会所有进程一起醒来抢 accept */
+void WebServer::watch_listener() {
+    if (m_workers > 0 && !cpu_affinity::get_instance()->enabled()) {
+        epoll_event event;
+        event.data.fd = m_listenfd;
+        event.events = EPOLLIN | EPOLLEXCLUSIVE;
+        if (m_LISTENTrigmode == 1) {
+            event.events |= EPOLLET;
+        }
+        epoll_ctl(m_epollfd, EPOLL_CTL_ADD, m_listenfd, &event);
+        utils.setNonBlocking(m_listenfd);
+        return;
+    }
+    utils.addfd(m_epollfd, m_listenfd, false, m_LISTENTrigmode);
+}
+
+/* I/O 线程预读完成，继续发送等待它的连接；预读期间已关闭的连接 seq 不匹配，跳过 */
+void WebServer::dealwithprefetch() {
+    io_done done[64];
+    int n;
+    while ((n = io_pool::get_instance()->completions(done, 64)) > 0) {
+        for (int i = 0; i < n; i++) {
+            connection* c = m_conns->get(done[i].sockfd);
+            if (c && c->conn.prefetch_done(done[i].seq)) {
+                dealwithwrite(done[i].sockfd);
+            }
+        }
+    }
+}
+
 void WebServer::eventLoop() {
     bool timeout = false;
     bool stop_server = false;
+    time_t swept = 0;
 
     while (!stop_server) {  /* dealwithsignal()函数会修改 stop_server 成员变量 */  /* 接收到的信号类型是SIGTERM时 */
-        int number = epoll_wait(m_epollfd, events, MAX_EVENT_NUMBER, -1);  /* event(buf) */
+        /* 暂停 accept 期间定期醒来检查队列是否已降到低水位 */
+        /* 排空期间每秒醒来检查是否超时 */
+        int number = epoll_wait(m_epollfd, events, MAX_EVENT_NUMBER, m_accept_paused ? 10 : m_draining ? 1000 : -1);  /* event(buf) */
         if (number < 0 && errno != EINTR) {
             LOG_ERROR("%s", "epoll failure");
             break;
@@ -355,31 +1042,72 @@ void WebServer::eventLoop() {
                     continue;
                 }
             }
+            /* 恢复等待完成的协程 */
+            else if (coro_loop::get_instance()->enabled() &&
+                     (sockfd == coro_loop::get_instance()->poll_fd() || sockfd == coro_loop::get_instance()->notify_fd())) {
+                coro_loop::get_instance()->run();
+            }
+            /* 升级启动的新程序回应了 */
+            else if (sockfd == m_upgrade_fd) {
+                if (upgrade_reply() == 1) {
+                    drain();
+                }
+            }
+            /* 常驻注册的连接 */
+            else if (http_conn::m_persistent && sockfd != m_pipefd[0] &&
+                     !(http_conn::m_io_offload && sockfd == io_pool::get_instance()->notify_fd())) {
+                dealwithevent(sockfd, events[i].events);
+            }
             /* 事件出错 */   /* 异常事件 */
             else if (events[i].events & (EPOLLRDHUP | EPOLLHUP | EPOLLERR)) {
-                /* 服务端关闭连接， 移出对应的定时器 */
-                deal_timer(users_timer[sockfd].timer, sockfd);
+                /* 服务端关闭连接， 移出对应的定时器；同一轮里已关闭的连接不再处理 */
+                connection* c = m_conns->get(sockfd);
+                if (c) {
+                    deal_timer(c->data.timer, sockfd);
+                }
             }
             /* 处理信号 */   /* 异常事件 */
             else if ((sockfd == m_pipefd[0]) && (events[i].events & EPOLLIN)) {
                 bool flag = dealwithsignal(timeout, stop_server);
-                if (flag = false) {
+                if (flag == false) {
                     LOG_ERROR("%s", "dealclientdata failure");
                 }
             }
-            /* 处理读事件 */
-            else if (events[i].events & EPOLLIN) {
-                dealwithread(sockfd);
+            /* 预读完成 */
+            else if (http_conn::m_io_offload && sockfd == io_pool::get_instance()->notify_fd()) {
+                dealwithprefetch();
             }
-            /* 处理写事件 */
-            else if (events[i].events & EPOLLOUT) {
-                dealwithwrite(sockfd);
+            /* 处理读写事件，EPOLLONESHOT 的注册已随这次通知失效 */
+            else if (events[i].events & (EPOLLIN | EPOLLOUT)) {
+                connection* c = m_conns->get(sockfd);
+                if (!c) {
+                    continue;
+                }
+                c->conn.fired();
+                /* 处理读事件 */
+                if (events[i].events & EPOLLIN) {
+                    dealwithread(sockfd);
+                }
+                /* 处理写事件 */
+                else {
+                    dealwithwrite(sockfd);
+                }
             }
         }
+        update_accept();
         if (timeout) {
             utils.timer_handler();
             LOG_INFO("%s", "timer tick");  /* 写日志 */
             timeout = false;
         }
+        /* 排空期间每秒关闭一次空闲连接 */
+        if (m_draining && time(nullptr) != swept) {
+            swept = time(nullptr);
+            close_idle();
+            if (http_conn::m_user_count == 0 || swept >= m_drain_deadline) {
+                LOG_INFO("drained, %d connections left", http_conn::m_user_count);
+                stop_server = true;
+            }
+        }
     }
 }
@@ -11,14 +11,26 @@
 #include <stdio.h>
 #include <cassert>
 #include <sys/epoll.h>
+#include <sys/prctl.h>
+#include <sys/wait.h>
+#include <sys/syscall.h>
+#include <signal.h>
+#include <netinet/tcp.h>
 #include <string>
+#include <vector>
+#include <algorithm>
 
 #include "../threadpool/threadpool.hpp"
 #include "../http/http_conn.h"
+#include "../http/conn_table.h"
+#include "../cpu/cpu_affinity.h"
 
-const int MAX_FD = 65535;  /* 最大文件描述符 */
 const int MAX_EVENT_NUMBER = 10000;  /* 最大事件数 */
 const int TIMESLOT = 5;  /* 最小超时单位 */
+const int ACCEPT_BATCH = 64;  /* LT 模式下每次 listenfd 可读时最多 accept 的连接数 */
+const char UPGRADE_ENV[] = "WEBSERVER_UPGRADE_FD";  /* 由旧进程 exec 而来时，与旧进程相连的 fd */
+const int UPGRADE_FD = 3;
+const size_t UPGRADE_KEYS_MAX = 64 << 10;  /* 交给新进程预热的缓存键总长上限 */
 
 
 class WebServer{
@@ -28,8 +40,15 @@ public:
 
     void init(int port, string user, string password, string dataBaseName, 
               int log_write, int opt_linger, int trigMode, int sql_num,
-              int thread_num, int close_log, int actor_model);
+              int thread_num, int close_log, int actor_model, string upload_dir,
+              int gzip_cache_mb, int cache_file_kb, int cache_mb,
+              string bundle, int io_threads, int max_queue,
+              int conn_rate, int req_rate, int max_conns,
+              int backlog, int defer_accept, int fastopen, string cpus,
+              int workers, int drain_sec, int co_threads);
     
+    void set_command(char* argv[]);
+    void prefork();
     void thread_pool();
     void sql_pool();
     void log_write();
@@ -43,6 +62,19 @@ public:
     bool dealwithsignal(bool& timeout, bool& stop_serer);
     void dealwithread(int sockfd);
     void dealwithwrite(int sockfd);
+    void dealwithevent(int sockfd, uint32_t events);
+    void dealwithprefetch();
+    void shed(int sockfd);
+    void reject(int sockfd, const char* response, size_t len);
+    void update_accept();
+    int open_listener(int loop);
+    void watch_listener();
+    void inherit();
+    bool start_upgrade(const vector<int>& listeners);
+    int upgrade_reply();
+    void upgrade_ready();
+    void drain();
+    void close_idle();
 
 public:
     // 基础信息 
@@ -51,10 +83,11 @@ public:
     int m_log_write;
     int m_close_log;
     int m_actormodel;
+    string m_upload_dir;
 
     int m_pipefd[2];
     int m_epollfd;
-    http_conn* users;
+    conn_table* m_conns;  /* fd -> 连接(http_conn 和定时器数据) */
 
     /* 数据库相关 */
     connection_pool* m_connPool;
@@ -66,18 +99,37 @@ public:
     /* 线程池相关 */
     threadpool<http_conn> * m_pool;
     int m_thread_num;
+    int m_io_threads;  /* 文件预读线程数，仅 proactor 模式使用 */
+    int m_co_threads;  /* 协程阻塞调用线程数，仅 proactor 模式使用 */
+    int m_max_queue;  /* 线程池请求队列的上限，满了的请求以 503 拒绝 */
+    bool m_accept_paused;  /* 队列深度超过高水位，listenfd 已移出 epoll */
 
     /* epoll_event 相关 */
     epoll_event events[MAX_EVENT_NUMBER];
 
     int m_listenfd;
     int m_OPT_LINGER;
+    int m_backlog;  /* listen 的连接队列长度 */
+    int m_defer_accept;  /* TCP_DEFER_ACCEPT 的秒数，0 表示不用 */
+    int m_fastopen;  /* TCP_FASTOPEN 的队列长度，0 表示不用 */
+    int m_loop;  /* 本事件循环的序号(多进程时即工作进程的序号)，决定使用的 CPU 和在 reuseport 组中的下标 */
+    int m_workers;  /* 工作进程数，0 表示单进程 */
+    vector<int> m_inherited;  /* 从旧进程接收的监听 socket */
+    int m_ready_pipe[2];  /* 多进程升级时工作进程开始监听后各写一个字节，主进程数够了再通知旧进程 */
+    sigset_t m_sigmask;  /* 多进程主进程阻塞信号之前的信号掩码 */
+
+    /* 平滑升级和退出 */
+    char** m_argv;  /* 启动时的命令行 */
+    int m_drain_sec;  /* 停止 accept 后等待已有连接的最长秒数 */
+    bool m_draining;
+    time_t m_drain_deadline;
+    int m_upgrade_fd;  /* 旧进程：与新程序相连的 Unix socket；新程序：从旧进程继承的一端；没有升级时为 -1 */
+    pid_t m_upgrade_pid;
     int m_TRIGMode;
     int m_LISTENTrigmode;
     int m_CONNTrigmode;
 
     /* 定时器相关 */
-    client_data* users_timer;
     Utils utils;
 };
 
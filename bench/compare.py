@@ -0,0 +1,56 @@
+#!/usr/bin/env python3
+# 对比两次 micro_bench --json 的结果，按 real_time(ns/op) 找出回退
+#
+# 用法: bench/compare.py base.json new.json [--threshold 0.10]
+#   变慢超过阈值的测试标记为 REGRESSION，存在回退时退出码为 1，可直接用于 CI
+
+import argparse
+import json
+import sys
+
+
+def load(path):
+    with open(path) as f:
+        data = json.load(f)
+    return {b["name"]: b for b in data["benchmarks"]}
+
+
+def main():
+    parser = argparse.ArgumentParser(description="compare two micro_bench JSON results")
+    parser.add_argument("base")
+    parser.add_argument("new")
+    parser.add_argument("--threshold", type=float, default=0.10,
+                        help="relative slowdown treated as a regression (default 0.10)")
+    args = parser.parse_args()
+
+    base = load(args.base)
+    new = load(args.new)
+
+    regressions = 0
+    print("%-45s %14s %14s %9s" % ("benchmark", "base ns/op", "new ns/op", "change"))
+    for name in base:
+        if name not in new:
+            print("%-45s %14.1f %14s %9s" % (name, base[name]["real_time"], "-", "missing"))
+            continue
+        old_t = base[name]["real_time"]
+        new_t = new[name]["real_time"]
+        change = (new_t - old_t) / old_t if old_t > 0 else 0.0
+        mark = ""
+        if change > args.threshold:
+            mark = "  REGRESSION"
+            regressions += 1
+        elif change < -args.threshold:
+            mark = "  improved"
+        print("%-45s %14.1f %14.1f %+8.1f%%%s" % (name, old_t, new_t, change * 100, mark))
+    for name in new:
+        if name not in base:
+            print("%-45s %14s %14.1f %9s" % (name, "-", new[name]["real_time"], "new"))
+
+    if regressions:
+        print("\n%d benchmark(s) regressed by more than %.0f%%" % (regressions, args.threshold * 100))
+        return 1
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,648 @@
+/***************************************************************/
+/* HTTP 压测工具：多线程，每个线程一个 epoll 循环驱动若干连接        */
+/* 支持长/短连接、流水线深度、请求混合、固定速率(开环)压测          */
+/* 固定速率下延迟从"计划发送时刻"算起，避免协调遗漏(coordinated omission) */
+/***************************************************************/
+
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <signal.h>
+#include <pthread.h>
+#include <string>
+#include <vector>
+
+#include "../metrics/metrics.h"
+
+using namespace std;
+
+const int MAX_PIPELINE = 64;        /* 单连接最多在途请求数 */
+const int MAX_HEADER_LEN = 8192;    /* 响应头最大长度 */
+const int RECV_BUF_SIZE = 65536;
+
+/* 命令行参数 */
+struct bench_config {
+    bench_config() : host("127.0.0.1"), port(9006), connections(64), threads(4), duration(10),
+                     keepalive(1), pipeline(1), rate(0), timeout(5), seed(1), json(0),
+                     mix("GET /judge.html 1") {}
+    string host;
+    int port;
+    int connections;         /* 总连接数 */
+    int threads;             /* 压测线程数 */
+    int duration;            /* 压测时长(秒) */
+    int keepalive;           /* 1 长连接，0 每个请求一个连接 */
+    int pipeline;            /* 流水线深度 */
+    double rate;             /* 总请求速率(req/s)，0 表示闭环全速 */
+    int timeout;             /* 单请求超时(秒) */
+    unsigned seed;           /* 请求混合的随机种子，保证可复现 */
+    int json;                /* 以 JSON 单行输出结果 */
+    string mix;              /* 请求混合："METHOD PATH WEIGHT[,METHOD PATH WEIGHT...]" */
+};
+
+/* 预先渲染好的请求报文 */
+struct request_tmpl {
+    string bytes;
+    int weight;
+};
+
+/* 单个连接的状态 */
+struct conn_state {
+    int fd;
+    bool connecting;
+    string out;                          /* 待发送的字节 */
+    size_t out_off;
+    uint64_t inflight[MAX_PIPELINE];     /* 在途请求的起始时刻(环形队列) */
+    int head;
+    int count;
+    uint64_t next_due;                   /* 开环模式下下一个请求的计划时刻 */
+    /* 响应解析状态 */
+    char hbuf[MAX_HEADER_LEN];
+    int hlen;
+    bool in_body;
+    long long body_left;
+    int status;
+    bool close_after;
+};
+
+/* 每个压测线程的上下文，线程私有，结束后再汇总 */
+struct thread_ctx {
+    pthread_t tid;
+    int index;
+    int epfd;
+    int tfd;                             /* 开环模式下按纳秒精度唤醒到期请求 */
+    vector<conn_state> conns;
+    uint64_t interval;                   /* 开环模式下单连接的请求间隔(ns) */
+    uint32_t rng;
+    uint64_t hist[H_BUCKETS];
+    long long completed;
+    long long errors;                    /* 连接失败/被重置/丢失的请求 */
+    long long timeouts;
+    long long status_class[6];           /* 1xx ~ 5xx */
+    long long bytes;
+};
+
+static bench_config g_conf;
+static vector<request_tmpl> g_reqs;
+static int g_total_weight = 0;
+static struct sockaddr_in g_addr;
+static uint64_t g_start_ns = 0;
+static uint64_t g_deadline_ns = 0;
+
+static uint64_t now_ns() {
+    return Metrics::now_ns();
+}
+
+static void usage(const char* prog) {
+    fprintf(stderr,
+            "usage: %s [-h host] [-p port] [-c connections] [-t threads] [-d seconds]\n"
+            "          [-k 1|0 keep-alive] [-P pipeline] [-R req/s] [-T timeout] [-s seed] [-j]\n"
+            "          [-r \"GET /judge.html 8,POST /2CGISQL.cgi 1\"]\n"
+            "  -R 0 runs closed-loop at full speed; -R N paces N req/s in total and measures\n"
+            "  latency from each request's scheduled time (coordinated-omission safe).\n", prog);
+}
+
+/* 解析请求混合，POST 请求带上 do_requset 登录/注册分支期望的表单体 */
+static bool parse_mix(const string& spec) {
+    size_t pos = 0;
+    while (pos < spec.size()) {
+        size_t end = spec.find(',', pos);
+        if (end == string::npos) {
+            end = spec.size();
+        }
+        string item = spec.substr(pos, end - pos);
+        pos = end + 1;
+
+        char method[16], path[1024];
+        int weight = 1;
+        int n = sscanf(item.c_str(), "%15s %1023s %d", method, path, &weight);
+        if (n < 2 || weight <= 0) {
+            fprintf(stderr, "bad request mix item: %s\n", item.c_str());
+            return false;
+        }
+
+        request_tmpl t;
+        t.weight = weight;
+        t.bytes = string(method) + " " + path + " HTTP/1.1\r\nHost: " + g_conf.host + "\r\n";
+        t.bytes += g_conf.keepalive ? "Connection: keep-alive\r\n" : "Connection: close\r\n";
+        if (strcasecmp(method, "POST") == 0) {
+            const char* body = "user=bench&password=bench";
+            char len[64];
+            snprintf(len, sizeof(len), "Content-Length: %d\r\n", (int)strlen(body));
+            t.bytes += "Content-Type: application/x-www-form-urlencoded\r\n";
+            t.bytes += len;
+            t.bytes += "\r\n";
+            t.bytes += body;
+        }
+        else {
+            t.bytes += "\r\n";
+        }
+        g_reqs.push_back(t);
+        g_total_weight += weight;
+    }
+    return !g_reqs.empty();
+}
+
+static const string& pick_request(thread_ctx* ctx) {
+    /* xorshift32，每个线程独立种子，结果可复现 */
+    uint32_t x = ctx->rng;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    ctx->rng = x;
+    int r = (int)(x % (uint32_t)g_total_weight);
+    for (size_t i = 0; i < g_reqs.size(); i++) {
+        r -= g_reqs[i].weight;
+        if (r < 0) {
+            return g_reqs[i].bytes;
+        }
+    }
+    return g_reqs.back().bytes;
+}
+
+static void update_interest(thread_ctx* ctx, conn_state* c, int op) {
+    epoll_event ev;
+    ev.data.ptr = c;
+    ev.events = EPOLLIN | EPOLLRDHUP;
+    if (c->connecting || c->out_off < c->out.size()) {
+        ev.events |= EPOLLOUT;
+    }
+    epoll_ctl(ctx->epfd, op, c->fd, &ev);
+}
+
+static void reset_parser(conn_state* c) {
+    c->hlen = 0;
+    c->in_body = false;
+    c->body_left = 0;
+    c->status = 0;
+    c->close_after = false;
+}
+
+static bool open_conn(thread_ctx* ctx, conn_state* c) {
+    c->fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (c->fd < 0) {
+        return false;
+    }
+    int one = 1;
+    setsockopt(c->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    int ret = connect(c->fd, (struct sockaddr*)&g_addr, sizeof(g_addr));
+    if (ret < 0 && errno != EINPROGRESS) {
+        close(c->fd);
+        c->fd = -1;
+        return false;
+    }
+    c->connecting = true;
+    c->out.clear();
+    c->out_off = 0;
+    reset_parser(c);
+    update_interest(ctx, c, EPOLL_CTL_ADD);
+    return true;
+}
+
+/* 关闭连接；在途但未收到响应的请求计为错误(或超时) */
+static void close_conn(thread_ctx* ctx, conn_state* c, bool timed_out) {
+    if (c->fd >= 0) {
+        epoll_ctl(ctx->epfd, EPOLL_CTL_DEL, c->fd, 0);
+        close(c->fd);
+        c->fd = -1;
+    }
+    if (timed_out) {
+        ctx->timeouts += c->count;
+    }
+    else {
+        ctx->errors += c->count;
+    }
+    c->count = 0;
+    c->head = 0;
+}
+
+/* 按流水线深度和速率把到期的请求放入发送缓冲 */
+static void fill_requests(thread_ctx* ctx, conn_state* c, uint64_t now) {
+    int depth = g_conf.keepalive ? g_conf.pipeline : 1;
+    while (c->count < depth) {
+        uint64_t start;
+        if (g_conf.rate > 0) {
+            if (c->next_due > now || c->next_due >= g_deadline_ns) {
+                break;
+            }
+            start = c->next_due;         /* 从计划时刻开始计时 */
+            c->next_due += ctx->interval;
+        }
+        else {
+            if (now >= g_deadline_ns) {
+                break;
+            }
+            start = now;
+        }
+        if (c->out_off == c->out.size()) {
+            c->out.clear();
+            c->out_off = 0;
+        }
+        c->out += pick_request(ctx);
+        c->inflight[(c->head + c->count) % MAX_PIPELINE] = start;
+        c->count++;
+    }
+}
+
+static bool flush_out(thread_ctx* ctx, conn_state* c) {
+    while (c->out_off < c->out.size()) {
+        ssize_t n = send(c->fd, c->out.data() + c->out_off, c->out.size() - c->out_off, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                break;
+            }
+            return false;
+        }
+        c->out_off += n;
+    }
+    update_interest(ctx, c, EPOLL_CTL_MOD);
+    return true;
+}
+
+/* 一个完整响应到达 */
+static void complete_response(thread_ctx* ctx, conn_state* c, uint64_t now) {
+    if (c->count > 0) {
+        uint64_t start = c->inflight[c->head];
+        c->head = (c->head + 1) % MAX_PIPELINE;
+        c->count--;
+        ctx->hist[Metrics::bucket_index(now > start ? now - start : 0)]++;
+        ctx->completed++;
+        int cls = c->status / 100;
+        if (cls >= 1 && cls <= 5) {
+            ctx->status_class[cls]++;
+        }
+    }
+}
+
+/* 解析响应头：状态码、Content-Length、Connection: close */
+static bool parse_header(conn_state* c) {
+    c->hbuf[c->hlen] = '\0';
+    if (strncmp(c->hbuf, "HTTP/1.", 7) != 0) {
+        return false;
+    }
+    c->status = atoi(c->hbuf + 9);
+    c->body_left = 0;
+    const char* cl = strcasestr(c->hbuf, "\r\nContent-Length:");
+    if (cl) {
+        c->body_left = atoll(cl + 17);
+    }
+    c->close_after = strcasestr(c->hbuf, "\r\nConnection: close") != nullptr;
+    c->in_body = true;
+    return true;
+}
+
+/* 处理收到的数据，返回 false 表示连接需要关闭 */
+static bool consume(thread_ctx* ctx, conn_state* c, const char* data, int n, uint64_t now) {
+    int pos = 0;
+    while (pos < n) {
+        if (!c->in_body) {
+            int room = MAX_HEADER_LEN - 1 - c->hlen;
+            int take = n - pos < room ? n - pos : room;
+            if (take <= 0) {
+                return false;  /* 响应头过长 */
+            }
+            int search_from = c->hlen > 3 ? c->hlen - 3 : 0;
+            memcpy(c->hbuf + c->hlen, data + pos, take);
+            c->hlen += take;
+            char* end = (char*)memmem(c->hbuf + search_from, c->hlen - search_from, "\r\n\r\n", 4);
+            if (!end) {
+                pos += take;
+                continue;
+            }
+            int header_len = (int)(end - c->hbuf) + 4;
+            /* 多拷进来的部分属于响应体或下一个响应，退回给 pos */
+            pos += take - (c->hlen - header_len);
+            c->hlen = header_len;
+            if (!parse_header(c)) {
+                return false;
+            }
+        }
+        long long body = c->body_left < n - pos ? c->body_left : n - pos;
+        c->body_left -= body;
+        pos += (int)body;
+        if (c->body_left == 0) {
+            bool close_after = c->close_after;
+            complete_response(ctx, c, now);
+            reset_parser(c);
+            if (close_after || !g_conf.keepalive) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+static void reopen(thread_ctx* ctx, conn_state* c, uint64_t now) {
+    if (now >= g_deadline_ns) {
+        return;
+    }
+    if (!open_conn(ctx, c)) {
+        ctx->errors++;
+    }
+}
+
+static void* bench_thread(void* arg) {
+    thread_ctx* ctx = (thread_ctx*)arg;
+    char* buf = new char[RECV_BUF_SIZE];
+    epoll_event events[256];
+
+    for (size_t i = 0; i < ctx->conns.size(); i++) {
+        if (!open_conn(ctx, &ctx->conns[i])) {
+            ctx->errors++;
+        }
+    }
+
+    uint64_t timeout_ns = (uint64_t)g_conf.timeout * 1000000000ULL;
+    uint64_t last_sweep = now_ns();
+    while (true) {
+        uint64_t now = now_ns();
+        if (now >= g_deadline_ns) {
+            break;
+        }
+        /* 开环模式：用 timerfd 在最早的计划时刻唤醒(毫秒级的 epoll 超时会让发送本身晚到) */
+        /* 最长等 100ms，以便检查超时和结束 */
+        if (g_conf.rate > 0) {
+            int depth = g_conf.keepalive ? g_conf.pipeline : 1;
+            uint64_t earliest = now + 100000000ULL;
+            for (size_t i = 0; i < ctx->conns.size(); i++) {
+                conn_state* c = &ctx->conns[i];
+                if (c->fd >= 0 && !c->connecting && c->count < depth && c->next_due < earliest) {
+                    earliest = c->next_due;
+                }
+            }
+            if (earliest <= now) {
+                earliest = now + 1;
+            }
+            struct itimerspec its;
+            memset(&its, 0, sizeof(its));
+            its.it_value.tv_sec = earliest / 1000000000ULL;
+            its.it_value.tv_nsec = earliest % 1000000000ULL;
+            timerfd_settime(ctx->tfd, TFD_TIMER_ABSTIME, &its, nullptr);
+        }
+        int number = epoll_wait(ctx->epfd, events, 256, 100);
+        now = now_ns();
+        for (int i = 0; i < number; i++) {
+            conn_state* c = (conn_state*)events[i].data.ptr;
+            if (c == nullptr) {  /* timerfd */
+                uint64_t expirations;
+                ssize_t ret = ::read(ctx->tfd, &expirations, sizeof(expirations));
+                (void)ret;
+                continue;
+            }
+            if (c->fd < 0) {
+                continue;
+            }
+            if (c->connecting) {
+                int err = 0;
+                socklen_t len = sizeof(err);
+                getsockopt(c->fd, SOL_SOCKET, SO_ERROR, &err, &len);
+                if (err != 0) {
+                    close_conn(ctx, c, false);
+                    ctx->errors++;
+                    reopen(ctx, c, now);
+                    continue;
+                }
+                c->connecting = false;
+                fill_requests(ctx, c, now);
+                if (!flush_out(ctx, c)) {
+                    close_conn(ctx, c, false);
+                    reopen(ctx, c, now);
+                }
+                continue;
+            }
+            if (events[i].events & EPOLLIN) {
+                bool alive = true;
+                while (alive) {
+                    ssize_t n = recv(c->fd, buf, RECV_BUF_SIZE, 0);
+                    if (n > 0) {
+                        ctx->bytes += n;
+                        alive = consume(ctx, c, buf, (int)n, now);
+                        if (n < RECV_BUF_SIZE) {
+                            break;
+                        }
+                    }
+                    else if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                        break;
+                    }
+                    else {
+                        alive = false;
+                    }
+                }
+                if (!alive) {
+                    close_conn(ctx, c, false);
+                    reopen(ctx, c, now);
+                    continue;
+                }
+            }
+            else if (events[i].events & (EPOLLRDHUP | EPOLLHUP | EPOLLERR)) {
+                close_conn(ctx, c, false);
+                reopen(ctx, c, now);
+                continue;
+            }
+            fill_requests(ctx, c, now);
+            if (!flush_out(ctx, c)) {
+                close_conn(ctx, c, false);
+                reopen(ctx, c, now);
+            }
+        }
+
+        /* 开环模式：没有事件的连接也要按时发出到期请求 */
+        if (g_conf.rate > 0) {
+            for (size_t i = 0; i < ctx->conns.size(); i++) {
+                conn_state* c = &ctx->conns[i];
+                if (c->fd >= 0 && !c->connecting && c->next_due <= now) {
+                    fill_requests(ctx, c, now);
+                    if (!flush_out(ctx, c)) {
+                        close_conn(ctx, c, false);
+                        reopen(ctx, c, now);
+                    }
+                }
+            }
+        }
+
+        /* 每 100ms 检查一次超时请求 */
+        if (now - last_sweep > 100000000ULL) {
+            last_sweep = now;
+            for (size_t i = 0; i < ctx->conns.size(); i++) {
+                conn_state* c = &ctx->conns[i];
+                if (c->fd >= 0 && c->count > 0 && now - c->inflight[c->head] > timeout_ns) {
+                    close_conn(ctx, c, true);
+                    reopen(ctx, c, now);
+                }
+            }
+        }
+    }
+
+    for (size_t i = 0; i < ctx->conns.size(); i++) {
+        conn_state* c = &ctx->conns[i];
+        if (c->fd >= 0) {
+            epoll_ctl(ctx->epfd, EPOLL_CTL_DEL, c->fd, 0);
+            close(c->fd);
+            c->fd = -1;
+        }
+    }
+    delete[] buf;
+    return nullptr;
+}
+
+/* 从合并后的直方图取百分位，返回所在桶的中点(ns) */
+static double percentile(const uint64_t* hist, uint64_t total, double q) {
+    if (total == 0) {
+        return 0;
+    }
+    uint64_t rank = (uint64_t)(q * total);
+    if (rank >= total) {
+        rank = total - 1;
+    }
+    uint64_t seen = 0;
+    for (int b = 0; b < H_BUCKETS; b++) {
+        seen += hist[b];
+        if (seen > rank) {
+            uint64_t lo = Metrics::bucket_lower(b);
+            uint64_t hi = b + 1 < H_BUCKETS ? Metrics::bucket_lower(b + 1) : lo;
+            return (lo + hi) / 2.0;
+        }
+    }
+    return (double)Metrics::bucket_lower(H_BUCKETS - 1);
+}
+
+int main(int argc, char* argv[]) {
+    int opt;
+    const char* str = "h:p:c:t:d:k:P:R:r:T:s:j";
+    while ((opt = getopt(argc, argv, str)) != -1) {
+        switch (opt) {
+        case 'h': g_conf.host = optarg; break;
+        case 'p': g_conf.port = atoi(optarg); break;
+        case 'c': g_conf.connections = atoi(optarg); break;
+        case 't': g_conf.threads = atoi(optarg); break;
+        case 'd': g_conf.duration = atoi(optarg); break;
+        case 'k': g_conf.keepalive = atoi(optarg); break;
+        case 'P': g_conf.pipeline = atoi(optarg); break;
+        case 'R': g_conf.rate = atof(optarg); break;
+        case 'r': g_conf.mix = optarg; break;
+        case 'T': g_conf.timeout = atoi(optarg); break;
+        case 's': g_conf.seed = (unsigned)strtoul(optarg, nullptr, 10); break;
+        case 'j': g_conf.json = 1; break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (g_conf.threads <= 0 || g_conf.connections < g_conf.threads || g_conf.duration <= 0 ||
+        g_conf.pipeline <= 0 || g_conf.pipeline > MAX_PIPELINE || g_conf.rate < 0) {
+        usage(argv[0]);
+        return 1;
+    }
+    if (!parse_mix(g_conf.mix)) {
+        return 1;
+    }
+
+    struct hostent* he = gethostbyname(g_conf.host.c_str());
+    if (!he) {
+        fprintf(stderr, "cannot resolve %s\n", g_conf.host.c_str());
+        return 1;
+    }
+    memset(&g_addr, 0, sizeof(g_addr));
+    g_addr.sin_family = AF_INET;
+    g_addr.sin_port = htons(g_conf.port);
+    memcpy(&g_addr.sin_addr, he->h_addr_list[0], sizeof(g_addr.sin_addr));
+    signal(SIGPIPE, SIG_IGN);
+
+    g_start_ns = now_ns();
+    g_deadline_ns = g_start_ns + (uint64_t)g_conf.duration * 1000000000ULL;
+
+    /* 连接均分到各线程；开环模式下各连接的首个计划时刻均匀错开 */
+    vector<thread_ctx*> ctxs;
+    uint64_t per_conn_interval = g_conf.rate > 0 ? (uint64_t)(1e9 * g_conf.connections / g_conf.rate) : 0;
+    int conn_index = 0;
+    for (int i = 0; i < g_conf.threads; i++) {
+        thread_ctx* ctx = new thread_ctx();
+        ctx->index = i;
+        ctx->epfd = epoll_create1(EPOLL_CLOEXEC);
+        ctx->tfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+        epoll_event tev;
+        tev.data.ptr = nullptr;
+        tev.events = EPOLLIN;
+        epoll_ctl(ctx->epfd, EPOLL_CTL_ADD, ctx->tfd, &tev);
+        ctx->interval = per_conn_interval;
+        ctx->rng = g_conf.seed * 2654435761u + i + 1;
+        int n = g_conf.connections / g_conf.threads + (i < g_conf.connections % g_conf.threads ? 1 : 0);
+        ctx->conns.resize(n);
+        for (int j = 0; j < n; j++, conn_index++) {
+            conn_state* c = &ctx->conns[j];
+            c->fd = -1;
+            c->count = 0;
+            c->head = 0;
+            c->next_due = g_start_ns + (g_conf.rate > 0 ? (uint64_t)(conn_index * 1e9 / g_conf.rate) : 0);
+        }
+        ctxs.push_back(ctx);
+    }
+    for (size_t i = 0; i < ctxs.size(); i++) {
+        pthread_create(&ctxs[i]->tid, nullptr, bench_thread, ctxs[i]);
+    }
+
+    /* 汇总 */
+    uint64_t hist[H_BUCKETS];
+    memset(hist, 0, sizeof(hist));
+    long long completed = 0, errors = 0, timeouts = 0, bytes = 0;
+    long long status_class[6] = {0};
+    for (size_t i = 0; i < ctxs.size(); i++) {
+        pthread_join(ctxs[i]->tid, nullptr);
+        for (int b = 0; b < H_BUCKETS; b++) {
+            hist[b] += ctxs[i]->hist[b];
+        }
+        completed += ctxs[i]->completed;
+        errors += ctxs[i]->errors;
+        timeouts += ctxs[i]->timeouts;
+        bytes += ctxs[i]->bytes;
+        for (int k = 0; k < 6; k++) {
+            status_class[k] += ctxs[i]->status_class[k];
+        }
+        close(ctxs[i]->tfd);
+        close(ctxs[i]->epfd);
+        delete ctxs[i];
+    }
+    double elapsed = (now_ns() - g_start_ns) / 1e9;
+    double p50 = percentile(hist, completed, 0.50) / 1e3;
+    double p90 = percentile(hist, completed, 0.90) / 1e3;
+    double p99 = percentile(hist, completed, 0.99) / 1e3;
+    double p999 = percentile(hist, completed, 0.999) / 1e3;
+    double pmax = 0;
+    for (int b = H_BUCKETS - 1; b >= 0; b--) {
+        if (hist[b]) {
+            pmax = (b + 1 < H_BUCKETS ? Metrics::bucket_lower(b + 1) : Metrics::bucket_lower(b)) / 1e3;
+            break;
+        }
+    }
+
+    if (g_conf.json) {
+        printf("{\"connections\":%d,\"threads\":%d,\"duration\":%.3f,\"keepalive\":%d,\"pipeline\":%d,"
+               "\"rate\":%.1f,\"requests\":%lld,\"errors\":%lld,\"timeouts\":%lld,\"rps\":%.1f,\"mbps\":%.3f,"
+               "\"2xx\":%lld,\"3xx\":%lld,\"4xx\":%lld,\"5xx\":%lld,"
+               "\"p50_us\":%.1f,\"p90_us\":%.1f,\"p99_us\":%.1f,\"p999_us\":%.1f,\"max_us\":%.1f}\n",
+               g_conf.connections, g_conf.threads, elapsed, g_conf.keepalive, g_conf.pipeline, g_conf.rate,
+               completed, errors, timeouts, completed / elapsed, bytes / elapsed / 1e6,
+               status_class[2], status_class[3], status_class[4], status_class[5],
+               p50, p90, p99, p999, pmax);
+    }
+    else {
+        printf("%d connections, %d threads, %.2fs, keep-alive %s, pipeline %d, rate %s\n",
+               g_conf.connections, g_conf.threads, elapsed, g_conf.keepalive ? "on" : "off", g_conf.pipeline,
+               g_conf.rate > 0 ? "fixed" : "unbounded");
+        printf("  requests  %lld (2xx %lld, 3xx %lld, 4xx %lld, 5xx %lld), errors %lld, timeouts %lld\n",
+               completed, status_class[2], status_class[3], status_class[4], status_class[5], errors, timeouts);
+        printf("  throughput %.1f req/s, %.2f MB/s\n", completed / elapsed, bytes / elapsed / 1e6);
+        printf("  latency(us) p50 %.1f  p90 %.1f  p99 %.1f  p999 %.1f  max %.1f\n", p50, p90, p99, p999, pmax);
+    }
+    return 0;
+}
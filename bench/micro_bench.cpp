@@ -0,0 +1,921 @@
+/***************************************************************/
+/* 微基准测试：请求解析、定时器链表、阻塞队列、线程池、数据库连接池、限流表、请求路径的堆分配 */
+/* 自包含的计时框架，迭代次数自动放大到最短运行时间；               */
+/* --json 输出与 Google Benchmark 相同结构的 JSON，可用 compare.py 对比 */
+/***************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sched.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <atomic>
+#include <string>
+#include <vector>
+
+#include "../http/http_conn.h"
+#include "../http/http_scan.h"
+#include "../timer/lst_timer.h"
+#include "../log/block_queue.hpp"
+#include "../threadpool/threadpool.hpp"
+#include "../sql_conn_pool/sql_connection_pool.h"
+#include "../metrics/metrics.h"
+
+using namespace std;
+
+/* 一次基准测试的结果 */
+struct bench_result {
+    string name;
+    long long iterations;
+    double ns_per_op;
+    double items_per_second;
+    double p50_ns;                  /* 仅延迟类测试填写 */
+    double p99_ns;
+    bool has_latency;
+};
+
+/* 运行 iters 次，返回耗时(ns)；可顺带填写延迟分位数 */
+typedef uint64_t (*bench_fn)(long long iters, int arg, bench_result& r);
+
+struct bench_case {
+    string name;
+    bench_fn fn;
+    int arg;
+};
+
+static double g_min_time = 0.5;    /* 每个测试最短运行时间(秒) */
+
+/* 从直方图取分位数(桶中点) */
+static double hist_percentile(const uint64_t* hist, uint64_t total, double q) {
+    if (total == 0) {
+        return 0;
+    }
+    uint64_t rank = (uint64_t)(q * total);
+    if (rank >= total) {
+        rank = total - 1;
+    }
+    uint64_t seen = 0;
+    for (int b = 0; b < H_BUCKETS; b++) {
+        seen += hist[b];
+        if (seen > rank) {
+            uint64_t lo = Metrics::bucket_lower(b);
+            uint64_t hi = b + 1 < H_BUCKETS ? Metrics::bucket_lower(b + 1) : lo;
+            return (lo + hi) / 2.0;
+        }
+    }
+    return 0;
+}
+
+/************************** 堆分配计数 **************************/
+/* glibc 下可执行文件中定义的 malloc 等覆盖 libc 的版本，计数后转发给 __libc_*；
+    operator new 也经过 malloc，一并计入。只统计打开了 t_count_allocs 的线程 */
+static __thread bool t_count_allocs = false;
+static atomic<long long> g_allocs(0);
+
+#if defined(__GLIBC__) && !defined(__SANITIZE_ADDRESS__)  /* ASan 有自己的 malloc */
+extern "C" {
+void* __libc_malloc(size_t n);
+void* __libc_calloc(size_t n, size_t size);
+void* __libc_realloc(void* p, size_t n);
+
+void* malloc(size_t n) {
+    if (t_count_allocs) {
+        g_allocs.fetch_add(1, memory_order_relaxed);
+    }
+    return __libc_malloc(n);
+}
+void* calloc(size_t n, size_t size) {
+    if (t_count_allocs) {
+        g_allocs.fetch_add(1, memory_order_relaxed);
+    }
+    return __libc_calloc(n, size);
+}
+void* realloc(void* p, size_t n) {
+    if (t_count_allocs) {
+        g_allocs.fetch_add(1, memory_order_relaxed);
+    }
+    return __libc_realloc(p, n);
+}
+}
+#endif
+
+/************************** 请求解析 **************************/
+
+/* 真实请求样本 */
+static const char* CORPUS_CURL =
+    "GET /judge.html HTTP/1.1\r\n"
+    "Host: 127.0.0.1:9006\r\n"
+    "User-Agent: curl/7.88.1\r\n"
+    "Accept: */*\r\n"
+    "\r\n";
+
+static const char* CORPUS_BROWSER =
+    "GET /picture.html HTTP/1.1\r\n"
+    "Host: 192.168.1.20:9006\r\n"
+    "Connection: keep-alive\r\n"
+    "Cache-Control: max-age=0\r\n"
+    "sec-ch-ua: \"Chromium\";v=\"118\", \"Google Chrome\";v=\"118\", \"Not=A?Brand\";v=\"99\"\r\n"
+    "sec-ch-ua-mobile: ?0\r\n"
+    "sec-ch-ua-platform: \"Windows\"\r\n"
+    "Upgrade-Insecure-Requests: 1\r\n"
+    "User-Agent: Mozilla/5.0 (Windows NT 10.0; Win64; x64) AppleWebKit/537.36 (KHTML, like Gecko) Chrome/118.0.0.0 Safari/537.36\r\n"
+    "Accept: text/html,application/xhtml+xml,application/xml;q=0.9,image/avif,image/webp,image/apng,*/*;q=0.8\r\n"
+    "Sec-Fetch-Site: same-origin\r\n"
+    "Sec-Fetch-Mode: navigate\r\n"
+    "Sec-Fetch-User: ?1\r\n"
+    "Sec-Fetch-Dest: document\r\n"
+    "Referer: http://192.168.1.20:9006/welcome.html\r\n"
+    "Accept-Encoding: gzip, deflate, br\r\n"
+    "Accept-Language: zh-CN,zh;q=0.9,en;q=0.8\r\n"
+    "If-None-Match: \"1a2b3c-4d5e-6f70\"\r\n"
+    "If-Modified-Since: Tue, 10 Oct 2023 08:00:00 GMT\r\n"
+    "\r\n";
+
+static const char* CORPUS_LOGIN =
+    "POST /2CGISQL.cgi HTTP/1.1\r\n"
+    "Host: 192.168.1.20:9006\r\n"
+    "Connection: keep-alive\r\n"
+    "Content-Length: 25\r\n"
+    "Content-Type: application/x-www-form-urlencoded\r\n"
+    "Origin: http://192.168.1.20:9006\r\n"
+    "Referer: http://192.168.1.20:9006/log.html\r\n"
+    "User-Agent: Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36 (KHTML, like Gecko) Chrome/118.0.0.0 Safari/537.36\r\n"
+    "\r\n"
+    "user=bench&password=bench";
+
+static const char* corpus(int arg) {
+    switch (arg) {
+    case 0:
+        return CORPUS_CURL;
+    case 1:
+        return CORPUS_BROWSER;
+    default:
+        return CORPUS_LOGIN;
+    }
+}
+
+/************************** 报文扫描 **************************/
+
+static const http_scanner* g_scanners[HTTP_SCANNER_MAX];
+static int g_scanner_num = 0;
+
+/* 用 arg 号实现逐行扫描整个 browser 请求，再对每行做一次词元扫描 */
+static uint64_t bm_http_scan(long long iters, int arg, bench_result& r) {
+    const http_scanner* scanner = g_scanners[arg];
+    const char* req = CORPUS_BROWSER;
+    int len = strlen(req);
+    long long hits = 0;
+    uint64_t start = Metrics::now_ns();
+    for (long long i = 0; i < iters; i++) {
+        int pos = 0;
+        while (pos < len) {
+            int line_len = scanner->line(req + pos, len - pos);
+            hits += scanner->token(req + pos, line_len);
+            pos += line_len + 1;
+        }
+    }
+    uint64_t elapsed = Metrics::now_ns() - start;
+    r.items_per_second = (double)len * iters / (elapsed / 1e9);
+    if (hits == 0) {
+        fprintf(stderr, "http_scan found no tokens\n");
+    }
+    return elapsed;
+}
+
+/* 各向量化实现与标量实现对拍：先穷举单个特殊字节的位置，再随机生成 rounds 个缓冲区 */
+static int fuzz_http_scan(long long rounds) {
+    static char buf[512 + 64];
+    const char specials[] = {'\r', '\n', '\t', ' ', '\0', 0x01, 0x1f, 0x7f, (char)0x80, (char)0xff, ':'};
+    int failures = 0;
+
+    for (int s = 1; s < g_scanner_num; s++) {
+        const http_scanner* sc = g_scanners[s];
+        for (int c = 0; c < 256; c++) {
+            for (int pos = 0; pos < 80; pos++) {
+                memset(buf, 'a', 80);
+                buf[pos] = (char)c;
+                for (int len = pos; len <= 80; len += 7) {
+                    if (sc->line(buf, len) != g_scanners[0]->line(buf, len) ||
+                        sc->token(buf, len) != g_scanners[0]->token(buf, len)) {
+                        fprintf(stderr, "%s mismatch: byte 0x%02x at %d, len %d\n", sc->name, c, pos, len);
+                        failures++;
+                    }
+                }
+            }
+        }
+    }
+
+    uint32_t x = 2463534242u;
+    for (long long round = 0; round < rounds; round++) {
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+        int offset = x % 64;  /* 覆盖各种不对齐 */
+        int len = (x >> 8) % 512;
+        int density = 1 + (x >> 20) % 64;  /* 平均每 density 个字节一个特殊字符 */
+        char* p = buf + offset;
+        for (int i = 0; i < len; i++) {
+            x ^= x << 13;
+            x ^= x >> 17;
+            x ^= x << 5;
+            if (x % density == 0) {
+                p[i] = specials[(x >> 8) % sizeof(specials)];
+            }
+            else if ((x >> 8) % 16 == 0) {
+                p[i] = (char)(x >> 16);  /* 任意字节 */
+            }
+            else {
+                p[i] = 'A' + (x >> 16) % 58;
+            }
+        }
+        int expect_line = g_scanners[0]->line(p, len);
+        int expect_token = g_scanners[0]->token(p, len);
+        for (int s = 1; s < g_scanner_num; s++) {
+            const http_scanner* sc = g_scanners[s];
+            int got_line = sc->line(p, len);
+            int got_token = sc->token(p, len);
+            if (got_line != expect_line || got_token != expect_token) {
+                fprintf(stderr, "%s mismatch: round %lld offset %d len %d: line %d/%d token %d/%d\n",
+                        sc->name, round, offset, len, got_line, expect_line, got_token, expect_token);
+                failures++;
+            }
+        }
+    }
+
+    printf("http_scan fuzz: %d implementation(s) vs scalar, %lld random buffers, %d mismatch(es)\n",
+           g_scanner_num - 1, rounds, failures);
+    return failures == 0 ? 0 : 1;
+}
+
+/* 依次查找 browser 请求中出现的请求头名称 */
+static uint64_t bm_header_lookup(long long iters, int arg, bench_result& r) {
+    static const char* names[] = {"Host", "Connection", "Cache-Control", "sec-ch-ua", "sec-ch-ua-mobile",
+                                  "sec-ch-ua-platform", "Upgrade-Insecure-Requests", "User-Agent", "Accept",
+                                  "Sec-Fetch-Site", "Sec-Fetch-Mode", "Sec-Fetch-User", "Sec-Fetch-Dest",
+                                  "Referer", "Accept-Encoding", "Accept-Language", "If-None-Match",
+                                  "If-Modified-Since"};
+    const int n = sizeof(names) / sizeof(names[0]);
+    int lens[n];
+    for (int i = 0; i < n; i++) {
+        lens[i] = strlen(names[i]);
+    }
+    int known = 0;
+    uint64_t start = Metrics::now_ns();
+    for (long long i = 0; i < iters; i++) {
+        for (int j = 0; j < n; j++) {
+            known += http_header_lookup(names[j], lens[j]) != HDR_OTHER;
+        }
+    }
+    uint64_t elapsed = Metrics::now_ns() - start;
+    r.items_per_second = (double)iters * n / (elapsed / 1e9);
+    if (known == 0) {
+        fprintf(stderr, "http_header_lookup found no known header\n");
+    }
+    return elapsed;
+}
+
+/* http_conn 的友元，直接驱动私有的解析函数 */
+class micro_bench {
+public:
+    /* 把请求装入读缓冲，恢复到刚读完数据时的状态 */
+    static void load(http_conn* conn, const char* req, int len) {
+        memcpy(conn->m_read_buf, req, len);
+        conn->m_read_idx = len;
+        conn->m_checked_idx = 0;
+        conn->m_start_line = 0;
+    }
+
+    static uint64_t parse_line(long long iters, int arg, bench_result& r) {
+        http_conn* conn = new http_conn();
+        conn->init();
+        const char* req = corpus(arg);
+        int len = strlen(req);
+        long long lines = 0;
+        uint64_t start = Metrics::now_ns();
+        for (long long i = 0; i < iters; i++) {
+            load(conn, req, len);
+            while (conn->parse_line() == http_conn::LINE_OK) {
+                lines++;
+            }
+        }
+        uint64_t elapsed = Metrics::now_ns() - start;
+        r.items_per_second = (double)len * iters / (elapsed / 1e9);  /* 字节/秒 */
+        if (lines == 0) {
+            fprintf(stderr, "parse_line found no lines\n");
+        }
+        delete conn;
+        return elapsed;
+    }
+
+    /* init() + process_read：与服务器每个请求的实际开销一致 */
+    static uint64_t process_read(long long iters, int arg, bench_result& r) {
+        http_conn* conn = new http_conn();
+        const char* req = corpus(arg);
+        int len = strlen(req);
+        int complete = 0;
+        uint64_t start = Metrics::now_ns();
+        for (long long i = 0; i < iters; i++) {
+            conn->init();
+            load(conn, req, len);
+            if (conn->process_read() == http_conn::GET_REQUEST) {
+                complete++;
+            }
+        }
+        uint64_t elapsed = Metrics::now_ns() - start;
+        r.items_per_second = (double)len * iters / (elapsed / 1e9);
+        (void)complete;
+        delete conn;
+        return elapsed;
+    }
+
+    /* 完整的 keep-alive 静态 GET：read -> process -> write，经 socketpair 收发，日志打开(同步写临时文件)。
+        预热之后统计本线程的堆分配次数，不为 0 时报错退出：请求路径上的临时数据应全部来自请求内存池 */
+    static uint64_t keepalive_get(long long iters, int arg, bench_result& r) {
+        static char root[] = "/tmp/micro_bench.XXXXXX";
+        static bool prepared = false;
+        if (!prepared) {
+            if (!mkdtemp(root)) {
+                perror("mkdtemp");
+                exit(1);
+            }
+            string path = string(root) + "/index.html";
+            FILE* fp = fopen(path.c_str(), "w");
+            for (int i = 0; i < 64; i++) {
+                fputs("<p>micro_bench keep-alive static GET</p>\n", fp);
+            }
+            fclose(fp);
+            path = string(root) + "/micro_bench.log";
+            Log::get_instance()->init(path.c_str(), 0, 2000, 800000, 0);
+            prepared = true;
+        }
+
+        int sv[2];
+        if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) < 0) {
+            perror("socketpair");
+            exit(1);
+        }
+        fcntl(sv[0], F_SETFL, fcntl(sv[0], F_GETFL) | O_NONBLOCK);
+        fcntl(sv[1], F_SETFL, fcntl(sv[1], F_GETFL) | O_NONBLOCK);
+        http_conn* conn = new http_conn();
+        sockaddr_in addr;
+        memset(&addr, 0, sizeof(addr));
+        string empty;
+        conn->init(sv[0], addr, root, 0, 0, empty, empty, empty);
+
+        const char req[] = "GET /index.html HTTP/1.1\r\nHost: localhost\r\nConnection: keep-alive\r\n\r\n";
+        long long bytes = 0;
+        uint64_t start = 0;
+        for (long long i = -64; i < iters; i++) {  /* 前 64 次预热：线程的指标槽位、日志文件缓冲等一次性的分配 */
+            if (i == 0) {
+                g_allocs.store(0);
+                t_count_allocs = true;
+                start = Metrics::now_ns();
+            }
+            send(sv[1], req, sizeof(req) - 1, 0);
+            if (!conn->read()) {
+                break;
+            }
+            conn->process();
+            if (!conn->write()) {
+                break;
+            }
+            char buf[8192];
+            ssize_t n;
+            while ((n = recv(sv[1], buf, sizeof(buf), 0)) > 0) {
+                bytes += n;
+            }
+        }
+        uint64_t elapsed = Metrics::now_ns() - start;
+        t_count_allocs = false;
+        r.items_per_second = iters / (elapsed / 1e9);
+        (void)arg;
+        delete conn;
+        close(sv[0]);
+        close(sv[1]);
+        long long allocs = g_allocs.load();
+        if (allocs != 0 || bytes == 0) {
+            fprintf(stderr, "http_conn/keepalive_get: %lld heap allocations in %lld requests (%lld bytes received)\n",
+                    allocs, iters, bytes);
+            exit(1);
+        }
+        return elapsed;
+    }
+};
+
+/************************** 定时器链表 **************************/
+
+static void noop_cb(client_data* data) {
+}
+
+static util_timer* make_timer(client_data* data, time_t expire) {
+    util_timer* timer = new util_timer();
+    timer->expire = expire;
+    timer->cb_func = noop_cb;
+    timer->user_data = data;
+    return timer;
+}
+
+/* 按到期时间递增向空链表添加 arg 个定时器(与服务器中新连接的情况相同)，iters 为 add 次数 */
+static uint64_t bm_timer_add(long long iters, int arg, bench_result& r) {
+    client_data data;
+    long long rounds = (iters + arg - 1) / arg;
+    uint64_t elapsed = 0;
+    vector<util_timer*> timers(arg);
+    for (long long i = 0; i < rounds; i++) {
+        sort_timer_lst lst;
+        for (int j = 0; j < arg; j++) {
+            timers[j] = make_timer(&data, 1000 + j);
+        }
+        uint64_t start = Metrics::now_ns();
+        for (int j = 0; j < arg; j++) {
+            lst.add_timer(timers[j]);
+        }
+        elapsed += Metrics::now_ns() - start;
+    }
+    r.items_per_second = rounds * arg / (elapsed / 1e9);
+    return elapsed * iters / (rounds * arg);
+}
+
+/* arg 个定时器中随机选一个延长到最后(与服务器中有数据到达时相同) */
+static uint64_t bm_timer_adjust(long long iters, int arg, bench_result& r) {
+    client_data data;
+    sort_timer_lst lst;
+    vector<util_timer*> timers(arg);
+    for (int j = 0; j < arg; j++) {
+        timers[j] = make_timer(&data, 1000 + j);
+        lst.add_timer(timers[j]);
+    }
+    time_t expire = 1000 + arg;
+    uint32_t x = 12345;
+    uint64_t start = Metrics::now_ns();
+    for (long long i = 0; i < iters; i++) {
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+        util_timer* timer = timers[x % arg];
+        timer->expire = expire++;
+        lst.adjust_timer(timer);
+    }
+    uint64_t elapsed = Metrics::now_ns() - start;
+    r.items_per_second = iters / (elapsed / 1e9);
+    return elapsed;
+}
+
+/* arg 个全部到期的定时器由一次 tick 全部处理，iters 为处理的定时器个数 */
+static uint64_t bm_timer_tick(long long iters, int arg, bench_result& r) {
+    client_data data;
+    long long rounds = (iters + arg - 1) / arg;
+    uint64_t elapsed = 0;
+    for (long long i = 0; i < rounds; i++) {
+        sort_timer_lst lst;
+        for (int j = arg; j > 0; j--) {
+            lst.add_timer(make_timer(&data, j));  /* 到期时间递减，每次都插在表头，建表不随规模变慢 */
+        }
+        uint64_t start = Metrics::now_ns();
+        lst.tick();
+        elapsed += Metrics::now_ns() - start;
+    }
+    r.items_per_second = rounds * arg / (elapsed / 1e9);
+    return elapsed * iters / (rounds * arg);
+}
+
+/************************** 阻塞队列 **************************/
+
+struct queue_ctx {
+    block_queue<long long>* queue;
+    long long items;
+    atomic<long long> consumed;
+};
+
+static void* queue_producer(void* arg) {
+    queue_ctx* ctx = (queue_ctx*)arg;
+    for (long long i = 0; i < ctx->items; i++) {
+        while (!ctx->queue->push(i)) {
+            sched_yield();  /* 队列满 */
+        }
+    }
+    return nullptr;
+}
+
+static void* queue_consumer(void* arg) {
+    queue_ctx* ctx = (queue_ctx*)arg;
+    long long item;
+    while (ctx->queue->pop(item)) {
+        if (item < 0) {  /* 结束标记 */
+            break;
+        }
+        ctx->consumed++;
+    }
+    return nullptr;
+}
+
+/* arg 个生产者 + arg 个消费者，共 iters 个元素 */
+static uint64_t bm_block_queue(long long iters, int arg, bench_result& r) {
+    queue_ctx ctx;
+    ctx.queue = new block_queue<long long>(1024);
+    ctx.items = iters / arg + 1;
+    ctx.consumed = 0;
+    vector<pthread_t> producers(arg), consumers(arg);
+
+    uint64_t start = Metrics::now_ns();
+    for (int i = 0; i < arg; i++) {
+        pthread_create(&consumers[i], nullptr, queue_consumer, &ctx);
+    }
+    for (int i = 0; i < arg; i++) {
+        pthread_create(&producers[i], nullptr, queue_producer, &ctx);
+    }
+    for (int i = 0; i < arg; i++) {
+        pthread_join(producers[i], nullptr);
+    }
+    for (int i = 0; i < arg; i++) {
+        while (!ctx.queue->push(-1)) {
+            sched_yield();
+        }
+    }
+    for (int i = 0; i < arg; i++) {
+        pthread_join(consumers[i], nullptr);
+    }
+    uint64_t elapsed = Metrics::now_ns() - start;
+    long long total = ctx.items * arg;
+    r.items_per_second = total / (elapsed / 1e9);
+    delete ctx.queue;
+    return elapsed * iters / total;
+}
+
+/************************** 线程池 **************************/
+
+/* 满足 threadpool<T> 接口的最小任务，记录入队到执行的延迟 */
+struct bench_task {
+    MYSQL* mysql;
+    int m_state;
+    int improv;
+    int timer_flag;
+    uint64_t enqueued;
+    uint64_t latency;
+    atomic<int>* done;
+
+    bool read() { return true; }
+    bool write() { return true; }
+    bool has_pending_request() const { return false; }
+    void from_worker() {}
+    void process() {
+        latency = Metrics::now_ns() - enqueued;
+        done->fetch_add(1, memory_order_release);
+    }
+};
+
+static threadpool<bench_task>* g_pool = nullptr;  /* 工作线程为分离线程，线程池随进程存活 */
+
+static void init_db_pool() {
+    static bool inited = false;
+    if (!inited) {
+        connection_pool::GetInstance()->init("localhost", "bench", "bench", "bench", 3306, 8, 1);
+        inited = true;
+    }
+}
+
+/* 单个任务入队后等待执行完成，测量唤醒延迟 */
+static uint64_t bm_threadpool_latency(long long iters, int arg, bench_result& r) {
+    vector<uint64_t> hist(H_BUCKETS, 0);
+    atomic<int> done(0);
+    bench_task task;
+    task.done = &done;
+    uint64_t start = Metrics::now_ns();
+    for (long long i = 0; i < iters; i++) {
+        task.enqueued = Metrics::now_ns();
+        g_pool->append_p(&task);
+        while (done.load(memory_order_acquire) != i + 1) {
+            sched_yield();
+        }
+        hist[Metrics::bucket_index(task.latency)]++;
+    }
+    uint64_t elapsed = Metrics::now_ns() - start;
+    r.items_per_second = iters / (elapsed / 1e9);
+    r.p50_ns = hist_percentile(&hist[0], iters, 0.50);
+    r.p99_ns = hist_percentile(&hist[0], iters, 0.99);
+    r.has_latency = true;
+    return elapsed;
+}
+
+/* 一次性入队一批任务，测量吞吐 */
+static uint64_t bm_threadpool_throughput(long long iters, int arg, bench_result& r) {
+    const int BATCH = 1000;
+    vector<bench_task> tasks(BATCH);
+    atomic<int> done(0);
+    for (int i = 0; i < BATCH; i++) {
+        tasks[i].done = &done;
+    }
+    long long submitted = 0;
+    uint64_t start = Metrics::now_ns();
+    while (submitted < iters) {
+        int n = iters - submitted < BATCH ? (int)(iters - submitted) : BATCH;
+        done = 0;
+        for (int i = 0; i < n; i++) {
+            tasks[i].enqueued = Metrics::now_ns();
+            while (!g_pool->append_p(&tasks[i])) {
+                sched_yield();
+            }
+        }
+        while (done.load(memory_order_acquire) != n) {
+            sched_yield();
+        }
+        submitted += n;
+    }
+    uint64_t elapsed = Metrics::now_ns() - start;
+    r.items_per_second = iters / (elapsed / 1e9);
+    return elapsed;
+}
+
+/************************** 数据库连接池 **************************/
+
+struct db_ctx {
+    long long iters;
+};
+
+static void* db_worker(void* arg) {
+    db_ctx* ctx = (db_ctx*)arg;
+    connection_pool* pool = connection_pool::GetInstance();
+    for (long long i = 0; i < ctx->iters; i++) {
+        MYSQL* mysql = nullptr;
+        connectionRAII con(&mysql, pool);
+    }
+    return nullptr;
+}
+
+/* arg 个线程并发 acquire/release，池大小为 8 */
+static uint64_t bm_connection_pool(long long iters, int arg, bench_result& r) {
+    db_ctx ctx;
+    ctx.iters = iters / arg + 1;
+    vector<pthread_t> threads(arg);
+    uint64_t start = Metrics::now_ns();
+    for (int i = 0; i < arg; i++) {
+        pthread_create(&threads[i], nullptr, db_worker, &ctx);
+    }
+    for (int i = 0; i < arg; i++) {
+        pthread_join(threads[i], nullptr);
+    }
+    uint64_t elapsed = Metrics::now_ns() - start;
+    long long total = ctx.iters * arg;
+    r.items_per_second = total / (elapsed / 1e9);
+    return elapsed * iters / total;
+}
+
+/************************** 限流表 **************************/
+
+struct ratelimit_ctx {
+    long long iters;
+    int ips;
+};
+
+static void* ratelimit_worker(void* arg) {
+    ratelimit_ctx* ctx = (ratelimit_ctx*)arg;
+    rate_limiter* limiter = rate_limiter::get_instance();
+    for (long long i = 0; i < ctx->iters; i++) {
+        limiter->allow_request(htonl(0x0a000001 + (uint32_t)(i % ctx->ips)));
+    }
+    return nullptr;
+}
+
+/* 每个请求一次 allow_request：arg 为 线程数 * 100000 + IP 数，IP 数为 1 时所有线程争用同一个令牌桶 */
+static uint64_t bm_ratelimit(long long iters, int arg, bench_result& r) {
+    ratelimit_ctx ctx;
+    int threads = arg / 100000;
+    ctx.ips = arg % 100000;
+    ctx.iters = iters / threads + 1;
+    rate_limiter* limiter = rate_limiter::get_instance();
+    limiter->init(0, rate_limiter::MAX_RATE, 0, 1);
+    for (int i = 0; i < ctx.ips; i++) {
+        limiter->admit_connection(htonl(0x0a000001 + i));
+    }
+    vector<pthread_t> tids(threads);
+    uint64_t start = Metrics::now_ns();
+    for (int i = 0; i < threads; i++) {
+        pthread_create(&tids[i], nullptr, ratelimit_worker, &ctx);
+    }
+    for (int i = 0; i < threads; i++) {
+        pthread_join(tids[i], nullptr);
+    }
+    uint64_t elapsed = Metrics::now_ns() - start;
+    long long total = ctx.iters * threads;
+    r.items_per_second = total / (elapsed / 1e9);
+    return elapsed * iters / total;
+}
+
+/************************** 框架 **************************/
+
+static bench_result run_case(const bench_case& c) {
+    bench_result r;
+    r.name = c.name;
+    r.has_latency = false;
+    r.p50_ns = r.p99_ns = 0;
+    r.items_per_second = 0;
+    long long iters = 1;
+    uint64_t elapsed = 0;
+    while (true) {
+        elapsed = c.fn(iters, c.arg, r);
+        if (elapsed >= g_min_time * 1e9 || iters >= (1LL << 40)) {
+            break;
+        }
+        /* 按已用时间估算达到最短时间需要的迭代次数，至少放大 2 倍、至多 100 倍 */
+        double scale = elapsed > 0 ? g_min_time * 1.2e9 / elapsed : 100;
+        if (scale < 2) {
+            scale = 2;
+        }
+        if (scale > 100) {
+            scale = 100;
+        }
+        iters = (long long)(iters * scale);
+    }
+    r.iterations = iters;
+    r.ns_per_op = (double)elapsed / iters;
+    return r;
+}
+
+static void json_escape(string& out, const string& s) {
+    for (size_t i = 0; i < s.size(); i++) {
+        if (s[i] == '"' || s[i] == '\\') {
+            out += '\\';
+        }
+        out += s[i];
+    }
+}
+
+static void write_json(FILE* fp, const vector<bench_result>& results) {
+    time_t t = time(nullptr);
+    char date[64];
+    strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%S", localtime(&t));
+    fprintf(fp, "{\n  \"context\": {\n    \"date\": \"%s\",\n    \"num_cpus\": %ld,\n    \"min_time\": %.3f\n  },\n",
+            date, sysconf(_SC_NPROCESSORS_ONLN), g_min_time);
+    fprintf(fp, "  \"benchmarks\": [\n");
+    for (size_t i = 0; i < results.size(); i++) {
+        const bench_result& r = results[i];
+        string name;
+        json_escape(name, r.name);
+        fprintf(fp, "    {\"name\": \"%s\", \"iterations\": %lld, \"real_time\": %.3f, \"time_unit\": \"ns\", "
+                    "\"items_per_second\": %.1f",
+                name.c_str(), r.iterations, r.ns_per_op, r.items_per_second);
+        if (r.has_latency) {
+            fprintf(fp, ", \"p50_ns\": %.1f, \"p99_ns\": %.1f", r.p50_ns, r.p99_ns);
+        }
+        fprintf(fp, "}%s\n", i + 1 < results.size() ? "," : "");
+    }
+    fprintf(fp, "  ]\n}\n");
+}
+
+int main(int argc, char* argv[]) {
+    const char* filter = "";
+    const char* json_path = nullptr;
+    long long fuzz_rounds = 0;
+    for (int i = 1; i < argc; i++) {
+        if (strncmp(argv[i], "--filter=", 9) == 0) {
+            filter = argv[i] + 9;
+        }
+        else if (strncmp(argv[i], "--json=", 7) == 0) {
+            json_path = argv[i] + 7;
+        }
+        else if (strncmp(argv[i], "--min-time=", 11) == 0) {
+            g_min_time = atof(argv[i] + 11);
+        }
+        else if (strncmp(argv[i], "--fuzz=", 7) == 0) {
+            fuzz_rounds = atoll(argv[i] + 7);
+        }
+        else {
+            fprintf(stderr, "usage: %s [--filter=substr] [--json=out.json] [--min-time=seconds] [--fuzz=rounds]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    g_scanner_num = http_scanners(g_scanners);
+    if (fuzz_rounds > 0) {
+        return fuzz_http_scan(fuzz_rounds);
+    }
+
+    vector<bench_case> cases;
+    for (int i = 0; i < g_scanner_num; i++) {
+        bench_case c;
+        c.name = string("http_scan/browser/") + g_scanners[i]->name;
+        c.fn = bm_http_scan;
+        c.arg = i;
+        cases.push_back(c);
+    }
+    {
+        bench_case c;
+        c.name = "http_header/lookup/browser";
+        c.fn = bm_header_lookup;
+        c.arg = 0;
+        cases.push_back(c);
+    }
+    const char* corpus_names[] = {"curl", "browser", "login_post"};
+    for (int i = 0; i < 3; i++) {
+        bench_case c;
+        c.name = string("http_conn/parse_line/") + corpus_names[i];
+        c.fn = micro_bench::parse_line;
+        c.arg = i;
+        cases.push_back(c);
+    }
+    for (int i = 0; i < 3; i++) {
+        bench_case c;
+        c.name = string("http_conn/process_read/") + corpus_names[i];
+        c.fn = micro_bench::process_read;
+        c.arg = i;
+        cases.push_back(c);
+    }
+    {
+        /* 会打开日志，放在其他 http_conn 测试之后 */
+        bench_case c;
+        c.name = "http_conn/keepalive_get/zero_alloc";
+        c.fn = micro_bench::keepalive_get;
+        c.arg = 0;
+        cases.push_back(c);
+    }
+    int timer_sizes[] = {100, 1000, 10000};
+    for (int i = 0; i < 3; i++) {
+        char name[64];
+        bench_case c;
+        snprintf(name, sizeof(name), "sort_timer_lst/add/%d", timer_sizes[i]);
+        c.name = name;
+        c.fn = bm_timer_add;
+        c.arg = timer_sizes[i];
+        cases.push_back(c);
+        snprintf(name, sizeof(name), "sort_timer_lst/adjust/%d", timer_sizes[i]);
+        c.name = name;
+        c.fn = bm_timer_adjust;
+        cases.push_back(c);
+        snprintf(name, sizeof(name), "sort_timer_lst/tick/%d", timer_sizes[i]);
+        c.name = name;
+        c.fn = bm_timer_tick;
+        cases.push_back(c);
+    }
+    int queue_threads[] = {1, 4};
+    for (int i = 0; i < 2; i++) {
+        char name[64];
+        snprintf(name, sizeof(name), "block_queue/push_pop/%dx%d", queue_threads[i], queue_threads[i]);
+        bench_case c;
+        c.name = name;
+        c.fn = bm_block_queue;
+        c.arg = queue_threads[i];
+        cases.push_back(c);
+    }
+    {
+        bench_case c;
+        c.name = "threadpool/enqueue_to_execute";
+        c.fn = bm_threadpool_latency;
+        c.arg = 0;
+        cases.push_back(c);
+        c.name = "threadpool/throughput";
+        c.fn = bm_threadpool_throughput;
+        cases.push_back(c);
+    }
+    int db_threads[] = {1, 4, 16};
+    for (int i = 0; i < 3; i++) {
+        char name[64];
+        snprintf(name, sizeof(name), "connection_pool/acquire_release/%d", db_threads[i]);
+        bench_case c;
+        c.name = name;
+        c.fn = bm_connection_pool;
+        c.arg = db_threads[i];
+        cases.push_back(c);
+    }
+    int ratelimit_args[][2] = {{1, 1}, {1, 10000}, {4, 1}, {4, 10000}};
+    for (int i = 0; i < 4; i++) {
+        char name[64];
+        snprintf(name, sizeof(name), "rate_limiter/allow_request/%dx%d", ratelimit_args[i][0], ratelimit_args[i][1]);
+        bench_case c;
+        c.name = name;
+        c.fn = bm_ratelimit;
+        c.arg = ratelimit_args[i][0] * 100000 + ratelimit_args[i][1];
+        cases.push_back(c);
+    }
+
+    init_db_pool();
+    g_pool = new threadpool<bench_task>(0, connection_pool::GetInstance(), 4, 100000);
+
+    vector<bench_result> results;
+    printf("%-45s %14s %14s %16s %12s %12s\n", "benchmark", "iterations", "ns/op", "items/s", "p50(ns)", "p99(ns)");
+    for (size_t i = 0; i < cases.size(); i++) {
+        if (strstr(cases[i].name.c_str(), filter) == nullptr) {
+            continue;
+        }
+        bench_result r = run_case(cases[i]);
+        results.push_back(r);
+        printf("%-45s %14lld %14.1f %16.1f", r.name.c_str(), r.iterations, r.ns_per_op, r.items_per_second);
+        if (r.has_latency) {
+            printf(" %12.1f %12.1f", r.p50_ns, r.p99_ns);
+        }
+        printf("\n");
+        fflush(stdout);
+    }
+
+    if (json_path) {
+        FILE* fp = fopen(json_path, "w");
+        if (!fp) {
+            fprintf(stderr, "cannot open %s\n", json_path);
+            return 1;
+        }
+        write_json(fp, results);
+        fclose(fp);
+    }
+    return 0;
+}
@@ -0,0 +1,57 @@
+/* 微基准测试用的 MySQL 客户端桩：不建立任何网络连接，连接池和 connectionRAII 可以照常工作 */
+/* 只实现服务器代码用到的函数，签名与 <mysql/mysql.h> 保持一致 */
+
+#include <string.h>
+#include <mysql/mysql.h>
+
+static MYSQL_RES g_result;
+
+MYSQL* STDCALL mysql_init(MYSQL* mysql) {
+    if (mysql == nullptr) {
+        mysql = new MYSQL;
+        memset(mysql, 0, sizeof(MYSQL));
+    }
+    return mysql;
+}
+
+MYSQL* STDCALL mysql_real_connect(MYSQL* mysql, const char* host, const char* user, const char* passwd,
+                                  const char* db, unsigned int port, const char* unix_socket, unsigned long clientflag) {
+    return mysql;
+}
+
+int STDCALL mysql_query(MYSQL* mysql, const char* q) {
+    return 0;
+}
+
+unsigned long STDCALL mysql_real_escape_string(MYSQL* mysql, char* to, const char* from, unsigned long length) {
+    memcpy(to, from, length);
+    to[length] = '\0';
+    return length;
+}
+
+const char* STDCALL mysql_error(MYSQL* mysql) {
+    return "";
+}
+
+MYSQL_RES* STDCALL mysql_store_result(MYSQL* mysql) {
+    return &g_result;
+}
+
+unsigned int STDCALL mysql_num_fields(MYSQL_RES* res) {
+    return 2;
+}
+
+MYSQL_FIELD* STDCALL mysql_fetch_fields(MYSQL_RES* res) {
+    return nullptr;
+}
+
+MYSQL_ROW STDCALL mysql_fetch_row(MYSQL_RES* result) {
+    return nullptr;  /* 空表 */
+}
+
+void STDCALL mysql_free_result(MYSQL_RES* result) {
+}
+
+void STDCALL mysql_close(MYSQL* sock) {
+    delete sock;
+}
@@ -0,0 +1,68 @@
+#!/bin/bash
+# 在同一台机器上按配置矩阵压测服务器：触发模式(-m) x 并发模型(-a) x 线程数(-t)
+# 每个组合都重新启动服务器，压测参数完全相同，结果可直接对比。
+#
+# 用法: bench/run_matrix.sh [http_bench 参数...]
+#   环境变量:
+#     SERVER       服务器可执行文件          (默认 ./myTinyWebserver)
+#     PORT         服务器端口                (默认 9006)
+#     TRIG_MODES   -m 取值列表               (默认 "0 1 2 3")
+#     ACTORS       -a 取值列表               (默认 "0 1")
+#     THREADS      -t 取值列表               (默认 "8")
+#     SERVER_CPUS  taskset 绑定服务器的 CPU   (可选，如 0-3)
+#     BENCH_CPUS   taskset 绑定压测工具的 CPU (可选，如 4-7)
+#   例: SERVER_CPUS=0-3 BENCH_CPUS=4-7 bench/run_matrix.sh -c 256 -t 4 -d 15 -R 50000
+
+SERVER=${SERVER:-./myTinyWebserver}
+PORT=${PORT:-9006}
+TRIG_MODES=${TRIG_MODES:-"0 1 2 3"}
+ACTORS=${ACTORS:-"0 1"}
+THREADS=${THREADS:-"8"}
+BENCH=${BENCH:-./http_bench}
+
+server_prefix=""
+bench_prefix=""
+if [ -n "$SERVER_CPUS" ]; then
+    server_prefix="taskset -c $SERVER_CPUS"
+fi
+if [ -n "$BENCH_CPUS" ]; then
+    bench_prefix="taskset -c $BENCH_CPUS"
+fi
+
+# 从 http_bench -j 的输出中取字段
+field() {
+    echo "$1" | grep -o "\"$2\":[0-9.]*" | cut -d: -f2
+}
+
+wait_port() {
+    for i in $(seq 1 50); do
+        if (exec 3<>/dev/tcp/127.0.0.1/$PORT) 2>/dev/null; then
+            return 0
+        fi
+        sleep 0.1
+    done
+    return 1
+}
+
+printf "%-4s %-4s %-4s %12s %10s %10s %10s %10s %8s\n" "m" "a" "t" "req/s" "p50(us)" "p99(us)" "p999(us)" "max(us)" "errors"
+for m in $TRIG_MODES; do
+    for a in $ACTORS; do
+        for t in $THREADS; do
+            $server_prefix $SERVER -p $PORT -m $m -a $a -t $t -c 1 > /dev/null 2>&1 &
+            pid=$!
+            if ! wait_port; then
+                echo "server failed to start (m=$m a=$a t=$t)" >&2
+                kill $pid 2>/dev/null
+                wait $pid 2>/dev/null
+                continue
+            fi
+            out=$($bench_prefix $BENCH -p $PORT -j "$@")
+            kill $pid 2>/dev/null
+            wait $pid 2>/dev/null
+            errors=$(( $(field "$out" errors) + $(field "$out" timeouts) ))
+            printf "%-4s %-4s %-4s %12s %10s %10s %10s %10s %8s\n" "$m" "$a" "$t" \
+                "$(field "$out" rps)" "$(field "$out" p50_us)" "$(field "$out" p99_us)" \
+                "$(field "$out" p999_us)" "$(field "$out" max_us)" "$errors"
+        done
+    done
+done
@@ -0,0 +1,144 @@
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <zlib.h>
+
+#include "gzip_cache.h"
+#include "../metrics/metrics.h"
+
+static const size_t ENTRY_OVERHEAD = 128;  /* 每个缓存项除数据外的簿记开销的估计 */
+
+void gzip_cache::init(size_t budget) {
+    m_lock.lock();
+    m_budget = budget;
+    m_lock.unlock();
+}
+
+/* 文本类资源：HTML/CSS/JS 以及常见的文本格式 */
+bool gzip_cache::compressible(const char* path, off_t size) {
+    static const char* exts[] = {".html", ".htm", ".css", ".js", ".json", ".txt", ".xml", ".svg", ".map", ".csv"};
+    if (size < MIN_SIZE || size > MAX_SIZE) {
+        return false;
+    }
+    const char* dot = strrchr(path, '.');
+    if (!dot || strchr(dot, '/')) {
+        return false;
+    }
+    for (size_t i = 0; i < sizeof(exts) / sizeof(exts[0]); i++) {
+        if (strcasecmp(dot, exts[i]) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/* 预压缩的 <path>.gz：必须是不早于原文件的普通文件 */
+bool gzip_cache::load_sibling(const char* path, const struct stat& st, string& out) {
+    string gz = string(path) + ".gz";
+    int fd = open(gz.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return false;
+    }
+    struct stat gst;
+    if (fstat(fd, &gst) < 0 || !S_ISREG(gst.st_mode) || gst.st_mtime < st.st_mtime || gst.st_size > MAX_SIZE) {
+        close(fd);
+        return false;
+    }
+    out.resize(gst.st_size);
+    size_t got = 0;
+    while (got < out.size()) {
+        ssize_t n = read(fd, &out[got], out.size() - got);
+        if (n <= 0) {
+            break;
+        }
+        got += n;
+    }
+    close(fd);
+    return got == out.size();
+}
+
+/* 整个文件一次 deflate，输出 gzip 格式(windowBits + 16) */
+bool gzip_cache::compress(const char* path, off_t size, string& out) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return false;
+    }
+    void* src = mmap(0, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (src == MAP_FAILED) {
+        return false;
+    }
+    z_stream zs;
+    memset(&zs, 0, sizeof(zs));
+    bool ok = deflateInit2(&zs, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) == Z_OK;
+    if (ok) {
+        out.resize(deflateBound(&zs, size));
+        zs.next_in = (Bytef*)src;
+        zs.avail_in = size;
+        zs.next_out = (Bytef*)&out[0];
+        zs.avail_out = out.size();
+        ok = deflate(&zs, Z_FINISH) == Z_STREAM_END;
+        out.resize(zs.total_out);
+        deflateEnd(&zs);
+    }
+    munmap(src, size);
+    return ok;
+}
+
+shared_ptr<const string> gzip_cache::get(const char* path, const struct stat& st) {
+    file_key key = {st.st_dev, st.st_ino, st.st_size, st.st_mtim.tv_sec, st.st_mtim.tv_nsec};
+    shared_ptr<const string> data;
+
+    m_lock.lock();
+    unordered_map<file_key, entry, file_key_hash>::iterator it = m_entries.find(key);
+    if (it != m_entries.end()) {
+        m_lru.splice(m_lru.begin(), m_lru, it->second.lru);
+        data = it->second.data;
+        m_lock.unlock();
+        METRIC_ADD(M_GZIP_HITS, 1);
+        return data->empty() ? shared_ptr<const string>() : data;
+    }
+    if (!m_pending.insert(key).second) {
+        m_lock.unlock();
+        return data;  /* 其他线程正在压缩 */
+    }
+    m_lock.unlock();
+    METRIC_ADD(M_GZIP_MISSES, 1);
+
+    /* 读取或压缩时不持锁 */
+    string* out = new string;
+    if (!load_sibling(path, st, *out) && (!compress(path, st.st_size, *out) || out->size() >= (size_t)st.st_size)) {
+        out->clear();
+    }
+    data.reset(out);
+
+    m_lock.lock();
+    m_pending.erase(key);
+    insert(key, data);
+    m_lock.unlock();
+    return data->empty() ? shared_ptr<const string>() : data;
+}
+
+/* 持锁调用：插入并按 LRU 淘汰到预算以内；超过预算四分之一的单项不缓存 */
+void gzip_cache::insert(const file_key& key, const shared_ptr<const string>& data) {
+    size_t cost = data->size() + ENTRY_OVERHEAD;
+    if (cost > m_budget / 4 || m_entries.count(key)) {
+        return;
+    }
+    while (m_used + cost > m_budget && !m_lru.empty()) {
+        unordered_map<file_key, entry, file_key_hash>::iterator victim = m_entries.find(m_lru.back());
+        size_t victim_cost = victim->second.data->size() + ENTRY_OVERHEAD;
+        m_used -= victim_cost;
+        METRIC_ADD(M_GZIP_CACHE_BYTES, -(int64_t)victim_cost);
+        METRIC_ADD(M_GZIP_EVICTIONS, 1);
+        m_entries.erase(victim);
+        m_lru.pop_back();
+    }
+    m_lru.push_front(key);
+    entry& e = m_entries[key];
+    e.data = data;
+    e.lru = m_lru.begin();
+    m_used += cost;
+    METRIC_ADD(M_GZIP_CACHE_BYTES, cost);
+}
@@ -0,0 +1,94 @@
+#ifndef GZIP_CACHE_H
+#define GZIP_CACHE_H
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <list>
+#include <memory>
+#include <set>
+#include <string>
+#include <unordered_map>
+
+#include "../lock/locker.h"
+
+using namespace std;
+
+/* 静态文件的 gzip 版本缓存：
+    以文件身份(设备号、inode、大小、纳秒 mtime)为键，文件被修改后旧版本自然不再命中，按 LRU 淘汰；
+    总内存不超过 init 时给定的预算。
+    未命中时优先读取同目录下较新的预压缩文件 <file>.gz，没有再用 zlib 压缩。
+    get 只在工作线程中调用(do_requset)，压缩不会阻塞事件循环线程；同一文件正在被其他线程压缩时
+    不重复压缩，本次直接返回空，由调用者发送未压缩的版本。
+    缓存项以 shared_ptr 交给连接，发送期间即使被淘汰也不会被释放。
+*/
+class gzip_cache {
+public:
+    static const off_t MIN_SIZE = 256;              /* 小于此大小的文件压缩收益抵不过开销 */
+    static const off_t MAX_SIZE = 8 * 1024 * 1024;  /* 大于此大小的文件不在内存中压缩 */
+
+    /* 局部静态变量单例模式 */
+    static gzip_cache* get_instance() {
+        static gzip_cache instance;
+        return &instance;
+    }
+
+    /* budget 为缓存的内存上限(字节)，0 表示关闭压缩 */
+    void init(size_t budget);
+    bool enabled() const {
+        return m_budget > 0;
+    }
+
+    /* 按扩展名和大小判断是否值得压缩：图片、视频等已压缩格式不压缩 */
+    static bool compressible(const char* path, off_t size);
+
+    /* path 的 gzip 版本，st 为 path 当前的 stat；压缩后没有变小、读取失败或正在被压缩时返回空 */
+    shared_ptr<const string> get(const char* path, const struct stat& st);
+
+    /* 读取较新的预压缩文件 <path>.gz；压缩整个文件。打包工具 mkbundle 也用它们，保证 gzip 版本逐字节相同 */
+    static bool load_sibling(const char* path, const struct stat& st, string& out);
+    static bool compress(const char* path, off_t size, string& out);
+
+private:
+    gzip_cache() : m_budget(0), m_used(0) {}
+    ~gzip_cache() {}
+
+    struct file_key {
+        dev_t dev;
+        ino_t ino;
+        off_t size;
+        time_t sec;
+        long nsec;
+        bool operator==(const file_key& o) const {
+            return dev == o.dev && ino == o.ino && size == o.size && sec == o.sec && nsec == o.nsec;
+        }
+        bool operator<(const file_key& o) const {
+            if (ino != o.ino) return ino < o.ino;
+            if (dev != o.dev) return dev < o.dev;
+            if (sec != o.sec) return sec < o.sec;
+            if (nsec != o.nsec) return nsec < o.nsec;
+            return size < o.size;
+        }
+    };
+    struct file_key_hash {
+        size_t operator()(const file_key& k) const {
+            return hash<unsigned long long>()(((unsigned long long)k.dev << 32) ^ k.ino ^
+                                              ((unsigned long long)k.nsec << 20) ^ k.sec ^ k.size);
+        }
+    };
+    struct entry {
+        shared_ptr<const string> data;  /* 空串表示压缩后没有变小，不再尝试 */
+        list<file_key>::iterator lru;
+    };
+
+    void insert(const file_key& key, const shared_ptr<const string>& data);
+
+private:
+    locker m_lock;
+    size_t m_budget;
+    size_t m_used;
+    unordered_map<file_key, entry, file_key_hash> m_entries;
+    list<file_key> m_lru;          /* 表头为最近使用 */
+    set<file_key> m_pending;       /* 正在压缩的文件 */
+};
+
+#endif
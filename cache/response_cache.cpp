@@ -0,0 +1,554 @@
+#include <errno.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <algorithm>
+#include <vector>
+
+#include "response_cache.h"
+#include "../metrics/metrics.h"
+
+static const size_t MIN_CHUNK = 1024;
+static const size_t HEAD_ROOM = 4096;      /* 键、状态行和头部的余量 */
+static const size_t MIN_PAGE = 64 << 10;
+static const int EVICT_SCAN = 16;          /* 淘汰时从 LRU 尾部最多看多少项，跳过正在发送的 */
+static const char KEEP_ALIVE[] = "Connection: Keep-alive\r\n\r\n";
+
+static size_t align_up(size_t n, size_t a) {
+    return (n + a - 1) / a * a;
+}
+
+/* 大小级别从 MIN_CHUNK 起每级约乘 1.25，最大一级放得下 max_file 的响应(不超过预算的 1/4)；
+    页至少能放下一个最大的块。映射依次为 header、缓存项、哈希桶、页的级别、数据页，物理页在第一次写入时才分配 */
+void response_cache::init(off_t max_file, size_t budget) {
+    if (max_file <= 0 || budget == 0) {
+        return;
+    }
+    size_t largest = (size_t)max_file + HEAD_ROOM;
+    if (largest > budget / 4) {
+        largest = budget / 4;
+    }
+    header hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    size_t size = MIN_CHUNK;
+    while (hdr.classes < RC_MAX_CLASSES) {
+        hdr.cls_size[hdr.classes++] = size;
+        if (size >= largest) {
+            break;
+        }
+        size = align_up(size * 5 / 4, 64);
+    }
+    largest = hdr.cls_size[hdr.classes - 1];
+    hdr.page_size = largest > MIN_PAGE ? largest : MIN_PAGE;
+    hdr.pages = budget / hdr.page_size;
+    hdr.entries = budget / 4096 > 256 ? budget / 4096 : 256;
+    hdr.buckets = 1;
+    while (hdr.buckets < hdr.entries) {
+        hdr.buckets <<= 1;
+    }
+    if (hdr.pages == 0) {
+        return;
+    }
+
+    size_t entries_off = align_up(sizeof(header), 64);
+    size_t buckets_off = align_up(entries_off + hdr.entries * sizeof(entry), 64);
+    size_t page_cls_off = align_up(buckets_off + hdr.buckets * sizeof(int32_t), 64);
+    size_t data_off = align_up(page_cls_off + hdr.pages * sizeof(int32_t), 4096);
+    size_t total = data_off + hdr.pages * hdr.page_size;
+    char* base = (char*)mmap(NULL, total, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (base == MAP_FAILED) {
+        return;
+    }
+
+    m_hdr = (header*)base;
+    memcpy(m_hdr, &hdr, sizeof(hdr));
+    pthread_mutexattr_t attr;
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+    pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+    pthread_mutex_init(&m_hdr->lock, &attr);
+    pthread_mutexattr_destroy(&attr);
+    for (int c = 0; c < RC_MAX_CLASSES; c++) {
+        m_hdr->lru_head[c] = -1;
+        m_hdr->lru_tail[c] = -1;
+    }
+
+    /* 映射为全 0，引用计数不需要再初始化 */
+    m_entries = (entry*)(base + entries_off);
+    for (uint32_t i = 0; i < hdr.entries; i++) {
+        m_entries[i].next_hash = i + 1 < hdr.entries ? (int32_t)(i + 1) : -1;
+        m_entries[i].state = FREE;
+    }
+    m_hdr->free_entry = 0;
+    m_buckets = (int32_t*)(base + buckets_off);
+    memset(m_buckets, 0xff, hdr.buckets * sizeof(int32_t));
+    m_page_cls = (int32_t*)(base + page_cls_off);
+    m_data = base + data_off;
+    m_max_file = max_file;
+}
+
+void response_cache::set_process(int proc) {
+    m_proc = proc >= 0 && proc < RC_MAX_PROCS ? proc : RC_MAX_PROCS - 1;
+}
+
+/* 引用计数不需要持锁：计数只会在这里和 release 中减少。
+    它正在填充的项不在任何链表里(比如拷贝时文件被截短，访问映射收到 SIGBUS)，持锁把项和块放回空闲链表；
+    它退出时带着锁，链表可能只改了一半，这时重建索引 */
+bool response_cache::release_process(int proc) {
+    if (!enabled() || proc < 0 || proc >= RC_MAX_PROCS) {
+        return false;
+    }
+    for (uint32_t i = 0; i < m_hdr->entries; i++) {
+        m_entries[i].refs[proc].store(0, memory_order_release);
+    }
+    if (!lock(true)) {
+        return false;
+    }
+    bool broken = m_hdr->broken;
+    if (broken) {
+        rebuild(proc);
+    }
+    else {
+        for (uint32_t i = 0; i < m_hdr->entries; i++) {
+            entry& e = m_entries[i];
+            if (e.state == FILLING && e.filler == proc) {
+                free_chunk(e.cls, e.chunk);
+                e.state = FREE;
+                e.next_hash = m_hdr->free_entry;
+                m_hdr->free_entry = i;
+            }
+        }
+    }
+    unlock();
+    return broken;
+}
+
+/* 路径加编码偏好 */
+size_t response_cache::make_key(char* key, const char* path, bool gzip) {
+    size_t len = strlen(path);
+    if (len + 2 > (size_t)RC_MAX_KEY) {
+        return 0;
+    }
+    memcpy(key, path, len);
+    key[len] = '\n';
+    key[len + 1] = gzip ? '1' : '0';
+    return len + 2;
+}
+
+/* FNV-1a */
+uint32_t response_cache::hash_key(const char* key, size_t len) {
+    uint32_t h = 2166136261u;
+    for (size_t i = 0; i < len; i++) {
+        h = (h ^ (unsigned char)key[i]) * 16777619u;
+    }
+    return h;
+}
+
+time_t response_cache::now_sec() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+    return ts.tv_sec;
+}
+
+/* 持锁进程中途退出时链表可能只改了一半，标记损坏，之后一律当作未命中，直到主进程重建索引。
+    even_broken 为 true 时损坏也返回持锁，由调用者检查 broken */
+bool response_cache::lock(bool even_broken) {
+    int ret = pthread_mutex_lock(&m_hdr->lock);
+    if (ret == EOWNERDEAD) {
+        m_hdr->broken = 1;
+        pthread_mutex_consistent(&m_hdr->lock);
+    }
+    else if (ret != 0) {
+        return false;
+    }
+    if (m_hdr->broken && !even_broken) {
+        pthread_mutex_unlock(&m_hdr->lock);
+        return false;
+    }
+    return true;
+}
+
+void response_cache::unlock() {
+    pthread_mutex_unlock(&m_hdr->lock);
+}
+
+int response_cache::class_for(size_t need) const {
+    for (int c = 0; c < m_hdr->classes; c++) {
+        if (m_hdr->cls_size[c] >= need) {
+            return c;
+        }
+    }
+    return -1;
+}
+
+/* 以下持锁调用 */
+int response_cache::find(const char* key, size_t len, uint32_t hash) const {
+    for (int32_t i = m_buckets[hash & (m_hdr->buckets - 1)]; i >= 0; i = m_entries[i].next_hash) {
+        const entry& e = m_entries[i];
+        if (e.hash == hash && e.key_len == len && memcmp(m_data + e.chunk, key, len) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+bool response_cache::referenced(int idx) const {
+    const entry& e = m_entries[idx];
+    for (int p = 0; p < RC_MAX_PROCS; p++) {
+        if (e.refs[p].load(memory_order_acquire) != 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void response_cache::lru_unlink(int idx) {
+    entry& e = m_entries[idx];
+    if (e.lru_prev >= 0) {
+        m_entries[e.lru_prev].lru_next = e.lru_next;
+    }
+    else {
+        m_hdr->lru_head[e.cls] = e.lru_next;
+    }
+    if (e.lru_next >= 0) {
+        m_entries[e.lru_next].lru_prev = e.lru_prev;
+    }
+    else {
+        m_hdr->lru_tail[e.cls] = e.lru_prev;
+    }
+}
+
+void response_cache::lru_push(int idx) {
+    entry& e = m_entries[idx];
+    e.lru_prev = -1;
+    e.lru_next = m_hdr->lru_head[e.cls];
+    if (e.lru_next >= 0) {
+        m_entries[e.lru_next].lru_prev = idx;
+    }
+    else {
+        m_hdr->lru_tail[e.cls] = idx;
+    }
+    m_hdr->lru_head[e.cls] = idx;
+}
+
+void response_cache::lru_push_tail(int idx) {
+    entry& e = m_entries[idx];
+    e.lru_next = -1;
+    e.lru_prev = m_hdr->lru_tail[e.cls];
+    if (e.lru_prev >= 0) {
+        m_entries[e.lru_prev].lru_next = idx;
+    }
+    else {
+        m_hdr->lru_head[e.cls] = idx;
+    }
+    m_hdr->lru_tail[e.cls] = idx;
+}
+
+/* 从哈希表摘下，之后的 get 不再命中；还有连接在发送时移到 LRU 尾部，引用归零后最先回收 */
+void response_cache::unhash(int idx) {
+    entry& e = m_entries[idx];
+    int32_t* link = &m_buckets[e.hash & (m_hdr->buckets - 1)];
+    while (*link != idx) {
+        link = &m_entries[*link].next_hash;
+    }
+    *link = e.next_hash;
+    e.state = DEAD;
+    if (!referenced(idx)) {
+        reclaim(idx);
+        return;
+    }
+    lru_unlink(idx);
+    lru_push_tail(idx);
+}
+
+/* 已摘下且没有引用的项：块和项都放回空闲链表 */
+void response_cache::reclaim(int idx) {
+    entry& e = m_entries[idx];
+    lru_unlink(idx);
+    free_chunk(e.cls, e.chunk);
+    METRIC_ADD(M_RCACHE_BYTES, -(int64_t)m_hdr->cls_size[e.cls]);
+    METRIC_ADD(M_RCACHE_ENTRIES, -1);
+    e.state = FREE;
+    e.next_hash = m_hdr->free_entry;
+    m_hdr->free_entry = idx;
+}
+
+/* 从 cls 的 LRU 尾部回收一项，跳过还在发送的 */
+bool response_cache::evict(int cls) {
+    int32_t idx = m_hdr->lru_tail[cls];
+    for (int n = 0; idx >= 0 && n < EVICT_SCAN; n++, idx = m_entries[idx].lru_prev) {
+        if (referenced(idx)) {
+            continue;
+        }
+        if (m_entries[idx].state == LIVE) {
+            METRIC_ADD(M_RCACHE_EVICTIONS, 1);
+            unhash(idx);
+        }
+        else {
+            reclaim(idx);
+        }
+        return true;
+    }
+    return false;
+}
+
+int response_cache::alloc_entry(int cls) {
+    if (m_hdr->free_entry < 0 && !evict(cls)) {
+        return -1;
+    }
+    int idx = m_hdr->free_entry;
+    m_hdr->free_entry = m_entries[idx].next_hash;
+    return idx;
+}
+
+/* 级别的空闲块用完时先切一页新的，页也用完了才淘汰 */
+bool response_cache::alloc_chunk(int cls, uint64_t* chunk) {
+    if (m_hdr->cls_free[cls] == 0) {
+        if (m_hdr->pages_used < m_hdr->pages) {
+            size_t size = m_hdr->cls_size[cls];
+            size_t p = m_hdr->pages_used;
+            m_page_cls[p] = cls;  /* 先记级别再计入，重建时只切分记过级别的页 */
+            m_hdr->pages_used = p + 1;
+            uint64_t page = p * m_hdr->page_size;
+            for (size_t off = 0; off + size <= m_hdr->page_size; off += size) {
+                free_chunk(cls, page + off);
+            }
+        }
+        else if (!evict(cls)) {
+            return false;
+        }
+    }
+    *chunk = m_hdr->cls_free[cls] - 1;
+    memcpy(&m_hdr->cls_free[cls], m_data + *chunk, sizeof(uint64_t));
+    return true;
+}
+
+void response_cache::free_chunk(int cls, uint64_t chunk) {
+    memcpy(m_data + chunk, &m_hdr->cls_free[cls], sizeof(uint64_t));
+    m_hdr->cls_free[cls] = chunk + 1;
+}
+
+/* 主进程持锁调用。哈希链、LRU 和空闲链表全部丢弃，按缓存项重新建立：
+    还有进程在发送的项改为 DEAD 放到 LRU 尾部(块不动，引用归零后回收)，其他进程正在填充的项原样保留，
+    其余的项放回空闲链表；已切分的页按级别重新切块，除去保留的块都是空闲块。之前缓存的响应全部失效 */
+void response_cache::rebuild(int dead_proc) {
+    memset(m_buckets, 0xff, m_hdr->buckets * sizeof(int32_t));
+    for (int c = 0; c < RC_MAX_CLASSES; c++) {
+        m_hdr->lru_head[c] = -1;
+        m_hdr->lru_tail[c] = -1;
+        m_hdr->cls_free[c] = 0;
+    }
+    m_hdr->free_entry = -1;
+    vector<uint64_t> kept;
+    int64_t dropped = 0;
+    int64_t dropped_bytes = 0;
+    for (int i = (int)m_hdr->entries - 1; i >= 0; i--) {
+        entry& e = m_entries[i];
+        bool filling = e.state == FILLING && e.filler >= 0 && e.filler != dead_proc;
+        bool sending = (e.state == LIVE || e.state == DEAD) && referenced(i);
+        if (filling || sending) {
+            kept.push_back(e.chunk);
+            if (sending) {
+                e.state = DEAD;
+                lru_push_tail(i);
+            }
+            continue;
+        }
+        if (e.state == LIVE || e.state == DEAD) {
+            dropped++;
+            dropped_bytes += m_hdr->cls_size[e.cls];
+        }
+        e.state = FREE;
+        e.next_hash = m_hdr->free_entry;
+        m_hdr->free_entry = i;
+    }
+    sort(kept.begin(), kept.end());
+    for (size_t p = 0; p < m_hdr->pages_used; p++) {
+        int cls = m_page_cls[p];
+        size_t size = m_hdr->cls_size[cls];
+        uint64_t page = p * m_hdr->page_size;
+        for (size_t off = 0; off + size <= m_hdr->page_size; off += size) {
+            if (!binary_search(kept.begin(), kept.end(), page + off)) {
+                free_chunk(cls, page + off);
+            }
+        }
+    }
+    METRIC_ADD(M_RCACHE_BYTES, -dropped_bytes);
+    METRIC_ADD(M_RCACHE_ENTRIES, -dropped);
+    METRIC_ADD(M_RCACHE_REBUILDS, 1);
+    m_hdr->broken = 0;
+}
+
+/* 命中时先取引用再放锁，不新鲜的项在锁外 stat，期间它不会被复用 */
+bool response_cache::get(const char* path, bool gzip, cached_response* out) {
+    char key[RC_MAX_KEY];
+    size_t key_len = make_key(key, path, gzip);
+    if (key_len == 0 || !lock()) {
+        METRIC_ADD(M_RCACHE_MISSES, 1);
+        return false;
+    }
+    uint32_t hash = hash_key(key, key_len);
+    time_t now = now_sec();
+    int idx = find(key, key_len, hash);
+    if (idx < 0) {
+        unlock();
+        METRIC_ADD(M_RCACHE_MISSES, 1);
+        return false;
+    }
+    entry& e = m_entries[idx];
+    e.refs[m_proc].fetch_add(1, memory_order_relaxed);
+    uint32_t gen = e.gen;
+    bool fresh = e.checked == now;
+    if (fresh) {
+        lru_unlink(idx);
+        lru_push(idx);
+    }
+    unlock();
+
+    /* 每秒至多校验一次 */
+    if (!fresh) {
+        struct stat st;
+        bool valid = stat(path, &st) == 0 && st.st_dev == e.dev && st.st_ino == e.ino && st.st_size == e.size &&
+                     st.st_mtim.tv_sec == e.mtime.tv_sec && st.st_mtim.tv_nsec == e.mtime.tv_nsec;
+        if (lock()) {
+            if (e.gen == gen && e.state == LIVE) {
+                if (valid) {
+                    e.checked = now;
+                    lru_unlink(idx);
+                    lru_push(idx);
+                }
+                else {
+                    unhash(idx);
+                }
+            }
+            unlock();
+        }
+        else {
+            valid = false;
+        }
+        if (!valid) {
+            e.refs[m_proc].fetch_sub(1, memory_order_release);
+            METRIC_ADD(M_RCACHE_MISSES, 1);
+            return false;
+        }
+    }
+    out->data = m_data + e.chunk + e.key_len;
+    out->len = e.len;
+    out->conn_off = e.conn_off;
+    out->body_off = e.body_off;
+    out->entry = idx;
+    METRIC_ADD(M_RCACHE_HITS, 1);
+    return true;
+}
+
+void response_cache::release(cached_response* resp) {
+    if (resp->data) {
+        m_entries[resp->entry].refs[m_proc].fetch_sub(1, memory_order_release);
+        resp->data = nullptr;
+    }
+}
+
+/* 持锁分配块，锁外拷贝，再持锁挂进哈希表；两个进程同时缓存同一路径时后到的放弃 */
+void response_cache::put(const char* path, bool gzip, const struct stat& st, const char* head, size_t conn_off,
+                         const char* body, size_t body_len) {
+    char key[RC_MAX_KEY];
+    size_t key_len = make_key(key, path, gzip);
+    size_t len = conn_off + sizeof(KEEP_ALIVE) - 1 + body_len;
+    int cls = key_len ? class_for(key_len + len) : -1;
+    if (cls < 0 || !lock()) {
+        return;
+    }
+    uint32_t hash = hash_key(key, key_len);
+    int idx = -1;
+    uint64_t chunk = 0;
+    if (find(key, key_len, hash) < 0 && (idx = alloc_entry(cls)) >= 0 && !alloc_chunk(cls, &chunk)) {
+        m_entries[idx].next_hash = m_hdr->free_entry;
+        m_hdr->free_entry = idx;
+        idx = -1;
+    }
+    if (idx < 0) {
+        unlock();
+        return;
+    }
+    entry& e = m_entries[idx];
+    e.state = FILLING;
+    e.filler = m_proc;
+    e.gen++;
+    e.cls = cls;
+    e.chunk = chunk;
+    unlock();
+
+    char* p = m_data + chunk;
+    memcpy(p, key, key_len);
+    memcpy(p + key_len, head, conn_off);
+    memcpy(p + key_len + conn_off, KEEP_ALIVE, sizeof(KEEP_ALIVE) - 1);
+    memcpy(p + key_len + conn_off + sizeof(KEEP_ALIVE) - 1, body, body_len);
+    e.hash = hash;
+    e.key_len = key_len;
+    e.len = len;
+    e.conn_off = conn_off;
+    e.body_off = conn_off + sizeof(KEEP_ALIVE) - 1;
+    e.checked = now_sec();
+    e.dev = st.st_dev;
+    e.ino = st.st_ino;
+    e.size = st.st_size;
+    e.mtime = st.st_mtim;
+
+    if (!lock(true)) {
+        return;
+    }
+    if (m_hdr->broken) {
+        e.filler = -1;  /* 索引已损坏，不再挂入，主进程重建时回收 */
+        unlock();
+        return;
+    }
+    if (find(key, key_len, hash) >= 0) {
+        free_chunk(cls, chunk);
+        e.state = FREE;
+        e.next_hash = m_hdr->free_entry;
+        m_hdr->free_entry = idx;
+    }
+    else {
+        int32_t* bucket = &m_buckets[hash & (m_hdr->buckets - 1)];
+        e.next_hash = *bucket;
+        *bucket = idx;
+        e.state = LIVE;
+        lru_push(idx);
+        METRIC_ADD(M_RCACHE_BYTES, m_hdr->cls_size[cls]);
+        METRIC_ADD(M_RCACHE_ENTRIES, 1);
+    }
+    unlock();
+}
+
+/* 轮流取各级别 LRU 表头一侧的项，每个级别中越近使用的越靠前 */
+void response_cache::hot_keys(string& out, size_t max_bytes) {
+    out.clear();
+    if (!enabled() || !lock()) {
+        return;
+    }
+    int32_t cur[RC_MAX_CLASSES];
+    for (int c = 0; c < m_hdr->classes; c++) {
+        cur[c] = m_hdr->lru_head[c];
+    }
+    bool more = true;
+    while (more) {
+        more = false;
+        for (int c = 0; c < m_hdr->classes; c++) {
+            if (cur[c] < 0) {
+                continue;
+            }
+            const entry& e = m_entries[cur[c]];
+            cur[c] = e.lru_next;
+            more = true;
+            if (e.state != LIVE) {
+                continue;
+            }
+            if (out.size() + e.key_len + 1 > max_bytes) {
+                unlock();
+                return;
+            }
+            out.append(m_data + e.chunk, e.key_len);
+            out.push_back('\0');
+        }
+    }
+    unlock();
+}
@@ -0,0 +1,155 @@
+#ifndef RESPONSE_CACHE_H
+#define RESPONSE_CACHE_H
+
+#include <stdint.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <atomic>
+#include <string>
+
+using namespace std;
+
+const int RC_MAX_PROCS = 32;    /* 共享缓存的进程数上限，每个进程一列引用计数 */
+const int RC_MAX_CLASSES = 64;  /* 块大小级别数上限 */
+const int RC_MAX_KEY = 256;     /* 路径加编码偏好 */
+
+/* 命中的缓存响应：指向共享内存中连续存放的状态行、头部和响应体。
+    持有期间这一项不会被淘汰或复用，用完以 response_cache::release 归还 */
+struct cached_response {
+    const char* data;   /* Connection 头部为 keep-alive 的完整响应，为空表示没有持有 */
+    size_t len;
+    size_t conn_off;    /* Connection 头部行的起点，短连接发送时替换这一行 */
+    size_t body_off;    /* 响应体的起点 */
+    int entry;          /* 缓存项下标 */
+};
+
+/* 小文件响应缓存：
+    小于 max_file 的静态文件第一次被请求时，把整个响应(含头部)渲染进一块连续内存，
+    之后同一路径、同一编码偏好(是否接受 gzip)的请求不再 stat/open/mmap，也不再格式化头部，一次 writev 发完。
+    每个缓存项至多每秒用 stat 重新校验一次，文件被修改或删除后即失效。
+
+    缓存放在 fork 之前建立的共享匿名映射中，多进程模式下所有工作进程共用一份：
+    一个进程渲染过的响应，其他进程直接命中。映射内不存指针，只存下标和偏移。
+    内存按 memcached 的方式分成若干大小级别(相邻级别约差 1.25 倍)，页按需分给级别后切成等长的块，
+    每个级别一条 LRU，预算用完时从所属级别的 LRU 尾部淘汰没有被引用的项。
+    引用计数按进程分列，工作进程异常退出后由主进程清掉它那一列，并回收它正在填充的项；
+    锁是进程间共享的健壮互斥锁，持锁进程中途退出时链表可能已不一致，缓存暂停使用(只是不再命中)，
+    直到主进程在 release_process 中按缓存项重建索引。
+*/
+class response_cache {
+public:
+    /* 局部静态变量单例模式 */
+    static response_cache* get_instance() {
+        static response_cache instance;
+        return &instance;
+    }
+
+    /* max_file 为可缓存的最大文件(字节)，budget 为内存上限(字节)；任一为 0 表示关闭。
+        多进程模式下必须在 fork 之前调用 */
+    void init(off_t max_file, size_t budget);
+    bool enabled() const {
+        return m_max_file > 0 && m_hdr != nullptr;
+    }
+    bool fits(off_t body_len) const {
+        return body_len <= m_max_file;
+    }
+
+    /* 本进程在引用计数中的列号，工作进程 fork 后设置，单进程为 0 */
+    void set_process(int proc);
+    /* 第 proc 个工作进程已退出，清掉它持有的引用、回收它正在填充的项，由主进程调用；
+        它退出时持有锁则重建索引，返回 true */
+    bool release_process(int proc);
+
+    /* path 在该编码偏好下的缓存响应，命中时填写 out 并持有一个引用，未命中或已失效返回 false */
+    bool get(const char* path, bool gzip, cached_response* out);
+    /* 归还 get 得到的引用，没有持有时什么也不做 */
+    void release(cached_response* resp);
+
+    /* 缓存一个响应：head 的前 conn_off 字节为 Connection 头部之前的状态行和头部 */
+    void put(const char* path, bool gzip, const struct stat& st, const char* head, size_t conn_off,
+             const char* body, size_t body_len);
+
+    /* 最近使用的缓存键，以 '\0' 分隔，总长不超过 max_bytes；升级时交给新进程预热 */
+    void hot_keys(string& out, size_t max_bytes);
+
+private:
+    response_cache() : m_max_file(0), m_proc(0), m_hdr(nullptr), m_entries(nullptr), m_buckets(nullptr),
+                       m_page_cls(nullptr), m_data(nullptr) {}
+    ~response_cache() {}
+
+    enum ENTRY_STATE { FREE = 0, FILLING, LIVE, DEAD };
+
+    /* 缓存项，链表都以下标相连，-1 表示没有 */
+    struct entry {
+        int32_t next_hash;
+        int32_t lru_prev;
+        int32_t lru_next;
+        int32_t cls;
+        int32_t state;          /* FILLING: 正在拷贝，不在哈希表和 LRU 中；DEAD: 已失效，等引用归零后回收 */
+        int32_t filler;         /* FILLING 时正在拷贝的进程，-1 表示已放弃 */
+        uint32_t hash;
+        uint32_t gen;           /* 每次复用加一，校验期间用它判断是否还是同一项 */
+        uint32_t key_len;
+        uint64_t chunk;         /* 块在数据区中的偏移，块内先存键再存响应 */
+        size_t len;
+        size_t conn_off;
+        size_t body_off;
+        time_t checked;         /* 上次校验的时间(秒，单调时钟) */
+        /* 文件身份，用于重新校验 */
+        dev_t dev;
+        ino_t ino;
+        off_t size;
+        struct timespec mtime;
+        atomic<uint32_t> refs[RC_MAX_PROCS];
+    };
+
+    /* 映射开头的簿记 */
+    struct header {
+        pthread_mutex_t lock;   /* PTHREAD_PROCESS_SHARED | PTHREAD_MUTEX_ROBUST */
+        int broken;
+        int classes;
+        size_t cls_size[RC_MAX_CLASSES];
+        uint64_t cls_free[RC_MAX_CLASSES];  /* 空闲块链表，块的前 8 字节存下一块的偏移加一，0 表示没有 */
+        int32_t lru_head[RC_MAX_CLASSES];   /* 表头为最近使用 */
+        int32_t lru_tail[RC_MAX_CLASSES];
+        size_t page_size;
+        size_t pages;
+        size_t pages_used;
+        uint32_t entries;
+        uint32_t buckets;                   /* 2 的幂 */
+        int32_t free_entry;                 /* 空闲项链表，借用 next_hash */
+    };
+
+    static time_t now_sec();
+    static uint32_t hash_key(const char* key, size_t len);
+    static size_t make_key(char* key, const char* path, bool gzip);
+
+    bool lock(bool even_broken = false);
+    void unlock();
+    int class_for(size_t need) const;
+    int find(const char* key, size_t len, uint32_t hash) const;
+    bool referenced(int idx) const;
+    void lru_unlink(int idx);
+    void lru_push(int idx);
+    void lru_push_tail(int idx);
+    void unhash(int idx);
+    void reclaim(int idx);
+    bool evict(int cls);
+    int alloc_entry(int cls);
+    bool alloc_chunk(int cls, uint64_t* chunk);
+    void free_chunk(int cls, uint64_t chunk);
+    void rebuild(int dead_proc);
+
+private:
+    off_t m_max_file;
+    int m_proc;
+    header* m_hdr;         /* 以下都指向 fork 之前建立的共享映射，各进程中地址相同 */
+    entry* m_entries;
+    int32_t* m_buckets;
+    int32_t* m_page_cls;   /* 每个已切分的页属于哪个级别，重建空闲块链表用 */
+    char* m_data;
+};
+
+#endif
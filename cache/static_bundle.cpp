@@ -0,0 +1,83 @@
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "static_bundle.h"
+
+bool static_bundle::open(const char* path) {
+    int fd = ::open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) < 0 || st.st_size < (off_t)sizeof(bundle_header)) {
+        close(fd);
+        return false;
+    }
+    /* MAP_POPULATE：启动时一次顺序读把整个包读入页缓存并建立映射，之后发送不会缺页 */
+    void* base = mmap(0, st.st_size, PROT_READ, MAP_SHARED | MAP_POPULATE, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) {
+        return false;
+    }
+    m_base = (const char*)base;
+    m_size = st.st_size;
+    m_header = (const bundle_header*)m_base;
+    m_seeds = (const uint32_t*)(m_base + m_header->seeds_off);
+    m_entries = (const bundle_entry*)(m_base + m_header->entries_off);
+    if (!validate()) {
+        munmap(base, m_size);
+        m_base = nullptr;
+        m_size = 0;
+        return false;
+    }
+    return true;
+}
+
+/* [off, off + len) 是否在 [0, size) 内，不会溢出 */
+static bool in_range(uint64_t off, uint64_t len, uint64_t size) {
+    return off <= size && len <= size - off;
+}
+
+/* 一次性检查所有偏移都在包内，查找和发送时不再检查 */
+bool static_bundle::validate() const {
+    const bundle_header& h = *m_header;
+    if (memcmp(h.magic, BUNDLE_MAGIC, sizeof(BUNDLE_MAGIC)) != 0 || h.version != BUNDLE_VERSION || h.size != m_size ||
+        h.count == 0 || h.buckets == 0) {
+        return false;
+    }
+    if (h.seeds_off % sizeof(uint32_t) || h.entries_off % sizeof(uint64_t) ||
+        !in_range(h.seeds_off, (uint64_t)h.buckets * sizeof(uint32_t), m_size) ||
+        !in_range(h.entries_off, (uint64_t)h.count * sizeof(bundle_entry), m_size)) {
+        return false;
+    }
+    for (uint32_t i = 0; i < h.count; i++) {
+        const bundle_entry& e = m_entries[i];
+        if (!in_range(e.path_off, e.path_len, m_size) || !in_range(e.head_off, e.head_len, m_size) ||
+            !in_range(e.head_off + e.head_len, e.body_len, m_size) || !in_range(e.gz_head_off, e.gz_head_len, m_size) ||
+            !in_range(e.gz_head_off + e.gz_head_len, e.gz_body_len, m_size)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+const bundle_entry* static_bundle::find(const char* path, size_t len) const {
+    if (!m_base) {
+        return nullptr;
+    }
+    uint32_t bucket = bundle_hash(path, len, 0) % m_header->buckets;
+    const bundle_entry& e = m_entries[bundle_hash(path, len, m_seeds[bucket]) % m_header->count];
+    if (e.path_len != len || memcmp(m_base + e.path_off, path, len) != 0) {
+        return nullptr;
+    }
+    return &e;
+}
+
+static_bundle::~static_bundle() {
+    if (m_base) {
+        munmap((void*)m_base, m_size);
+    }
+}
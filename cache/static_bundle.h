@@ -0,0 +1,95 @@
+#ifndef STATIC_BUNDLE_H
+#define STATIC_BUNDLE_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/* 静态资源包：
+    由 tools/mkbundle 在部署时把网站根目录打包成一个文件，服务器启动时整个 mmap(MAP_POPULATE，
+    一次顺序读把包读进页缓存)，之后无条件的整文件 GET 不再有任何文件系统调用。
+    每个文件在包中存放预先渲染好的响应头(到 Content-Length 为止，Connection 行由服务器按连接补上)
+    和紧随其后的响应体；可压缩的文件另存一份 gzip 版本。
+    路径索引是一张最小完美哈希表(hash and displace)：路径先哈希到桶，每个桶记录一个种子，
+    用种子再哈希一次得到唯一的槽位，最后比较一次路径确认，查找 O(1)，没有冲突链。
+    校验器与从文件系统发送时完全相同(见 http_validators.h)，条件请求和 Range 请求仍走文件系统，结果一致。
+
+    文件布局：bundle_header | seeds[buckets] | bundle_entry[count] | 路径、响应头和响应体
+*/
+
+const char BUNDLE_MAGIC[8] = {'T', 'W', 'S', 'B', 'N', 'D', 'L', '1'};
+const uint32_t BUNDLE_VERSION = 1;
+
+struct bundle_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t count;          /* 文件数，也是槽位数 */
+    uint32_t buckets;        /* 桶数 */
+    uint32_t reserved;
+    uint64_t seeds_off;      /* uint32_t seeds[buckets] */
+    uint64_t entries_off;    /* bundle_entry[count]，按槽位排列 */
+    uint64_t size;           /* 整个包的大小，用于校验 */
+};
+
+const uint32_t BUNDLE_VARY = 1;  /* 可压缩，响应头中带 Vary: Accept-Encoding */
+
+struct bundle_entry {
+    uint64_t path_off;       /* 相对网站根目录的路径，以 / 开头 */
+    uint32_t path_len;
+    uint32_t flags;
+    uint64_t head_off;       /* 未压缩版本的响应头，响应体紧随其后 */
+    uint32_t head_len;
+    uint32_t gz_head_len;    /* gzip 版本的响应头长度，0 表示没有 gzip 版本 */
+    uint64_t body_len;
+    uint64_t gz_head_off;
+    uint64_t gz_body_len;
+};
+
+/* 路径哈希：FNV-1a 加 murmur 的收尾混合，seed 为 0 时用于分桶 */
+inline uint64_t bundle_hash(const char* s, size_t len, uint32_t seed) {
+    uint64_t h = 14695981039346656037ULL ^ ((uint64_t)seed * 0x9E3779B97F4A7C15ULL);
+    for (size_t i = 0; i < len; i++) {
+        h ^= (unsigned char)s[i];
+        h *= 1099511628211ULL;
+    }
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    return h;
+}
+
+/* 服务器端：只读打开资源包并查找 */
+class static_bundle {
+public:
+    /* 局部静态变量单例模式 */
+    static static_bundle* get_instance() {
+        static static_bundle instance;
+        return &instance;
+    }
+
+    /* 映射并校验资源包，失败返回 false 并保持未加载 */
+    bool open(const char* path);
+    bool loaded() const {
+        return m_base != nullptr;
+    }
+
+    /* 按路径查找，不存在返回 NULL */
+    const bundle_entry* find(const char* path, size_t len) const;
+    const char* data(uint64_t off) const {
+        return m_base + off;
+    }
+
+private:
+    static_bundle() : m_base(nullptr), m_size(0), m_header(nullptr), m_seeds(nullptr), m_entries(nullptr) {}
+    ~static_bundle();
+
+    bool validate() const;
+
+private:
+    const char* m_base;
+    size_t m_size;
+    const bundle_header* m_header;
+    const uint32_t* m_seeds;
+    const bundle_entry* m_entries;
+};
+
+#endif
@@ -12,11 +12,28 @@ Config::Config(){
     thread_num = 8;   //线程池内的线程数量,默认8   
     close_log = 0;  //关闭日志,默认不关闭 
     actor_model = 0;  //并发模型,默认是proactor
+    upload_dir = "";  //上传目录,默认不接受上传
+    gzip_cache_mb = 32;  //gzip缓存上限,默认32MB,0表示不压缩
+    cache_file_kb = 32;  //响应缓存的最大文件,默认32KB,0表示关闭响应缓存
+    cache_mb = 64;  //响应缓存上限,默认64MB
+    bundle = "";  //静态资源包,默认不使用
+    io_threads = 2;  //文件预读线程数,默认2,0表示事件循环直接从映射区发送
+    max_queue = 10000;  //线程池请求队列上限,默认10000,满了以503拒绝,超过3/4暂停accept
+    conn_rate = 0;  //每个IP每秒新建连接数上限,默认0不限
+    req_rate = 0;  //每个IP每秒请求数上限,默认0不限
+    max_conns = 0;  //每个IP同时连接数上限,默认0不限
+    backlog = 1024;  //listen队列长度,默认1024,实际不超过net.core.somaxconn
+    defer_accept = 0;  //TCP_DEFER_ACCEPT秒数,默认0不用,数据到达才唤醒accept
+    fastopen = 0;  //TCP_FASTOPEN队列长度,默认0不用
+    cpus = "";  //CPU列表,如0-3,8,默认不固定CPU
+    workers = 0;  //工作进程数,默认0单进程,大于0时主进程fork工作进程并在其退出时重新拉起
+    drain_sec = 30;  //SIGQUIT或升级后旧进程等待已有连接处理完的最长秒数,默认30
+    co_threads = 4;  //协程阻塞调用(数据库查询、文件读取)线程数,默认4,仅proactor,0表示表单请求交给线程池同步处理
 }
 
 void Config::parse_arg(int argc, char*argv[]){
     int opt;
-    const char *str = "p:l:m:o:s:t:c:a:";
+    const char *str = "p:l:m:o:s:t:c:a:u:z:f:M:B:i:q:r:R:C:b:d:F:A:w:g:j:";
     while ((opt = getopt(argc, argv, str)) != -1)
     {
         switch (opt)
@@ -61,6 +78,91 @@ void Config::parse_arg(int argc, char*argv[]){
             actor_model = atoi(optarg);
             break;
         }
+        case 'u':
+        {
+            upload_dir = optarg;
+            break;
+        }
+        case 'z':
+        {
+            gzip_cache_mb = atoi(optarg);
+            break;
+        }
+        case 'f':
+        {
+            cache_file_kb = atoi(optarg);
+            break;
+        }
+        case 'M':
+        {
+            cache_mb = atoi(optarg);
+            break;
+        }
+        case 'B':
+        {
+            bundle = optarg;
+            break;
+        }
+        case 'i':
+        {
+            io_threads = atoi(optarg);
+            break;
+        }
+        case 'q':
+        {
+            max_queue = atoi(optarg);
+            break;
+        }
+        case 'r':
+        {
+            conn_rate = atoi(optarg);
+            break;
+        }
+        case 'R':
+        {
+            req_rate = atoi(optarg);
+            break;
+        }
+        case 'C':
+        {
+            max_conns = atoi(optarg);
+            break;
+        }
+        case 'b':
+        {
+            backlog = atoi(optarg);
+            break;
+        }
+        case 'd':
+        {
+            defer_accept = atoi(optarg);
+            break;
+        }
+        case 'F':
+        {
+            fastopen = atoi(optarg);
+            break;
+        }
+        case 'A':
+        {
+            cpus = optarg;
+            break;
+        }
+        case 'w':
+        {
+            workers = atoi(optarg);
+            break;
+        }
+        case 'g':
+        {
+            drain_sec = atoi(optarg);
+            break;
+        }
+        case 'j':
+        {
+            co_threads = atoi(optarg);
+            break;
+        }
         default:
             break;
         }
@@ -22,6 +22,23 @@ public:
     int thread_num;         /* 线程池内的线程数量 */
     int close_log;          /* 是否关闭日志 */
     int actor_model;        /* 并发模型选择 */
+    string upload_dir;      /* 上传目录，为空表示不接受上传 */
+    int gzip_cache_mb;      /* gzip 缓存的内存上限(MB) */
+    int cache_file_kb;      /* 响应缓存可缓存的最大文件(KB) */
+    int cache_mb;           /* 响应缓存的内存上限(MB) */
+    string bundle;          /* 静态资源包，为空表示不使用 */
+    int io_threads;         /* 文件预读线程数 */
+    int max_queue;          /* 线程池请求队列的上限 */
+    int conn_rate;          /* 每个 IP 每秒新建连接数上限 */
+    int req_rate;           /* 每个 IP 每秒请求数上限 */
+    int max_conns;          /* 每个 IP 同时连接数上限 */
+    int backlog;            /* listen 的连接队列长度 */
+    int defer_accept;       /* TCP_DEFER_ACCEPT 的秒数，0 表示不用 */
+    int fastopen;           /* TCP_FASTOPEN 的队列长度，0 表示不用 */
+    string cpus;            /* 事件循环和工作线程使用的 CPU 列表，为空表示不固定 */
+    int workers;            /* 工作进程数，0 表示单进程 */
+    int drain_sec;          /* 平滑退出时等待已有连接的最长秒数 */
+    int co_threads;         /* 协程阻塞调用线程数 */
 };
 
 #endif
\ No newline at end of file
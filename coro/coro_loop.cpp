@@ -0,0 +1,135 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include "coro_loop.h"
+#include "../sql_conn_pool/sql_connection_pool.h"
+
+bool coro_loop::init(connection_pool* db, int threads) {
+    if (threads <= 0) {
+        return false;
+    }
+    m_db = db;
+    m_epollfd = epoll_create1(EPOLL_CLOEXEC);
+    if (m_epollfd < 0 || pipe2(m_notify, O_CLOEXEC | O_NONBLOCK) < 0) {
+        return false;
+    }
+    for (int i = 0; i < threads; i++) {
+        pthread_t tid;
+        if (pthread_create(&tid, nullptr, worker, this) != 0) {
+            break;
+        }
+        pthread_detach(tid);
+        m_threads++;
+    }
+    return m_threads > 0;
+}
+
+bool coro_loop::submit(blocking_call* job, coroutine_handle<> h) {
+    if (m_threads == 0) {
+        return false;
+    }
+    job->m_handle = h;
+    m_lock.lock();
+    m_jobs.push_back(job);
+    m_lock.unlock();
+    m_pending.post();
+    return true;
+}
+
+/* 一个 fd 同时只能有一个协程等待；就绪后在 run 中移出 */
+bool coro_loop::watch(socket_ready* waiter, coroutine_handle<> h) {
+    if (m_epollfd < 0) {
+        return false;
+    }
+    waiter->m_handle = h;
+    epoll_event event;
+    event.data.ptr = waiter;
+    event.events = waiter->m_events | EPOLLONESHOT;
+    return epoll_ctl(m_epollfd, EPOLL_CTL_ADD, waiter->m_fd, &event) == 0;
+}
+
+void coro_loop::run() {
+    epoll_event events[64];
+    int n;
+    while ((n = epoll_wait(m_epollfd, events, 64, 0)) > 0) {
+        for (int i = 0; i < n; i++) {
+            socket_ready* waiter = (socket_ready*)events[i].data.ptr;
+            waiter->m_revents = events[i].events;
+            epoll_ctl(m_epollfd, EPOLL_CTL_DEL, waiter->m_fd, 0);
+            waiter->m_handle.resume();
+        }
+    }
+
+    char buf[256];
+    while (read(m_notify[0], buf, sizeof(buf)) > 0) {
+    }
+    m_lock.lock();
+    list<coroutine_handle<> > ready;
+    ready.swap(m_ready);
+    m_lock.unlock();
+    for (list<coroutine_handle<> >::iterator it = ready.begin(); it != ready.end(); ++it) {
+        it->resume();
+    }
+}
+
+void* coro_loop::worker(void* arg) {
+    coro_loop* cl = (coro_loop*)arg;
+    cl->loop();
+    return cl;
+}
+
+/* 先放进就绪队列再写通知：事件循环读空管道后取队列，不会漏掉；管道满时已有未读的通知，不必再写 */
+void coro_loop::loop() {
+    while (true) {
+        m_pending.wait();
+        m_lock.lock();
+        if (m_jobs.empty()) {
+            m_lock.unlock();
+            continue;
+        }
+        blocking_call* job = m_jobs.front();
+        m_jobs.pop_front();
+        m_lock.unlock();
+
+        coroutine_handle<> h = job->m_handle;
+        job->call();
+        m_lock.lock();
+        m_ready.push_back(h);
+        m_lock.unlock();
+        char c = 1;
+        while (write(m_notify[1], &c, 1) < 0 && errno == EINTR) {
+        }
+    }
+}
+
+bool blocking_call::await_suspend(coroutine_handle<> h) {
+    if (coro_loop::get_instance()->submit(this, h)) {
+        return true;
+    }
+    call();
+    return false;
+}
+
+bool socket_ready::await_suspend(coroutine_handle<> h) {
+    if (coro_loop::get_instance()->watch(this, h)) {
+        return true;
+    }
+    m_revents = EPOLLERR;
+    return false;
+}
+
+void db_query::call() {
+    MYSQL* mysql = nullptr;
+    connectionRAII mysqlcon(&mysql, coro_loop::get_instance()->db());
+    if (mysql) {
+        m_result = m_run(mysql);
+    }
+}
+
+void file_read::call() {
+    do {
+        m_result = pread(m_fd, m_buf, m_len, m_off);
+    } while (m_result < 0 && errno == EINTR);
+}
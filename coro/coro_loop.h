@@ -0,0 +1,162 @@
+#ifndef CORO_LOOP_H
+#define CORO_LOOP_H
+
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/epoll.h>
+#include <mysql/mysql.h>
+#include <coroutine>
+#include <functional>
+#include <list>
+#include <string>
+
+#include "../lock/locker.h"
+#include "task.h"
+
+using namespace std;
+
+class connection_pool;
+
+/* 会阻塞的调用：在阻塞调用线程中执行 call()，完成后在事件循环线程中恢复等待的协程。
+    作为 awaitable 直接 co_await；db_query、file_read 是它的两种常用形式 */
+class blocking_call {
+public:
+    explicit blocking_call(function<void()> fn = nullptr) : m_fn(std::move(fn)) {}
+    virtual ~blocking_call() {}
+
+    bool await_ready() const {
+        return false;
+    }
+    /* 没有阻塞调用线程时就地执行，不挂起 */
+    bool await_suspend(coroutine_handle<> h);
+    void await_resume() const {}
+
+protected:
+    virtual void call() {
+        m_fn();
+    }
+
+private:
+    friend class coro_loop;
+    function<void()> m_fn;
+    coroutine_handle<> m_handle;
+};
+
+/* 数据库查询：从连接池取一个连接交给 run(转义参数、拼语句、执行都在这个连接上)，
+    co_await 的结果为 run 的返回值，约定 0 表示成功；取不到连接时为 -1 */
+class db_query : public blocking_call {
+public:
+    explicit db_query(function<int(MYSQL*)> run) : m_run(std::move(run)), m_result(-1) {}
+    int await_resume() const {
+        return m_result;
+    }
+
+protected:
+    void call();
+
+private:
+    function<int(MYSQL*)> m_run;
+    int m_result;
+};
+
+/* 文件读取：pread(fd, buf, len, off)，co_await 的结果为读到的字节数，出错为 -1 */
+class file_read : public blocking_call {
+public:
+    file_read(int fd, void* buf, size_t len, off_t off) : m_fd(fd), m_buf(buf), m_len(len), m_off(off), m_result(-1) {}
+    ssize_t await_resume() const {
+        return m_result;
+    }
+
+protected:
+    void call();
+
+private:
+    int m_fd;
+    void* m_buf;
+    size_t m_len;
+    off_t m_off;
+    ssize_t m_result;
+};
+
+/* socket 就绪：等待 fd 上出现 events(EPOLLIN/EPOLLOUT)，co_await 的结果为发生的事件(可能含 EPOLLHUP/EPOLLERR) */
+class socket_ready {
+public:
+    socket_ready(int fd, uint32_t events) : m_fd(fd), m_events(events), m_revents(0) {}
+
+    bool await_ready() const {
+        return false;
+    }
+    /* 登记失败(fd 无效)时不挂起，结果为 EPOLLERR */
+    bool await_suspend(coroutine_handle<> h);
+    uint32_t await_resume() const {
+        return m_revents;
+    }
+
+private:
+    friend class coro_loop;
+    int m_fd;
+    uint32_t m_events;
+    uint32_t m_revents;
+    coroutine_handle<> m_handle;
+};
+
+/* 协程的调度：
+    等待 socket 就绪的协程登记在本模块自己的 epoll 实例中(EPOLLONESHOT)，这个 epoll 实例的 fd 本身又注册在
+    事件循环的 epoll 中；会阻塞的调用交给阻塞调用线程执行，完成后协程进入就绪队列，再往通知管道写一个字节，
+    管道读端同样注册在事件循环的 epoll 中。事件循环收到这两个 fd 的事件时调用 run()，协程总在事件循环线程中恢复，
+    访问连接不需要加锁。
+    等待期间协程只占用它的协程帧，成千上万个慢请求可以同时挂起；阻塞调用线程数只决定同时进行的阻塞调用数，
+    数据库查询同时还受连接池大小的限制。
+*/
+class coro_loop {
+public:
+    /* 局部静态变量单例模式 */
+    static coro_loop* get_instance() {
+        static coro_loop instance;
+        return &instance;
+    }
+
+    /* 创建 epoll 实例、通知管道和 threads 个阻塞调用线程，db 为数据库查询使用的连接池；失败返回 false */
+    bool init(connection_pool* db, int threads);
+    bool enabled() const {
+        return m_threads > 0;
+    }
+    /* 由事件循环注册到它的 epoll 中，两者都非阻塞 */
+    int poll_fd() const {
+        return m_epollfd;
+    }
+    int notify_fd() const {
+        return m_notify[0];
+    }
+    connection_pool* db() const {
+        return m_db;
+    }
+
+    /* 事件循环线程调用：恢复 socket 已就绪和阻塞调用已完成的协程 */
+    void run();
+
+    /* 由 awaitable 调用 */
+    bool submit(blocking_call* job, coroutine_handle<> h);
+    bool watch(socket_ready* waiter, coroutine_handle<> h);
+
+private:
+    coro_loop() : m_db(nullptr), m_threads(0), m_epollfd(-1) {
+        m_notify[0] = m_notify[1] = -1;
+    }
+    ~coro_loop() {}
+
+    static void* worker(void* arg);
+    void loop();
+
+private:
+    connection_pool* m_db;
+    int m_threads;
+    int m_epollfd;
+    int m_notify[2];
+    list<blocking_call*> m_jobs;       /* 等待执行的阻塞调用 */
+    list<coroutine_handle<> > m_ready; /* 阻塞调用已完成、等待恢复的协程 */
+    locker m_lock;                     /* 保护以上两个队列 */
+    sem m_pending;
+};
+
+#endif
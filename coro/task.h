@@ -0,0 +1,146 @@
+#ifndef CORO_TASK_H
+#define CORO_TASK_H
+
+#include <coroutine>
+#include <exception>
+#include <utility>
+
+/* 协程任务：请求处理函数写成返回 task 的协程，遇到会阻塞的步骤时 co_await 对应的 awaitable(见 coro_loop.h)，
+    挂起期间不占用任何线程，操作完成后由事件循环线程恢复，处理函数因此可以按顺序直写而不用拆成回调。
+    task 创建时先挂起，被 co_await 时才开始执行，执行完经对称转移直接恢复等待它的协程；
+    最外层的 task 由 spawn 启动并脱离调用者，执行完自行销毁协程帧。
+*/
+template <typename T = void>
+class task;
+
+namespace coro_detail {
+
+/* 执行完时：有等待者则转去执行等待者，脱离的任务销毁自己 */
+struct final_awaiter {
+    bool await_ready() noexcept {
+        return false;
+    }
+    template <typename P>
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<P> h) noexcept {
+        std::coroutine_handle<> next = h.promise().continuation;
+        if (next) {
+            return next;
+        }
+        if (h.promise().detached) {
+            h.destroy();
+        }
+        return std::noop_coroutine();
+    }
+    void await_resume() noexcept {}
+};
+
+struct promise_base {
+    std::coroutine_handle<> continuation;  /* co_await 这个任务的协程 */
+    bool detached = false;                 /* 由 spawn 启动，没有等待者 */
+    std::exception_ptr error;
+
+    std::suspend_always initial_suspend() noexcept {
+        return {};
+    }
+    final_awaiter final_suspend() noexcept {
+        return {};
+    }
+    /* 脱离的任务没有人接收异常，与线程函数中未捕获的异常一样终止进程 */
+    void unhandled_exception() {
+        if (detached) {
+            std::terminate();
+        }
+        error = std::current_exception();
+    }
+};
+
+}  // namespace coro_detail
+
+template <typename T>
+class task {
+public:
+    struct promise_type : coro_detail::promise_base {
+        T value{};
+        task get_return_object() {
+            return task(std::coroutine_handle<promise_type>::from_promise(*this));
+        }
+        void return_value(T v) {
+            value = std::move(v);
+        }
+    };
+
+    task(task&& other) noexcept : m_handle(std::exchange(other.m_handle, nullptr)) {}
+    task(const task&) = delete;
+    task& operator=(const task&) = delete;
+    ~task() {
+        if (m_handle) {
+            m_handle.destroy();
+        }
+    }
+
+    bool await_ready() const noexcept {
+        return false;
+    }
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<> waiter) noexcept {
+        m_handle.promise().continuation = waiter;
+        return m_handle;
+    }
+    T await_resume() {
+        if (m_handle.promise().error) {
+            std::rethrow_exception(m_handle.promise().error);
+        }
+        return std::move(m_handle.promise().value);
+    }
+
+private:
+    explicit task(std::coroutine_handle<promise_type> h) : m_handle(h) {}
+
+    std::coroutine_handle<promise_type> m_handle;
+};
+
+template <>
+class task<void> {
+public:
+    struct promise_type : coro_detail::promise_base {
+        task get_return_object() {
+            return task(std::coroutine_handle<promise_type>::from_promise(*this));
+        }
+        void return_void() {}
+    };
+
+    task(task&& other) noexcept : m_handle(std::exchange(other.m_handle, nullptr)) {}
+    task(const task&) = delete;
+    task& operator=(const task&) = delete;
+    ~task() {
+        if (m_handle) {
+            m_handle.destroy();
+        }
+    }
+
+    bool await_ready() const noexcept {
+        return false;
+    }
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<> waiter) noexcept {
+        m_handle.promise().continuation = waiter;
+        return m_handle;
+    }
+    void await_resume() {
+        if (m_handle.promise().error) {
+            std::rethrow_exception(m_handle.promise().error);
+        }
+    }
+
+    /* 启动任务并脱离：执行到第一次挂起时返回，之后由事件循环恢复，执行完自行销毁 */
+    friend void spawn(task t) {
+        std::coroutine_handle<promise_type> h = std::exchange(t.m_handle, nullptr);
+        h.promise().detached = true;
+        h.resume();
+    }
+
+private:
+    explicit task(std::coroutine_handle<promise_type> h) : m_handle(h) {}
+
+    std::coroutine_handle<promise_type> m_handle;
+};
+
+#endif
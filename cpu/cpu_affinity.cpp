@@ -0,0 +1,138 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <linux/filter.h>
+
+#include "cpu_affinity.h"
+
+/* "0-3,8,10-11" */
+bool cpu_affinity::init(const char* list, int loops) {
+    m_cpus.clear();
+    m_loops = loops > 0 ? loops : 1;
+    if (!list || !*list) {
+        return true;
+    }
+    cpu_set_t allowed;
+    CPU_ZERO(&allowed);
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) < 0) {
+        return false;
+    }
+    cpu_set_t seen;
+    CPU_ZERO(&seen);
+    const char* p = list;
+    while (*p) {
+        char* end;
+        long first = strtol(p, &end, 10);
+        if (end == p) {
+            return false;
+        }
+        long last = first;
+        p = end;
+        if (*p == '-') {
+            last = strtol(p + 1, &end, 10);
+            if (end == p + 1) {
+                return false;
+            }
+            p = end;
+        }
+        if (first < 0 || last < first || last >= CPU_SETSIZE) {
+            return false;
+        }
+        for (long cpu = first; cpu <= last; cpu++) {
+            if (!CPU_ISSET(cpu, &allowed)) {
+                return false;
+            }
+            if (!CPU_ISSET(cpu, &seen)) {
+                CPU_SET(cpu, &seen);
+                m_cpus.push_back(cpu);
+            }
+        }
+        if (*p == ',') {
+            p++;
+        }
+        else if (*p) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void cpu_affinity::loop_set(int loop, cpu_set_t* set) const {
+    CPU_ZERO(set);
+    for (size_t j = 0; j < m_cpus.size(); j++) {
+        if ((int)(j % m_loops) == loop % m_loops) {
+            CPU_SET(m_cpus[j], set);
+        }
+    }
+}
+
+/* CPU 比事件循环少时几个事件循环共用 CPU：第 loop 个事件循环用第 loop % CPU 数 个 CPU */
+bool cpu_affinity::bind_loop_cpus(int loop) const {
+    if (!enabled()) {
+        return true;
+    }
+    cpu_set_t set;
+    loop_set(loop, &set);
+    if (CPU_COUNT(&set) == 0) {
+        CPU_SET(loop_cpu(loop), &set);
+    }
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+}
+
+bool cpu_affinity::pin_loop_thread(int loop) const {
+    if (!enabled()) {
+        return true;
+    }
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(loop_cpu(loop), &set);
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+}
+
+int cpu_affinity::loop_cpu(int loop) const {
+    if (!enabled()) {
+        return -1;
+    }
+    return m_cpus[loop % m_loops % m_cpus.size()];
+}
+
+bool cpu_affinity::owns(int loop, int cpu) const {
+    for (size_t j = 0; j < m_cpus.size(); j++) {
+        if (m_cpus[j] == cpu) {
+            return (int)(j % m_loops) == loop % m_loops;
+        }
+    }
+    return false;
+}
+
+static sock_filter bpf_stmt(uint16_t code, uint32_t k) {
+    sock_filter f = BPF_STMT(code, k);
+    return f;
+}
+
+static sock_filter bpf_jump(uint16_t code, uint32_t k, uint8_t jt, uint8_t jf) {
+    sock_filter f = BPF_JUMP(code, k, jt, jf);
+    return f;
+}
+
+/* A = 处理这个连接的 CPU；逐个比较列表中的 CPU，命中返回它所属的事件循环，都不命中返回 A % loops。
+    程序的返回值是 reuseport 组中 socket 的下标，超出组的大小时内核退回按四元组哈希选择 */
+bool cpu_affinity::attach_steering(int listenfd) const {
+    if (!enabled()) {
+        return true;
+    }
+    vector<sock_filter> code;
+    code.push_back(bpf_stmt(BPF_LD | BPF_W | BPF_ABS, SKF_AD_OFF + SKF_AD_CPU));
+    for (size_t j = 0; j < m_cpus.size(); j++) {
+        code.push_back(bpf_jump(BPF_JMP | BPF_JEQ | BPF_K, m_cpus[j], 0, 1));
+        code.push_back(bpf_stmt(BPF_RET | BPF_K, j % m_loops));
+    }
+    code.push_back(bpf_stmt(BPF_ALU | BPF_MOD | BPF_K, m_loops));
+    code.push_back(bpf_stmt(BPF_RET | BPF_A, 0));
+    sock_fprog prog;
+    prog.len = code.size();
+    prog.filter = code.data();
+    return setsockopt(listenfd, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &prog, sizeof(prog)) == 0;
+}
@@ -0,0 +1,54 @@
+#ifndef CPU_AFFINITY_H
+#define CPU_AFFINITY_H
+
+#include <sched.h>
+#include <vector>
+
+using namespace std;
+
+/* 把事件循环和它的工作线程固定在一组 CPU 上，并让新连接落到收到它的 CPU 所属的事件循环。
+    CPU 列表(如 "0-3,8-11")按顺序轮流分给各个事件循环：第 j 个 CPU 属于第 j % loops 个事件循环，
+    事件循环线程固定在它的第一个 CPU 上，工作线程、I/O 线程限制在它的全部 CPU 上。
+    每个事件循环有自己的 SO_REUSEPORT 监听 socket，按创建顺序就是它在 reuseport 组中的下标；
+    组上挂一段经典 BPF 程序，按处理 SYN 的 CPU(网卡中断/软中断所在的 CPU)选出下标，
+    连接从软中断到 accept、解析、发送都在同一组 CPU 上，不跨核搬运缓存行。
+    列表之外的 CPU 收到的连接按 CPU 号取模分配。 */
+class cpu_affinity {
+public:
+    /* 局部静态变量单例模式 */
+    static cpu_affinity* get_instance() {
+        static cpu_affinity instance;
+        return &instance;
+    }
+
+    /* 解析 CPU 列表，loops 为事件循环的个数；列表为空表示不固定，格式错误或含有不可用的 CPU 时返回 false */
+    bool init(const char* list, int loops);
+    bool enabled() const {
+        return !m_cpus.empty();
+    }
+    int loops() const {
+        return m_loops;
+    }
+
+    /* 把调用线程(及之后由它创建的线程)限制在第 loop 个事件循环的 CPU 上 */
+    bool bind_loop_cpus(int loop) const;
+    /* 把调用线程固定在第 loop 个事件循环的第一个 CPU 上，由事件循环线程在创建完其他线程之后调用 */
+    bool pin_loop_thread(int loop) const;
+    /* 第 loop 个事件循环的第一个 CPU */
+    int loop_cpu(int loop) const;
+    /* cpu 是否属于第 loop 个事件循环 */
+    bool owns(int loop, int cpu) const;
+
+    /* 在监听 socket 所在的 reuseport 组上挂 CPU -> 事件循环下标的 BPF 程序 */
+    bool attach_steering(int listenfd) const;
+
+private:
+    cpu_affinity() : m_loops(1) {}
+    void loop_set(int loop, cpu_set_t* set) const;
+
+private:
+    vector<int> m_cpus;  /* 按列表顺序 */
+    int m_loops;
+};
+
+#endif
@@ -0,0 +1,69 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/resource.h>
+
+#include "conn_table.h"
+#include "../metrics/metrics.h"
+
+/* 硬限制为 unlimited 时软限制最多只能提到 fs.nr_open */
+static rlim_t nr_open() {
+    rlim_t n = 1024 * 1024;
+    FILE* fp = fopen("/proc/sys/fs/nr_open", "r");
+    if (fp) {
+        unsigned long long v;
+        if (fscanf(fp, "%llu", &v) == 1) {
+            n = v;
+        }
+        fclose(fp);
+    }
+    return n;
+}
+
+bool conn_table::init() {
+    struct rlimit rl;
+    if (getrlimit(RLIMIT_NOFILE, &rl) < 0) {
+        return false;
+    }
+    if (rl.rlim_cur < rl.rlim_max) {
+        struct rlimit raised = rl;
+        raised.rlim_cur = rl.rlim_max == RLIM_INFINITY ? nr_open() : rl.rlim_max;
+        if (setrlimit(RLIMIT_NOFILE, &raised) == 0) {
+            rl = raised;
+        }
+    }
+    rlim_t cap = rl.rlim_cur == RLIM_INFINITY ? nr_open() : rl.rlim_cur;
+    if (cap > (1u << 30)) {
+        cap = 1u << 30;
+    }
+    /* calloc 大块内存来自 mmap，用到的页才会分配 */
+    m_table = (connection**)calloc(cap, sizeof(connection*));
+    if (!m_table) {
+        return false;
+    }
+    m_capacity = cap;
+    return true;
+}
+
+connection* conn_table::open(int fd) {
+    if ((unsigned)fd >= (unsigned)m_capacity) {
+        return nullptr;
+    }
+    size_t before = m_pool.allocated();
+    connection* c = m_pool.alloc();
+    METRIC_ADD(M_CONN_OBJECTS, m_pool.allocated() - before);
+    m_table[fd] = c;
+    return c;
+}
+
+void conn_table::release(int fd, const client_data* data) {
+    connection* c = get(fd);
+    if (c && &c->data == data) {
+        m_table[fd] = nullptr;
+        c->conn.release_cached();
+        m_pool.free(c);
+    }
+}
+
+conn_table::~conn_table() {
+    free(m_table);
+}
@@ -0,0 +1,109 @@
+#ifndef CONN_TABLE_H
+#define CONN_TABLE_H
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <new>
+#include <vector>
+
+#include "http_conn.h"
+#include "../timer/lst_timer.h"
+
+using namespace std;
+
+/* 对象池：按 SLAB_SIZE 个对象一批向系统申请，归还的对象放回空闲栈，下次直接复用，不析构也不重新构造。
+    归还的对象马上会被下一个 accept 取走并 init()，所以工作线程或协程还在使用的连接(in_worker())不能归还：
+    定时器推迟这样的连接，其他关闭路径都在连接回到事件循环之后。已申请的批不还给系统。
+    只在事件循环线程中使用，不加锁。 */
+template <typename T>
+class slab_pool {
+public:
+    static const int SLAB_SIZE = 64;
+
+    slab_pool() {}
+    ~slab_pool() {
+        for (size_t i = 0; i < m_slabs.size(); i++) {
+            for (int j = 0; j < SLAB_SIZE; j++) {
+                m_slabs[i][j].~T();
+            }
+            ::free(m_slabs[i]);
+        }
+    }
+
+    T* alloc() {
+        if (m_free.empty()) {
+            /* C++11 的 new 不保证超过 16 字节的对齐，按对象的对齐(缓存行)申请，相邻对象不共享缓存行 */
+            void* mem = nullptr;
+            size_t align = alignof(T) > sizeof(void*) ? alignof(T) : sizeof(void*);
+            if (posix_memalign(&mem, align, sizeof(T) * SLAB_SIZE) != 0) {
+                throw std::bad_alloc();
+            }
+            T* slab = (T*)mem;
+            for (int i = 0; i < SLAB_SIZE; i++) {
+                new (slab + i) T();
+            }
+            m_slabs.push_back(slab);
+            for (int i = SLAB_SIZE - 1; i >= 0; i--) {
+                m_free.push_back(slab + i);
+            }
+        }
+        T* obj = m_free.back();
+        m_free.pop_back();
+        return obj;
+    }
+    void free(T* obj) {
+        m_free.push_back(obj);
+    }
+    /* 已向系统申请的对象个数 */
+    size_t allocated() const {
+        return m_slabs.size() * SLAB_SIZE;
+    }
+
+private:
+    vector<T*> m_slabs;
+    vector<T*> m_free;
+};
+
+/* 一个连接的全部状态：HTTP 连接和它的定时器数据 */
+struct connection {
+    http_conn conn;
+    client_data data;
+};
+
+/* 连接表：fd -> 连接，大小由 RLIMIT_NOFILE 决定(启动时把软限制提到硬限制)，
+    表里只有指针，连接对象在 accept 时从对象池取出，关闭时归还，内存随同时在线的连接数增长，
+    而不是按 fd 上限一次性分配。 */
+class conn_table {
+public:
+    /* 局部静态变量单例模式 */
+    static conn_table* get_instance() {
+        static conn_table instance;
+        return &instance;
+    }
+
+    /* 调整 RLIMIT_NOFILE 并分配指针表，失败返回 false */
+    bool init();
+    int capacity() const {
+        return m_capacity;
+    }
+
+    /* fd 上的连接，没有时返回 NULL(已关闭的 fd 上迟到的事件) */
+    connection* get(int fd) const {
+        return (unsigned)fd < (unsigned)m_capacity ? m_table[fd] : nullptr;
+    }
+    /* 为新接受的 fd 取一个连接对象，fd 超出表的大小时返回 NULL */
+    connection* open(int fd);
+    /* 连接关闭后归还对象；data 用来确认 fd 上还是同一个连接。调用时连接不能在工作线程手里 */
+    void release(int fd, const client_data* data);
+
+private:
+    conn_table() : m_table(nullptr), m_capacity(0) {}
+    ~conn_table();
+
+private:
+    connection** m_table;
+    int m_capacity;
+    slab_pool<connection> m_pool;
+};
+
+#endif
@@ -0,0 +1,83 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <new>
+
+#include "http_arena.h"
+
+static size_t align_up(size_t n, size_t align) {
+    return (n + align - 1) & ~(align - 1);
+}
+
+void* request_arena::alloc(size_t n, size_t align) {
+    size_t off = align_up((uintptr_t)m_base + m_used, align) - (uintptr_t)m_base;
+    if (m_base && !m_overflow && off + n <= m_size) {
+        m_used = off + n;
+        return m_base + off;
+    }
+    return alloc_overflow(n, align);
+}
+
+/* 自带内存用完后的分配都落在溢出块里，保持"复位前只增不减" */
+void* request_arena::alloc_overflow(size_t n, size_t align) {
+    if (m_overflow) {
+        char* data = (char*)(m_overflow + 1);
+        size_t off = align_up((uintptr_t)data + m_overflow->used, align) - (uintptr_t)data;
+        if (off + n <= m_overflow->size) {
+            m_overflow->used = off + n;
+            return data + off;
+        }
+    }
+    size_t size = n + align > OVERFLOW_SIZE ? n + align : OVERFLOW_SIZE;
+    block* b = (block*)malloc(sizeof(block) + size);
+    if (!b) {
+        throw std::bad_alloc();
+    }
+    b->next = m_overflow;
+    b->size = size;
+    b->used = 0;
+    m_overflow = b;
+    char* data = (char*)(b + 1);
+    size_t off = align_up((uintptr_t)data, align) - (uintptr_t)data;
+    b->used = off + n;
+    return data + off;
+}
+
+char* request_arena::strdup(const char* s, size_t len) {
+    char* p = (char*)alloc(len + 1, 1);
+    memcpy(p, s, len);
+    p[len] = '\0';
+    return p;
+}
+
+/* 先按自带内存的剩余空间格式化，放不下时按实际长度重新分配再格式化一次 */
+char* request_arena::printf(const char* format, ...) {
+    size_t room = m_base && !m_overflow && m_used < m_size ? m_size - m_used : 0;
+    char* p = m_base + m_used;
+    va_list ap;
+    va_start(ap, format);
+    int n = vsnprintf(room ? p : nullptr, room, format, ap);
+    va_end(ap);
+    if (n < 0) {
+        n = 0;
+    }
+    if ((size_t)n < room) {
+        m_used += n + 1;
+        return p;
+    }
+    p = (char*)alloc(n + 1, 1);
+    va_start(ap, format);
+    vsnprintf(p, n + 1, format, ap);
+    va_end(ap);
+    return p;
+}
+
+void request_arena::reset() {
+    while (m_overflow) {
+        block* next = m_overflow->next;
+        free(m_overflow);
+        m_overflow = next;
+    }
+    m_used = 0;
+}
@@ -0,0 +1,59 @@
+#ifndef HTTP_ARENA_H
+#define HTTP_ARENA_H
+
+#include <stddef.h>
+#include <stdarg.h>
+
+/* 请求级的线性分配器(bump allocator)：请求处理中的临时数据从连接自带的一块内存中顺序切出，
+    不逐个释放，请求结束时(http_conn::init)整体复位。
+    自带的内存不够时向系统申请溢出块，复位时一并归还；正常的请求不会用到溢出块，请求路径上没有堆分配。
+    只由当前处理该连接的线程使用，不加锁。 */
+class request_arena {
+public:
+    static const size_t OVERFLOW_SIZE = 4096;  /* 溢出块的最小大小 */
+
+    request_arena() : m_base(nullptr), m_size(0), m_used(0), m_overflow(nullptr) {}
+    ~request_arena() {
+        reset();
+    }
+
+    /* 使用 [base, base + size) 作为自带的内存 */
+    void attach(char* base, size_t size) {
+        m_base = base;
+        m_size = size;
+        m_used = 0;
+    }
+
+    /* 分配 n 字节，按 align 对齐，不会失败(溢出块申请失败时抛出 bad_alloc) */
+    void* alloc(size_t n, size_t align = sizeof(void*));
+    /* 复制一个字符串(len 字节，另加 \0) */
+    char* strdup(const char* s, size_t len);
+    /* 按格式生成字符串 */
+    char* printf(const char* format, ...);
+    /* 释放本次请求分配的全部内存 */
+    void reset();
+
+    /* 自带内存中已分配的字节数 */
+    size_t used() const {
+        return m_used;
+    }
+
+    request_arena(const request_arena&) = delete;
+    request_arena& operator=(const request_arena&) = delete;
+
+private:
+    struct block {
+        block* next;
+        size_t size;
+        size_t used;
+    };
+    void* alloc_overflow(size_t n, size_t align);
+
+private:
+    char* m_base;
+    size_t m_size;
+    size_t m_used;
+    block* m_overflow;  /* 溢出块链表，表头是当前在用的块 */
+};
+
+#endif
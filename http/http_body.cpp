@@ -0,0 +1,117 @@
+#include "http_body.h"
+
+void body_reader::init_length(long long length, body_handler* handler) {
+    m_handler = handler;
+    m_remain = length;
+    m_received = 0;
+    m_state = length > 0 ? S_LENGTH : S_DONE;
+}
+
+void body_reader::init_chunked(body_handler* handler) {
+    m_handler = handler;
+    m_remain = 0;
+    m_size_digits = 0;
+    m_received = 0;
+    m_state = S_SIZE;
+}
+
+static int hex_value(char c) {
+    if (c >= '0' && c <= '9') {
+        return c - '0';
+    }
+    if (c >= 'a' && c <= 'f') {
+        return c - 'a' + 10;
+    }
+    if (c >= 'A' && c <= 'F') {
+        return c - 'A' + 10;
+    }
+    return -1;
+}
+
+/* 数据部分整段交给处理者，只有分块的框架(大小行、CRLF、尾部字段)逐字节走状态机 */
+int body_reader::feed(const char* data, int len) {
+    int i = 0;
+    while (i < len && m_state != S_DONE) {
+        char c = data[i];
+        switch (m_state) {
+        case S_LENGTH:
+        case S_DATA: {
+            int n = (long long)(len - i) < m_remain ? len - i : (int)m_remain;
+            if (!m_handler->on_data(data + i, n)) {
+                return BODY_REJECTED;
+            }
+            i += n;
+            m_remain -= n;
+            m_received += n;
+            if (m_remain == 0) {
+                m_state = m_state == S_LENGTH ? S_DONE : S_DATA_CR;
+            }
+            continue;
+        }
+        case S_SIZE: {
+            int v = hex_value(c);
+            if (v >= 0) {
+                if (++m_size_digits > 15) {
+                    return BODY_ERROR;
+                }
+                m_remain = m_remain * 16 + v;
+            }
+            else if (m_size_digits == 0) {
+                return BODY_ERROR;
+            }
+            else if (c == ';' || c == ' ' || c == '\t') {
+                m_state = S_EXT;
+            }
+            else if (c == '\r') {
+                m_state = S_SIZE_LF;
+            }
+            else {
+                return BODY_ERROR;
+            }
+            break;
+        }
+        case S_EXT:
+            if (c == '\r') {
+                m_state = S_SIZE_LF;
+            }
+            break;
+        case S_SIZE_LF:
+            if (c != '\n') {
+                return BODY_ERROR;
+            }
+            m_state = m_remain > 0 ? S_DATA : S_TRAILER;
+            break;
+        case S_DATA_CR:
+            if (c != '\r') {
+                return BODY_ERROR;
+            }
+            m_state = S_DATA_LF;
+            break;
+        case S_DATA_LF:
+            if (c != '\n') {
+                return BODY_ERROR;
+            }
+            m_size_digits = 0;
+            m_state = S_SIZE;
+            break;
+        case S_TRAILER:
+            m_state = c == '\r' ? S_END_LF : S_TRAILER_LINE;
+            break;
+        case S_TRAILER_LINE:
+            if (c == '\n') {
+                m_state = S_TRAILER;
+            }
+            break;
+        case S_END_LF:
+            if (c != '\n') {
+                return BODY_ERROR;
+            }
+            m_state = S_DONE;
+            break;
+        default:
+            return BODY_ERROR;
+        }
+        i++;
+    }
+    return i;
+}
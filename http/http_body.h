@@ -0,0 +1,98 @@
+#ifndef HTTP_BODY_H
+#define HTTP_BODY_H
+
+#include <string>
+
+using namespace std;
+
+/* 请求消息体的流式读取：
+    body_reader 按 Content-Length 或 Transfer-Encoding: chunked 增量解码，读缓冲区里有多少就消费多少，
+    解码出的数据按到达顺序分片交给 body_handler，不要求整个消息体连续地放在内存里，
+    每个连接占用的内存与消息体长度无关。
+*/
+
+/* 消息体的消费者 */
+class body_handler {
+public:
+    virtual ~body_handler() {}
+    /* 一段解码后的数据；返回 false 表示拒绝(如超出上限)，请求以 413 结束 */
+    virtual bool on_data(const char* data, int len) = 0;
+};
+
+/* 把消息体收集到字符串中，超过上限即拒绝：用于登录/注册表单 */
+class body_collector : public body_handler {
+public:
+    body_collector() : m_out(nullptr), m_limit(0) {}
+    void init(string* out, size_t limit) {
+        m_out = out;
+        m_limit = limit;
+        m_out->clear();
+    }
+    bool on_data(const char* data, int len) {
+        if (m_out->size() + len > m_limit) {
+            return false;
+        }
+        m_out->append(data, len);
+        return true;
+    }
+
+private:
+    string* m_out;
+    size_t m_limit;
+};
+
+/* 丢弃消息体：不关心消息体的请求也要把它读完，连接才能继续复用 */
+class body_discarder : public body_handler {
+public:
+    bool on_data(const char* /* data */, int /* len */) {
+        return true;
+    }
+};
+
+/* feed 的返回值：非负数为消费的字节数 */
+const int BODY_ERROR = -1;      /* 分块格式错误，400 */
+const int BODY_REJECTED = -2;   /* 处理者拒绝，413 */
+
+class body_reader {
+public:
+    body_reader() : m_state(S_DONE), m_handler(nullptr), m_remain(0), m_size_digits(0), m_received(0) {}
+
+    /* 定长消息体 */
+    void init_length(long long length, body_handler* handler);
+    /* chunked 编码的消息体 */
+    void init_chunked(body_handler* handler);
+
+    /* 消费 [data, data + len)，消息体结束后不再多消费，剩余字节属于下一个请求 */
+    int feed(const char* data, int len);
+
+    bool done() const {
+        return m_state == S_DONE;
+    }
+    /* 已解码的消息体字节数 */
+    long long received() const {
+        return m_received;
+    }
+
+private:
+    enum STATE {
+        S_LENGTH = 0,   /* 定长数据 */
+        S_SIZE,         /* 块大小(十六进制) */
+        S_EXT,          /* 块扩展，跳过 */
+        S_SIZE_LF,
+        S_DATA,         /* 块数据 */
+        S_DATA_CR,
+        S_DATA_LF,
+        S_TRAILER,      /* 最后一块之后的一行的行首：空行结束，否则为尾部字段 */
+        S_TRAILER_LINE, /* 尾部字段，跳过 */
+        S_END_LF,
+        S_DONE
+    };
+
+    STATE m_state;
+    body_handler* m_handler;
+    long long m_remain;      /* 当前块(或定长消息体)剩余的字节数 */
+    int m_size_digits;       /* 块大小已读入的位数 */
+    long long m_received;
+};
+
+#endif
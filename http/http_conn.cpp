@@ -1,9 +1,19 @@
 #include "http_conn.h"
+#include "http_scan.h"
+#include "http_validators.h"
+#include "../threadpool/io_pool.h"
+#include "../coro/coro_loop.h"
 #include <mysql/mysql.h>
 #include <fstream>
 
 /* 定义 HTTP 响应的一些状态信息 */
 const char* ok_200_title = "OK";
+const char* created_201_title = "Created";
+const char* partial_206_title = "Partial Content";
+const char* not_modified_304_title = "Not Modified";
+const char* range_416_title = "Range Not Satisfiable";
+const char* error_413_title = "Payload Too Large";
+const char* error_413_form = "The request body is larger than the server is willing to process.\n";
 const char* error_400_title = "Bad Request";
 const char* error_400_form = "Your request has bad syntax or is inherently impossible to staisfy.\n";
 const char* error_403_title = "Forbidden";
@@ -13,6 +23,10 @@ const char* error_404_form = "The requested file was not found on this server.\n
 const char* error_500_title = "Internal Error";
 const char* error_500_form = "There was an unusual problem serving the request file.\n";
 
+/* Connection 头部行和空行，与 add_Linger 的输出一致；缓存和资源包中的响应按连接补上这一行 */
+static const char conn_keep_alive[] = "Connection: Keep-alive\r\n\r\n";
+static const char conn_close[] = "Connection: close\r\n\r\n";
+
 locker m_lock;
 map<string, string> users;
 
@@ -44,18 +58,10 @@ void http_conn::initmysql_result(connection_pool* connPool) {  /* 初始化MySQL
     }
 }
 
-/* 使用 fcntl 函数设置文件描述符为非阻塞 IO */
-/* 传入参数为： 文件描述符 */
-int setNonBlocking(int fd) {
-    int old_option = fcntl(fd, F_GETFL);
-    int new_option = old_option | O_NONBLOCK;
-    fcntl(fd, F_SETFL, new_option);
-    return old_option;
-}
-
 /* 向 epollfd 中注册监视对象文件描述符 fd, 以及设置监视事件 */
 /* 传入参数为： epoll文件描述符 epollfd，需要注册的监视对象文件描述符fd, 是否one_shot */
 /* 根据 TRIGMode参数,选定以(LT or ET)模式读取数据 */
+/* 连接 socket 由 accept4 创建时已是非阻塞的，这里不再 fcntl */
 void addfd(int epollfd, int fd, bool one_shot, int TRIGMode) {
     epoll_event event;
     event.data.fd = fd;
@@ -70,7 +76,6 @@ void addfd(int epollfd, int fd, bool one_shot, int TRIGMode) {
         event.events |= EPOLLONESHOT;
     }
     epoll_ctl(epollfd, EPOLL_CTL_ADD, fd, &event);
-    setNonBlocking(fd);
 }
 
 /* 从 epollfd 中删除监视的文件描述符 fd, 并关闭文件描述符 fd */
@@ -97,43 +102,139 @@ void modfd(int epollfd, int fd, int ev, int TRIGMode) {
 /* 类外初始化静态变量： epoll文件描述符初始化为 -1 , 用户数量初始化为 0 */
 int http_conn::m_user_count = 0;
 int http_conn::m_epollfd = -1;
+string http_conn::m_upload_dir;
+bool http_conn::m_io_offload = false;
+bool http_conn::m_persistent = false;
+bool http_conn::m_worker_io = false;
+bool http_conn::m_draining = false;
+
+/* 常驻注册的事件：读写都关注，只在状态变化时通知一次 */
+static const uint32_t PERSISTENT_EVENTS = EPOLLIN | EPOLLOUT | EPOLLET | EPOLLRDHUP;
+
+/* EPOLLONESHOT 模式下，上一次注册的事件还没触发时再注册同样的事件不改变任何状态，省去这次 epoll_ctl。
+    m_events 在 epoll_ctl 之前更新：调用之后事件可能马上在事件循环线程中触发并被 fired() 清零 */
+void http_conn::arm(int ev) {
+    if (m_persistent) {
+        return;
+    }
+    /* 注册之后事件可能马上被事件循环交给另一个工作线程，在此之前放弃对连接的占有 */
+    m_in_worker.store(false, std::memory_order_release);
+    if (m_events == ev) {
+        METRIC_ADD(M_EPOLL_CTL_SKIPPED, 1);
+        return;
+    }
+    m_events = ev;
+    METRIC_ADD(M_EPOLL_CTL, 1);
+    modfd(m_epollfd, m_sockfd, ev, m_TRIGMode);
+}
+
+/* 常驻注册下工作线程处理期间的事件被事件循环忽略了：清除标志后重新提交一次同样的注册，
+    内核按 socket 当前的状态再通知一次(可写，以及处理期间到达的数据或断开)。
+    清除标志后连接可能马上被事件循环处理甚至关闭，之后只用局部变量 */
+void http_conn::hand_back(int ev) {
+    if (!m_persistent) {
+        arm(ev);
+        return;
+    }
+    int fd = m_sockfd;
+    m_in_worker.store(false, std::memory_order_release);
+    epoll_event event;
+    event.data.fd = fd;
+    event.events = PERSISTENT_EVENTS;
+    METRIC_ADD(M_EPOLL_CTL, 1);
+    epoll_ctl(m_epollfd, EPOLL_CTL_MOD, fd, &event);
+}
+
+http_conn::http_conn() {
+    m_buffers = new buffers;
+    m_read_buf = m_buffers->read_buf;
+    m_write_buf = m_buffers->write_buf;
+    m_iv = m_buffers->iv;
+    m_real_file = m_buffers->real_file;
+    m_headers = m_buffers->headers;
+    m_ranges = m_buffers->ranges;
+    m_arena.attach(m_buffers->arena, ARENA_SIZE);
+    /* init() 会保留读缓冲区中未处理的数据，新对象必须从空缓冲区开始 */
+    m_sockfd = -1;
+    m_read_idx = 0;
+    m_checked_idx = 0;
+    m_file_address = 0;
+    improv = 0;
+    timer_flag = 0;
+    m_in_worker = false;
+    m_events = 0;
+    m_read_ready = false;
+    m_cached.data = nullptr;
+}
+
+http_conn::~http_conn() {
+    delete m_buffers;
+}
 
-/* 函数成员的实现：关闭 HTTP 连接 */
+/* 函数成员的实现：关闭 HTTP 连接。
+    只 shutdown 不 close：fd 和连接对象由事件循环在收到 EPOLLHUP 后经定时器回调统一释放，
+    工作线程在这里 close 的话，fd 号可能马上被新连接复用，回调再 close 一次就关错了连接 */
 void http_conn::close_conn(bool real_close) {
     if (real_close && (m_epollfd != -1)) {
-        removefd(m_epollfd, m_sockfd);
-        m_sockfd = -1;
-        m_user_count--;
+        shutdown(m_sockfd, SHUT_RDWR);
+        m_upload.abort();
     }
 }
 
 /* 初始化客户 HTTP 连接， 并将客户文件描述符加入 epollfd 中监视 */
 /* 传入参数为： 客户的 文件描述符socket， 客户的地址 addr */
 void http_conn::init(int sockfd, const sockaddr_in& addr, char* root, int TRIGMode, 
-                     int close_log, string user, string passwd, string sqlname) {
+                     int close_log, const string& user, const string& passwd, const string& sqlname) {
     m_sockfd = sockfd;
     m_address = addr;
     /* 以下两行是为了避免 TIME_WAIT 状态， 仅适用于调试， 实际使用时应去掉 */
     int reuse = 1;
     setsockopt(m_sockfd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
-    addfd(m_epollfd, sockfd, true, m_TRIGMode);
+    m_TRIGMode = TRIGMode;
+    if (m_persistent) {
+        epoll_event event;
+        event.data.fd = sockfd;
+        event.events = PERSISTENT_EVENTS;
+        epoll_ctl(m_epollfd, EPOLL_CTL_ADD, sockfd, &event);
+    }
+    else {
+        addfd(m_epollfd, sockfd, true, m_TRIGMode);
+    }
+    m_events = EPOLLIN;
+    m_read_ready = false;
+    m_in_worker = false;
+    /* reactor 模式下工作线程在置位 improv 之后还会处理请求、调用 init()，这两个标志只在新连接时清零 */
+    timer_flag = 0;
+    improv = 0;
     m_user_count++;
+    METRIC_ADD(M_ACTIVE_CONNS, 1);
 
     /* 当浏览器出现连接重置时， 可能时网站根目录出错 或http响应格式出错 或文件中的内容完全为空 */
     doc_root = root;
-    m_TRIGMode = TRIGMode;
     m_close_log = close_log;
 
     strcpy(sql_user, user.c_str());
     strcpy(sql_passwd, passwd.c_str());
     strcpy(sql_name, sqlname.c_str());
 
+    m_read_idx = 0;  /* 新连接，不继承上一个使用此槽位的连接的残留数据 */
+    m_checked_idx = 0;
     init();
 }
 
 /* 初始化一些参数 */
+/* 流水线：上一个请求之后已经读入的字节是下一个请求的开头，挪到读缓冲区起始处保留下来 */
 void http_conn::init() {
+    int pending = m_read_idx - m_checked_idx;
+    if (pending > 0) {
+        memmove(m_read_buf, m_read_buf + m_checked_idx, pending);
+    }
+    else {
+        pending = 0;
+    }
     mysql = nullptr;
+    m_arena.reset();
+    m_upload.abort();  /* 上一个连接中途断开留下的临时文件 */
 
     bytes_to_send = 0;
     bytes_have_send = 0;
@@ -146,53 +247,77 @@ void http_conn::init() {
     m_version = 0;
     m_content_length = 0;
     m_host = 0;
+    m_header_count = 0;
+    memset(m_header_index, -1, sizeof(m_header_index));
     m_start_line = 0;
     m_checked_idx = 0;
-    m_read_idx = 0;
+    m_read_idx = pending;
     m_write_idx = 0;
+    m_file_address = 0;
+    m_prefetch_seq = 0;
+    m_rate_charged = false;
+    m_vary = false;
+    m_gzip = false;
+    m_gzip_body.reset();
+    m_accept_gzip = false;
+    m_cacheable = false;
+    release_cached();
+    m_routed = false;
+    m_bundle_entry = nullptr;
+    m_iv_count = 0;
+    m_iv_idx = 0;
+    m_range_count = 0;
     cgi = 0;
+    m_form_body.clear();
+    m_string = (char*)m_form_body.c_str();
     m_state = 0;
-    timer_flag = 0;
-    improv = 0;
-    memset(m_read_buf, '\0', READ_BUFFER_SIZE);
+    memset(m_read_buf + pending, '\0', READ_BUFFER_SIZE - pending);
     memset(m_write_buf, '\0', WRITE_BUFFER_SIZE);
-    memset(m_read_buf, '\0', FILENAME_LEN);
+    memset(m_real_file, '\0', FILENAME_LEN);
 }
 
 /* 从状态机：用于分析出一行数据，并不是取出数据 */
 http_conn::LINE_STATUS http_conn::parse_line() {  /* "报文格式中的每一行(32个字节) " */
-    char temp;
-    for(; m_checked_idx < m_read_idx; m_checked_idx++) {
-        temp = m_read_buf[m_checked_idx];
-        if (temp == '\r') {
-            /* \r 后面至少还有一个 \n, 所以接下来到达了 buffer 末尾表示 buffer 还需要继续接受， 返回 LINE_OPEN */
-            if ((m_checked_idx + 1) == m_read_idx) {  /* 本次读操作没有读入HTTP请求的完整头部，等待继续读入 */
-                return LINE_OPEN;
-            }
-            /* 接下来的字符是\n, 将 \r\n 修改为 \0\0， 将m_checked_idx指向下一行的开头， 返回LINE_OPEN */
-            else if (m_read_buf[m_checked_idx + 1] == '\n') {
-                m_read_buf[m_checked_idx++] = '\0';
-                m_read_buf[m_checked_idx++] = '\0';
-                return LINE_OK;
-            }
-            return LINE_BAD;
+    /* 向量化扫描一次跳到下一个 \r、\n 或非法字符，不再逐字节判断 */
+    m_checked_idx += http_scan_line(m_read_buf + m_checked_idx, m_read_idx - m_checked_idx);
+    if (m_checked_idx >= m_read_idx) {
+        /* 没有找到行尾，说明接收不完整，需要继续接收。则返回 LINE_OPEN */
+        return LINE_OPEN;
+    }
+    char temp = m_read_buf[m_checked_idx];
+    if (temp == '\r') {
+        /* \r 后面至少还有一个 \n, 所以接下来到达了 buffer 末尾表示 buffer 还需要继续接受， 返回 LINE_OPEN */
+        if ((m_checked_idx + 1) == m_read_idx) {  /* 本次读操作没有读入HTTP请求的完整头部，等待继续读入 */
+            return LINE_OPEN;
         }
-        else if (temp == '\n') {
-            if ((m_checked_idx > 1) && (m_read_buf[m_checked_idx - 1] == '\r')) {
-                m_read_buf[m_checked_idx - 1] = '\0';
-                m_read_buf[m_checked_idx++] = '\0';
-                return LINE_OK;
-            }
-            return LINE_BAD;
+        /* 接下来的字符是\n, 将 \r\n 修改为 \0\0， 将m_checked_idx指向下一行的开头， 返回LINE_OPEN */
+        else if (m_read_buf[m_checked_idx + 1] == '\n') {
+            m_read_buf[m_checked_idx++] = '\0';
+            m_read_buf[m_checked_idx++] = '\0';
+            return LINE_OK;
         }
+        return LINE_BAD;
     }
-    /* 当前字符既不是 \r,也不是 \n，说明接收不完整，需要继续接收。则返回 LINE_OPEN */
-    return LINE_OPEN;
+    else if (temp == '\n') {
+        if ((m_checked_idx > 1) && (m_read_buf[m_checked_idx - 1] == '\r')) {
+            m_read_buf[m_checked_idx - 1] = '\0';
+            m_read_buf[m_checked_idx++] = '\0';
+            return LINE_OK;
+        }
+        return LINE_BAD;
+    }
+    /* 行内出现控制字符等非法字符 */
+    return LINE_BAD;
 }
 
 /* 循环读取客户数据，直到无数据可读或者对方关闭连接 */
 /* 非阻塞 ET 工作模式下， 需要一次性将数据读完 */
 bool http_conn::read() {
+    /* 上传的消息体由工作线程直接从 socket 搬到文件，这里不读 */
+    if (m_upload.splicing()) {
+        m_read_ready = false;  /* 工作线程会读到 EAGAIN，之后的数据由 hand_back 重新通知 */
+        return true;
+    }
     if (m_read_idx >= READ_BUFFER_SIZE) {
         return false;
     }
@@ -201,20 +326,21 @@ bool http_conn::read() {
     /* LT 模式读取 */
     if(m_TRIGMode == 0) {
         bytes_read = recv(m_sockfd, m_read_buf + m_read_idx, READ_BUFFER_SIZE - m_read_idx, 0);  /* 本次调用读取的字节数 */
-        m_read_idx += bytes_read;  /* 更新读取标识位 */
         if (bytes_read <= 0) {
             return false;
         }
+        m_read_idx += bytes_read;  /* 更新读取标识位 */
         return true;  /* LT 模式不保证一次性读完 */
     }
     /* LT 模式读取 */
     else {
-        while (true) {  /* 循环读取，保证一次性读完 */
+        while (m_read_idx < READ_BUFFER_SIZE) {  /* 循环读取，直到读完或读缓冲区满(消息体消费后再读，EPOLL_CTL_MOD 重新注册时会再次通知) */
             /* 从套接字缓冲区接收数据，存储在 m_read_buf 缓冲区 */
             bytes_read = recv(m_sockfd, m_read_buf + m_read_idx, READ_BUFFER_SIZE - m_read_idx, 0);
             if (bytes_read == - 1) {
                 /* 非阻塞 ET 模式下，需要一次性将数据读完 */
                 if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                    m_read_ready = false;
                     break;  /* 打断，回到循环，不进入return */
                 }
                 return false;
@@ -230,37 +356,50 @@ bool http_conn::read() {
     }
 }
 
+/* 跳过空格和 \t */
+static int skip_blank(const char* text, int pos) {
+    while (text[pos] == ' ' || text[pos] == '\t') {
+        pos++;
+    }
+    return pos;
+}
+
 /* 解析 HTTP 请求行， 获得请求方法、目标、URL，以及 HTTP 版本号*/
 http_conn::HTTP_CODE http_conn::parse_request_line(char* text) {
-    /* strpbrk实在源字符串s1中找出最先含有搜索字符串s2中任意字符的位置并返回，若找不到返回 空指针 */
-    m_url = strpbrk(text, " \t");  /* 请求行中最先含有 空格(请注意：这里是有个空格的) 和 \t 任一字符的位置并返回 */
-    if(! m_url) {  /* 空指针 */
+    /* 整行已由 parse_line 以 \0 结尾，行尾的 \0 也会被词元扫描命中，所以每个词元只扫描一遍 */
+    int len = m_read_buf + m_checked_idx - text;
+    int pos = http_scan_token(text, len);  /* 方法 */
+    if (text[pos] != ' ' && text[pos] != '\t') {
         return BAD_REQUEST;
     }
-    *m_url++ = '\0';  /* 先解引用后++，即先把当前位置变为\0'， 再将变量m_url指向下一位置 */
     /* 取出数据，判断是 GET 或是 POST, 以确定本次Http请求的类型 */
-    char* method = text;
-    if (strcasecmp(method, "GET") == 0) {
+    if (pos == 3 && strncasecmp(text, "GET", 3) == 0) {
         m_method = GET;
     }
-    else if (strcasecmp(method, "POST") == 0){
+    else if (pos == 4 && strncasecmp(text, "POST", 4) == 0) {
         m_method = POST;
         cgi = 1;  /* common gateway interface: 客户端向服务器端发送数据 */
     }
+    else if (pos == 3 && strncasecmp(text, "PUT", 3) == 0) {
+        m_method = PUT;
+    }
     else {
         return BAD_REQUEST;
     }
+    text[pos] = '\0';
 
-    /* strspn 检测字符串 str1 中第一个不在字符串 str2 中出现的字符下标 */
-    m_url += strspn(m_url, " \t");  /* 如 GET 和 URL 之间还有空格， 则跳过这些空格找到第一个出现的字符 */
-    m_version = strpbrk(m_url, " \t");  /* 如上面得到的 GET同理 判断*/
-    if (! m_version) {
+    pos = skip_blank(text, pos + 1);  /* 如 GET 和 URL 之间还有空格， 则跳过这些空格找到第一个出现的字符 */
+    m_url = text + pos;
+    int url_len = http_scan_token(m_url, len - pos);
+    if (m_url[url_len] != ' ' && m_url[url_len] != '\t') {
         return BAD_REQUEST;
     }
-    *m_version++ = '\0';
-    m_version += strspn(m_version, " \t");  /* 此时正常情况下：m_url 指向 url，m_version 指向 HTTP/1.1 */
-    /* 比较 m_version 是否为 HTTP/1.1 */
-    if (strcasecmp(m_version, "HTTP/1.1") != 0) {
+    m_url[url_len] = '\0';
+
+    pos = skip_blank(text, pos + url_len + 1);  /* 此时正常情况下：m_url 指向 url，m_version 指向 HTTP/1.1 */
+    m_version = text + pos;
+    /* 比较 m_version 是否为 HTTP/1.1，其后必须就是行尾 */
+    if (http_scan_token(m_version, len - pos) != 8 || m_version[8] != '\0' || strncasecmp(m_version, "HTTP/1.1", 8) != 0) {
         return BAD_REQUEST;
     }
 
@@ -271,7 +410,7 @@ http_conn::HTTP_CODE http_conn::parse_request_line(char* text) {
         m_url = strchr(m_url, '/');
     }
     /* 同样增加 https 的情况 */
-    if (strncasecmp(m_url, "http:s//", 8) == 0) {
+    if (m_url && strncasecmp(m_url, "https://", 8) == 0) {
         m_url += 8;
         m_url = strchr(m_url, '/');
     }
@@ -303,50 +442,209 @@ http_conn::HTTP_CODE http_conn::parse_request_line(char* text) {
 */
 
 
+/* 解析十进制的 Content-Length，只允许数字，溢出返回 -1 */
+static long long parse_content_length(const char* value, int len) {
+    if (len == 0 || len > 18) {
+        return -1;
+    }
+    long long n = 0;
+    for (int i = 0; i < len; i++) {
+        if (value[i] < '0' || value[i] > '9') {
+            return -1;
+        }
+        n = n * 10 + (value[i] - '0');
+    }
+    return n;
+}
+
 /* 解析 HTTP 请求的 “一个” 头部信息 */
-http_conn::HTTP_CODE http_conn::parse_headers(char* text) {  /* 专门处理cg请求 ? */
+http_conn::HTTP_CODE http_conn::parse_headers(char* text) {
     /* 遇到空行，表示头部字段解析完毕 */
     if (text[0] == '\0') {  /* 从状态机parse_line读取一行数据时，已将 \r\n 都修改为 \0 */
-        /* 如果 HTTP 请求有消息，则还需要读取 m_content_length 字节的消息体， 主状态机转移到 CHECK_STATE_CONTENT */
-        if (m_content_length != 0) {
-            m_check_state = CHECK_STATE_CONTENT;
-            return NO_REQUEST;
-        }
+        /* 如果 HTTP 请求有消息体，则还需要读取消息体， 主状态机转移到 CHECK_STATE_CONTENT */
         /* 否则说明我们已经得到一个完整的 HTTP 请求 */
-        return GET_REQUEST;  /* 虽然是空行，但是成员属性m_content_length不为0，这便出现了矛盾 */
+        return start_body();
+    }
+
+    /* 只记录名称和值在读缓冲区中的位置：name ":" OWS value OWS，行尾的 \r\n 已被置为 \0\0 */
+    int line_len = m_checked_idx - 2 - (text - m_read_buf);
+    char* colon = (char*)memchr(text, ':', line_len);
+    if (!colon || m_header_count == MAX_HEADERS) {
+        return BAD_REQUEST;
+    }
+    int name_len = colon - text;
+    /* 名称为空、名称中(包括冒号前)有空白、或以空白开头的折行，都是 400 */
+    if (name_len == 0 || http_scan_token(text, name_len) != name_len) {
+        return BAD_REQUEST;
+    }
+    char* value = colon + 1;
+    char* end = text + line_len;
+    while (value < end && (*value == ' ' || *value == '\t')) {
+        value++;
+    }
+    while (end > value && (end[-1] == ' ' || end[-1] == '\t')) {
+        end--;
     }
+    *end = '\0';
+
+    http_header_view& h = m_headers[m_header_count];
+    h.name_off = text - m_read_buf;
+    h.name_len = name_len;
+    h.value_off = value - m_read_buf;
+    h.value_len = end - value;
+    h.id = http_header_lookup(text, name_len);
+    if (h.id != HDR_OTHER && m_header_index[h.id] < 0) {
+        m_header_index[h.id] = m_header_count;
+    }
+    m_header_count++;
 
+    switch (h.id) {
     /* 解析头部连接字段 Connection */
-    else if (strncasecmp(text, "Connection:", 11) == 0) {  /* strcasecmp()判断是否相等 */
-        text += 11;
-        text += strspn(text, " \t");
-        if (strcasecmp(text, "Keep-Alive") == 0) {
+    case HDR_CONNECTION:
+        if (strcasecmp(value, "Keep-Alive") == 0) {
             m_linger = true;
         }
+        break;
+    /* 解析请求体内容长度字段 Content-Length，多个取值不一致时拒绝 */
+    case HDR_CONTENT_LENGTH: {
+        long long n = parse_content_length(value, h.value_len);
+        if (n < 0 || (m_header_index[HDR_CONTENT_LENGTH] != m_header_count - 1 && n != m_content_length)) {
+            return BAD_REQUEST;
+        }
+        m_content_length = n;
+        break;
+    }
+    case HDR_HOST:
+        m_host = value;
+        break;
+    default:
+        break;
     }
+    return NO_REQUEST;
+}
+
 
-    /* 解析 请求体内容长度    字段：Content-Length */
-    else if (strncasecmp(text, "Host:", 15) == 0) {
-        text += 15;
-        text += strspn(text, " \t");
-        m_host = text;
+/* Transfer-Encoding 只支持 chunked 一种编码 */
+static bool is_chunked(const char* value) {
+    return strcasecmp(value, "chunked") == 0;
+}
+
+/* 登录(2)和注册(3)的表单地址 */
+static bool is_form_url(const char* url) {
+    const char* p = strrchr(url, '/');
+    return p && (p[1] == '2' || p[1] == '3');
+}
+
+/* 上传地址 /upload/<name>：返回 name，不是上传地址或 name 不合法返回 NULL。
+   name 只允许字母、数字和 ._-，不能以 . 开头，因此不会跳出上传目录，也不会与临时文件重名 */
+static const char* upload_name(const char* url) {
+    static const int UPLOAD_NAME_MAX = 128;
+    if (strncmp(url, "/upload/", 8) != 0) {
+        return nullptr;
+    }
+    const char* name = url + 8;
+    int len = 0;
+    for (const char* p = name; *p; p++, len++) {
+        char c = *p;
+        if (!((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') ||
+              c == '.' || c == '_' || c == '-')) {
+            return nullptr;
+        }
+    }
+    if (len == 0 || len > UPLOAD_NAME_MAX || name[0] == '.') {
+        return nullptr;
+    }
+    return name;
+}
+
+/* 请求头结束：按 RFC 7230 3.3.3 确定消息体的边界，选择消息体的处理者 */
+http_conn::HTTP_CODE http_conn::start_body() {
+    const char* te = get_header(HDR_TRANSFER_ENCODING);
+    body_handler* handler = &m_body_discarder;
+    const char* name = upload_name(m_url);
+    if ((m_method == PUT || m_method == POST) && name && !m_upload_dir.empty()) {
+        if (!m_upload.open(m_upload_dir.c_str(), name)) {
+            LOG_ERROR("upload: cannot create file for %s in %s", name, m_upload_dir.c_str());
+            m_linger = false;  /* 消息体不再读取 */
+            return INTERNAL_ERRNO;
+        }
+        handler = &m_upload;
+    }
+    if (!te && m_content_length == 0) {
+        return GET_REQUEST;
+    }
+    if (m_method == POST && handler == &m_body_discarder && is_form_url(m_url)) {
+        m_form_collector.init(&m_form_body, FORM_BODY_LIMIT);
+        handler = &m_form_collector;
+    }
+    if (te) {
+        /* 同时带 Content-Length 是请求走私的典型手法，直接拒绝 */
+        if (m_header_index[HDR_CONTENT_LENGTH] >= 0 || !is_chunked(te)) {
+            return BAD_REQUEST;
+        }
+        m_body_reader.init_chunked(handler);
     }
     else {
-        LOG_INFO("oppp! unknow headers %s", text);
+        if (handler == &m_form_collector && m_content_length > FORM_BODY_LIMIT) {
+            return PAYLOAD_TOO_LARGE;
+        }
+        m_body_reader.init_length(m_content_length, handler);
     }
+    /* 客户端在等 100 Continue 才发送消息体(如 curl 上传) */
+    const char* expect = get_header(HDR_EXPECT);
+    if (expect && strcasecmp(expect, "100-continue") == 0 && m_read_idx == m_checked_idx) {
+        static const char CONTINUE[] = "HTTP/1.1 100 Continue\r\n\r\n";
+        send(m_sockfd, CONTINUE, sizeof(CONTINUE) - 1, MSG_NOSIGNAL);
+    }
+    m_check_state = CHECK_STATE_CONTENT;
     return NO_REQUEST;
 }
 
+/* 把读缓冲区中已收到的消息体交给 body_reader，判断消息体是否已经读完 */
+http_conn::HTTP_CODE http_conn::parse_content() {
+    if (m_upload.splicing()) {
+        return pump_upload();
+    }
+    int n = m_body_reader.feed(m_read_buf + m_checked_idx, m_read_idx - m_checked_idx);
+    if (n == BODY_ERROR) {
+        return BAD_REQUEST;
+    }
+    if (n == BODY_REJECTED) {
+        return PAYLOAD_TOO_LARGE;
+    }
+    /* 已交给处理者的字节不再需要：把其后的字节(流水线的下一个请求)挪到消息体起点，
+       之后的 recv 继续写在这里，读缓冲区的占用不随消息体长度增长 */
+    int rest = m_read_idx - m_checked_idx - n;
+    memmove(m_read_buf + m_start_line, m_read_buf + m_checked_idx + n, rest);
+    m_checked_idx = m_start_line;
+    m_read_idx = m_start_line + rest;
+    if (!m_body_reader.done()) {
+        /* 定长的上传：读缓冲区中的部分已写入文件，其余不再经过读缓冲区，直接从 socket 搬到文件；
+           chunked 的上传需要解码，仍经读缓冲区写入 */
+        if (m_upload.active() && !get_header(HDR_TRANSFER_ENCODING)) {
+            m_upload.start_splice(m_content_length - m_body_reader.received());
+            return pump_upload();
+        }
+        return NO_REQUEST;  /* 消息体未收全，等待继续读入 */
+    }
+    /* POST 请求中最后为输入的 用户名 和 密码 */
+    m_string = (char*)m_form_body.c_str();
+    return GET_REQUEST;
+}
 
-/* 判断 http 请求是否被完整的读入了， 将请求体内容存入 m_string */
-http_conn::HTTP_CODE http_conn::parse_content(char* text) {
-    if (m_read_idx >= (m_content_length + m_checked_idx)) {
-        text[m_content_length] = '\0';
-        /* POST 请求中最后为输入的 用户名 和 密码 */
-        m_string  = text;
+/* 把 socket 中已到达的上传数据搬到文件 */
+http_conn::HTTP_CODE http_conn::pump_upload() {
+    switch (m_upload.pump(m_sockfd)) {
+    case UPLOAD_DONE:
         return GET_REQUEST;
+    case UPLOAD_AGAIN:
+        return NO_REQUEST;  /* 等待下一次可读，process 会重新注册 EPOLLIN */
+    default:
+        LOG_ERROR("upload: receive failed after %lld bytes", m_upload.written());
+        m_upload.abort();
+        m_linger = false;
+        return INTERNAL_ERRNO;
     }
-    return NO_REQUEST;
 }
 
 /*
@@ -369,7 +667,11 @@ http_conn::HTTP_CODE http_conn::process_read() {
     HTTP_CODE ret = NO_REQUEST;
     char* text = 0;
     /* 从 read_buf 中取出一行一行数据 */
-    while (((line_status = parse_line()) == LINE_OK) || ((m_check_state == CHECK_STATE_CONTENT) && (line_status == LINE_OK))) {
+    /* 消息体不按行解析：进入 CHECK_STATE_CONTENT 后不再调用 parse_line */
+    while ((m_check_state == CHECK_STATE_CONTENT) || ((line_status = parse_line()) == LINE_OK)) {
+        if (m_check_state == CHECK_STATE_CONTENT) {
+            return parse_content();
+        }
         text = get_line();  /* char* 类型， return： m_read_buf + m_read_line */
         m_start_line = m_checked_idx;
         LOG_INFO("got a http line: %s", text);
@@ -385,92 +687,97 @@ http_conn::HTTP_CODE http_conn::process_read() {
         }
         case CHECK_STATE_HEADER:{
             ret = parse_headers(text);
-            if (ret == BAD_REQUEST) {
-                return BAD_REQUEST;
-            }
-            else if (ret == GET_REQUEST) {
-                return do_requset();
+            if (ret != NO_REQUEST) {
+                return ret;  /* 完整请求由 process 调用 do_requset；或 400/413 */
             }
             break;
         }
-        case CHECK_STATE_CONTENT:{
-            ret = parse_content(text);
-            if (ret == GET_REQUEST) {
-                return do_requset();
-
-            }
-            line_status = LINE_OPEN;
-            break;
-        }             
         default:
             return INTERNAL_ERRNO;
         }
     }
+    if (line_status == LINE_BAD) {
+        return BAD_REQUEST;  /* 行尾格式错误或含非法字符 */
+    }
+    return NO_REQUEST;
 }
 /* 从状态机 判断行的获取-3：已读、未完、错误 */
 
 
+/* Accept-Encoding 是否接受 gzip：逐项比较编码名(gzip、x-gzip 或 *)，q=0 表示不接受 */
+static bool accepts_gzip(const char* value) {
+    const char* p = value;
+    while (*p) {
+        while (*p == ' ' || *p == '\t' || *p == ',') {
+            p++;
+        }
+        const char* name = p;
+        while (*p && *p != ',' && *p != ';' && *p != ' ' && *p != '\t') {
+            p++;
+        }
+        int len = p - name;
+        bool match = (len == 4 && strncasecmp(name, "gzip", 4) == 0) || (len == 6 && strncasecmp(name, "x-gzip", 6) == 0) ||
+                     (len == 1 && name[0] == '*');
+        double q = 1;
+        while (*p && *p != ',') {
+            if (*p == ';') {
+                const char* param = p + 1;
+                while (*param == ' ' || *param == '\t') {
+                    param++;
+                }
+                if ((param[0] == 'q' || param[0] == 'Q') && param[1] == '=') {
+                    q = atof(param + 2);
+                }
+            }
+            p++;
+        }
+        if (match) {
+            return q > 0;
+        }
+    }
+    return false;
+}
+
 /* 当得到一个完整、正确的 HTTP 请求时， 我们接分析目标文件的属性 */
-/* 如果目标文件存在，且队所有用户可读， 且不是目录， 就是用 mmap 将其映射到 内存地址 */
 http_conn::HTTP_CODE http_conn::do_requset() {
+    HTTP_CODE ret = m_routed ? GET_REQUEST : route_request();
+    if (ret != GET_REQUEST) {
+        return ret;
+    }
+    return serve_file();
+}
+
+/* 路由：上传、/metrics、URL 到文件路径的映射和响应缓存查找；需要访问文件时返回 GET_REQUEST。
+   GET 请求在这里不做文件 I/O，也不访问数据库，事件循环线程的快速路径可以直接调用 */
+http_conn::HTTP_CODE http_conn::route_request() {
+    /* 上传：消息体已完整写入临时文件，改名为正式文件 */
+    if (m_upload.active()) {
+        if (!m_upload.commit()) {
+            return INTERNAL_ERRNO;
+        }
+        return UPLOAD_COMPLETE;
+    }
+    /* 上传未开启、地址或文件名不合法 */
+    if (m_method == PUT || (m_method == POST && strncmp(m_url, "/upload/", 8) == 0)) {
+        return FORBIDDEN_REQUEST;
+    }
+    /* 保留路径：运行指标，直接从内存渲染 */
+    if (strcmp(m_url, "/metrics") == 0) {
+        Metrics::get_instance()->render(m_metrics_body);
+        return METRICS_REQUEST;
+    }
+
     strcpy(m_real_file, doc_root);  /* 将 mreal_file 赋值为网站根目录 /* strcpy(*dest,*sour):  */
     int len = strlen(doc_root);
     const char* p = strrchr(m_url, '/');  /* 末次位置 */
     /* 同步检验 (处理cgi）*/
-    if (cgi == 1 && (*(p + 1)) == '2' || (*(p + 1)) == '3') {  /* 配合前端代码完成页面跳跃 */
-        /* 根据标志判断是登录检测还是注册检测 */
-        char* m_url_real = (char*)malloc(sizeof(char) * 200);
-
-        /* 将 用户名 和 密码提取出来 */
-        char name[100], passwd[100];
-        int i;
-
-        /* 以 & 为分隔符， 其前部分为用户名 */
-        for (i = 5; m_string[i] != '&'; i++) {
-            name[i - 5] = m_string[i];
-        }
-        name[i - 5] = '\5';
-        /* & 后面是密码 */
-        int j = 0;
-        for (i = i + 10; m_string[i] != '\0'; i++, j++) {
-            passwd[j] = m_string[i];
-        }
-        passwd[j] = '\0';
-
-        if (*(p + 1) == '3') {
-            /* 注册校验，先检测数据库中是否有重名的 */
-            char* sql_insert = (char*) malloc (sizeof(char) * 200);
-            strcpy(sql_insert, "INSERT INTO user(username, passwd) VALUES");
-            strcat(sql_insert, "'");
-            strcat(sql_insert, name);
-            strcat(sql_insert, "', ");
-            strcat(sql_insert, passwd);
-            strcat(sql_insert, "');");
-            /* 如果没有重名的， 进行增加数据 */
-            if (users.find(name) == users.end()) {  /*users是map类型*/  /*没找到，则新注册*/
-                /* 向数据库插入数据时， 需要使用锁来同步数据 */
-                m_lock.lock();
-                int res = mysql_query(mysql, sql_insert);
-                users.insert(pair<string, string>(name, passwd));
-                m_lock.unlock();
-                strcpy(m_url_real, "/log.html");  /* 然后跳转到登录界面 */
-                strncpy(m_real_file + len, m_url_real, strlen(m_url_real));
-            }
-            else {
-                strcpy(m_url_real, "/registerError.html");  /* 有重名的，则注册失效 */
-                strncpy(m_real_file + len, m_url_real, strlen(m_url_real));
-            }
-        }
-        else if (*(p + 1) == '2') {  /* 登录，直接判断用户存在和对应密码正确 */
-            /* 如果是登录， 直接判断 */
-            if ((users.find(name) != users.end()) && (users[name] == passwd)) {
-                strcpy(m_url_real, "/welcome.html");
-                strncpy(m_real_file + len, m_url_real, strlen(m_url_real));
-            }
-            else {
-                strcpy(m_url_real, "/logError.html");
-                strncpy(m_real_file + len, m_url_real, strlen(m_url_real));
-            }
+    const char* page = nullptr;  /* 按 URL 首字符跳转的页面 */
+    if (cgi == 1 && ((*(p + 1)) == '2' || (*(p + 1)) == '3')) {  /* 配合前端代码完成页面跳跃 */
+        const char* name = nullptr;
+        const char* passwd = nullptr;
+        page = check_form(*(p + 1), &name, &passwd);
+        if (!page) {
+            page = finish_register(name, insert_user(mysql, name, passwd));
         }
     }
     /* 页面跳转
@@ -478,51 +785,151 @@ http_conn::HTTP_CODE http_conn::do_requset() {
     */
     // 注册页面
     else if (*(p + 1) == '0') {
-        char* m_url_real = (char*)malloc(sizeof(char) * 200);
-        strcpy(m_url_real, "/registor.html");
-        strncpy(m_real_file + len, m_url_real, strlen(m_url_real));
-        free(m_url_real);
+        page = "/registor.html";
     }
     // 登录页面
     else if (*(p + 1) == '1') {
-        char* m_url_real = (char*)malloc(sizeof(char) * 200);
-        strcpy(m_url_real, "/log.html");
-        strncpy(m_real_file + len, m_url_real, sizeof(m_url_real));
-        free(m_url_real);
+        page = "/log.html";
     }
     // 图片页面
     else if (*(p + 1) == '5') {
-        char* m_url_real = (char*)malloc(sizeof(char) * 200);
-        strcpy(m_url_real, "/picture.html");
-        strncpy(m_real_file + len, m_url_real, strlen(m_url_real));
-        free(m_url_real);
+        page = "/picture.html";
     }
     // 视频界面 
     else if (*(p + 1) == '6') {
-        char* m_url_real = (char*)malloc(sizeof(char) * 200);
-        strcpy(m_real_file, "/video.html");
-        strncpy(m_real_file + len, m_url_real, strlen(m_url_real));
-        free(m_url_real);
+        page = "/video.html";
     }
     /* 粉丝界面 */
     else if(*(p + 1) == '7') {
-        char* m_url_real = (char*)malloc(sizeof(char) * 200);
-        strcpy(m_url_real, "/fans.html");
-        strncpy(m_real_file + len, m_url_real, strlen(m_url_real));
-        free(m_url_real);
+        page = "/fans.html";
     }
     /* 判断界面(首页：登录或是注册)*/
     else if(*(p + 1) == '8') {
-        char* m_url_real = (char*)malloc(sizeof(char) * 200);
-        strcpy(m_url_real, "/judge.html");
-        strncpy(m_real_file + len, m_url_real, strlen(m_url_real));
-        free(m_url_real);
+        page = "/judge.html";
+    }
+    /* 将 url(或跳转的页面) 添加到 m_real_file 后， 此时 m_real_file 为客户请求文件的绝对路径 */
+    strncpy(m_real_file + len, page ? page : m_url, FILENAME_LEN - len - 1);
+    /* 无条件的整文件 GET 先查资源包和响应缓存，命中则不再 stat/open/mmap；
+       条件请求和 Range 请求走文件系统，资源包与文件系统给出的校验器相同 */
+    const char* ae = get_header(HDR_ACCEPT_ENCODING);
+    m_accept_gzip = ae && gzip_cache::get_instance()->enabled() && accepts_gzip(ae);
+    bool whole = m_method == GET && !get_header(HDR_RANGE) && !get_header(HDR_IF_NONE_MATCH) && !get_header(HDR_IF_MODIFIED_SINCE);
+    static_bundle* bundle = static_bundle::get_instance();
+    if (whole && bundle->loaded()) {
+        m_bundle_entry = bundle->find(m_real_file + len, strlen(m_real_file + len));
+        if (m_bundle_entry) {
+            return BUNDLE_RESPONSE;
+        }
+    }
+    response_cache* rcache = response_cache::get_instance();
+    m_cacheable = whole && rcache->enabled();
+    if (m_cacheable) {
+        if (rcache->get(m_real_file, m_accept_gzip, &m_cached)) {
+            return CACHED_RESPONSE;
+        }
     }
+    return GET_REQUEST;
+}
 
-    else {
-        /* 将 url 添加到 m_real_file 后， 此时 m_real_file 为客户请求文件的绝对路径 */
-        strncpy(m_real_file + len, m_url, FILENAME_LEN - len - 1);
+/* 登录(kind 为 '2')、注册('3')表单，返回跳转的页面。
+    注册新用户时先在 users 中登记(之后同名注册即失败)，返回 nullptr，*name 和 *passwd 为请求级的副本，
+    由调用者以 insert_user 写入数据库 */
+const char* http_conn::check_form(char kind, const char** name_out, const char** passwd_out) {
+    /* 将 用户名 和 密码提取出来 */
+    char name[100], passwd[100];
+    int i;
+
+    /* 消息体为 user=xxx&password=yyy，以 & 为分隔符， 其前部分为用户名；两者都截断到缓冲区长度 */
+    int j = 0;
+    for (i = 5; i < (int)m_form_body.size() && m_string[i] != '&' && j < 99; i++, j++) {
+        name[j] = m_string[i];
+    }
+    name[j] = '\0';
+    /* & 后面是密码 */
+    j = 0;
+    for (i = i + 10; i < (int)m_form_body.size() && j < 99; i++, j++) {
+        passwd[j] = m_string[i];
+    }
+    passwd[j] = '\0';
+
+    if (kind == '3') {
+        /* 注册校验，先检测是否有重名的；users 被多个线程访问，需要使用锁来同步 */
+        m_lock.lock();
+        bool added = users.insert(pair<string, string>(name, passwd)).second;
+        m_lock.unlock();
+        if (!added) {
+            return "/registerError.html";  /* 有重名的，则注册失效 */
+        }
+        *name_out = m_arena.strdup(name, strlen(name));
+        *passwd_out = m_arena.strdup(passwd, strlen(passwd));
+        return nullptr;
+    }
+    /* 登录，直接判断用户存在和对应密码正确 */
+    m_lock.lock();
+    map<string, string>::iterator it = users.find(name);
+    bool ok = it != users.end() && it->second == passwd;
+    m_lock.unlock();
+    return ok ? "/welcome.html" : "/logError.html";
+}
+
+/* 新用户写入数据库，返回 mysql_query 的结果。用户名和密码来自表单，以 mysql_real_escape_string 转义后才拼进语句 */
+int http_conn::insert_user(MYSQL* mysql, const char* name, const char* passwd) {
+    if (!mysql) {
+        return -1;
+    }
+    size_t name_len = strlen(name);
+    size_t passwd_len = strlen(passwd);
+    char* name_sql = (char*)m_arena.alloc(name_len * 2 + 1, 1);
+    char* passwd_sql = (char*)m_arena.alloc(passwd_len * 2 + 1, 1);
+    mysql_real_escape_string(mysql, name_sql, name, name_len);
+    mysql_real_escape_string(mysql, passwd_sql, passwd, passwd_len);
+    const char* sql_insert = m_arena.printf("INSERT INTO user(username, passwd) VALUES('%s', '%s')", name_sql, passwd_sql);
+    return mysql_query(mysql, sql_insert);
+}
+
+/* insert_user 的结果 res 决定注册的跳转页面：写入失败时撤销 check_form 在 users 中的登记，
+    否则内存中有而数据库中没有，重启后这个用户就消失了，期间同名注册也都会失败 */
+const char* http_conn::finish_register(const char* name, int res) {
+    if (res == 0) {
+        return "/log.html";  /* 然后跳转到登录界面 */
+    }
+    m_lock.lock();
+    users.erase(name);
+    m_lock.unlock();
+    return "/registerError.html";
+}
+
+/* 表单请求的协程版本：proactor 模式下由事件循环启动，连接在此期间与交给工作线程时一样由它独占。
+    写数据库和打开跳转页面的文件在阻塞调用线程中进行，等待时协程挂起，不占用工作线程也不阻塞事件循环 */
+task<> http_conn::serve_form() {
+    uint64_t start = Metrics::now_ns();
+    const char* p = strrchr(m_url, '/');
+    if (*(p + 1) == '2' || *(p + 1) == '3') {
+        const char* name = nullptr;
+        const char* passwd = nullptr;
+        const char* page = check_form(*(p + 1), &name, &passwd);
+        if (!page) {
+            int res = co_await db_query([this, name, passwd](MYSQL* mysql) { return insert_user(mysql, name, passwd); });
+            page = finish_register(name, res);
+        }
+        /* 表单已处理，之后按跳转的页面路由 */
+        m_url = m_arena.printf("%s", page);
+        cgi = 0;
+    }
+    HTTP_CODE ret = route_request();
+    if (ret == GET_REQUEST) {
+        co_await blocking_call([this, &ret] { ret = serve_file(); });
     }
+    bool write_ret = process_write(ret);
+    METRIC_OBSERVE(H_PROCESS, Metrics::now_ns() - start);
+    if (!write_ret) {
+        close_conn();
+    }
+    hand_back(EPOLLOUT);
+}
+
+/* 如果目标文件存在，且队所有用户可读， 且不是目录， 就是用 mmap 将其映射到 内存地址 */
+http_conn::HTTP_CODE http_conn::serve_file() {
     /* stat 函数用来获取文件信息 */
     /* 第一个参数为 文件路径 ， 第二个参数为 stat 类型的结构体 ， 执行成功保存文件的相关属性 */
     /* 执行成功返回0， 执行失败返回 -1 */
@@ -537,6 +944,36 @@ http_conn::HTTP_CODE http_conn::do_requset() {
     if (S_ISDIR(m_file_stat.st_mode)) {
         return BAD_REQUEST;
     }
+    /* 内容协商：可压缩的文本文件按 Accept-Encoding 选择 gzip 版本，两个版本的 ETag 不同；
+       Range 请求始终针对未压缩的版本 */
+    if (m_method == GET && gzip_cache::get_instance()->enabled() && gzip_cache::compressible(m_real_file, m_file_stat.st_size)) {
+        m_vary = true;
+        m_gzip = m_accept_gzip && !get_header(HDR_RANGE);
+    }
+    /* 条件请求命中时直接返回 304，不打开也不映射文件 */
+    if (m_method == GET && not_modified()) {
+        return NOT_MODIFIED;
+    }
+    /* 压缩版本从缓存取，不映射文件；取不到(压缩后没有变小或正在被其他线程压缩)时发送原文件 */
+    if (m_gzip) {
+        m_gzip_body = gzip_cache::get_instance()->get(m_real_file, m_file_stat);
+        if (m_gzip_body) {
+            return FILE_REQUEST;
+        }
+        m_gzip = false;
+    }
+    /* Range 请求：区间全部不可满足时返回 416，同样不需要打开文件 */
+    HTTP_CODE file_ret = FILE_REQUEST;
+    if (m_method == GET) {
+        file_ret = parse_range();
+        if (file_ret == RANGE_NOT_SATISFIABLE) {
+            return file_ret;
+        }
+    }
+    /* 空文件不能映射 */
+    if (m_file_stat.st_size == 0) {
+        return file_ret;
+    }
     int fd = open(m_real_file, O_RDONLY);
     /* .https://blog.csdn.net/bhniunan/article/details/104105153 */
     /* void *mmap(void *addr, size_t len, int prot, int flags, int fd, off_t offset); */
@@ -544,7 +981,187 @@ http_conn::HTTP_CODE http_conn::do_requset() {
     /* 返回值： 实际分配的内存的起始位置 */
     m_file_address = (char*)mmap(0, m_file_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
     close(fd);
-    return FILE_REQUEST;
+    if (m_file_address == MAP_FAILED) {
+        m_file_address = 0;
+        return INTERNAL_ERRNO;
+    }
+    return file_ret;
+}
+
+/* 解析 HTTP-date，依次尝试 IMF-fixdate、RFC 850 和 asctime 三种格式，失败返回 -1 */
+static time_t parse_http_date(const char* text) {
+    static const char* formats[] = {"%a, %d %b %Y %H:%M:%S GMT", "%A, %d-%b-%y %H:%M:%S GMT", "%a %b %d %H:%M:%S %Y"};
+    for (int i = 0; i < 3; i++) {
+        struct tm tm;
+        memset(&tm, 0, sizeof(tm));
+        const char* end = strptime(text, formats[i], &tm);
+        if (end && *end == '\0') {
+            return timegm(&tm);
+        }
+    }
+    return -1;
+}
+
+/* If-None-Match 使用弱比较：去掉 W/ 前缀后比较引号内的部分，"*" 匹配任何存在的资源 */
+static bool etag_list_match(const char* list, const char* etag) {
+    if (etag[0] == 'W') {
+        etag += 2;
+    }
+    int etag_len = strlen(etag);
+    const char* p = list;
+    while (*p) {
+        while (*p == ' ' || *p == '\t' || *p == ',') {
+            p++;
+        }
+        if (*p == '*') {
+            return true;
+        }
+        if (p[0] == 'W' && p[1] == '/') {
+            p += 2;
+        }
+        if (*p != '"') {
+            return false;  /* 格式错误，按不匹配处理 */
+        }
+        const char* close = strchr(p + 1, '"');
+        if (!close) {
+            return false;
+        }
+        if (close + 1 - p == etag_len && memcmp(p, etag, etag_len) == 0) {
+            return true;
+        }
+        p = close + 1;
+    }
+    return false;
+}
+
+/* 按 RFC 7232 判断条件 GET：有 If-None-Match 时只看它，否则看 If-Modified-Since */
+bool http_conn::not_modified() {
+    const char* inm = get_header(HDR_IF_NONE_MATCH);
+    if (inm) {
+        char etag[64];
+        format_etag(m_file_stat, m_gzip, etag, sizeof(etag));
+        return etag_list_match(inm, etag);
+    }
+    const char* ims = get_header(HDR_IF_MODIFIED_SINCE);
+    if (ims) {
+        time_t since = parse_http_date(ims);
+        return since >= 0 && m_file_stat.st_mtime <= since;
+    }
+    return false;
+}
+
+/* If-Range：实体标签用强比较(弱标签永不匹配)，日期须与 Last-Modified 完全一致 */
+static bool if_range_match(const char* value, const struct stat& st) {
+    if (value[0] == '"') {
+        char etag[64];
+        format_etag(st, false, etag, sizeof(etag));
+        return etag[0] == '"' && strcmp(value, etag) == 0;
+    }
+    if (value[0] == 'W' && value[1] == '/') {
+        return false;
+    }
+    return parse_http_date(value) == st.st_mtime;
+}
+
+/* 解析一个非负十进制数，没有数字或溢出返回 NULL */
+static const char* parse_range_number(const char* p, long long* out) {
+    long long n = 0;
+    int digits = 0;
+    while (*p >= '0' && *p <= '9') {
+        if (++digits > 18) {
+            return nullptr;
+        }
+        n = n * 10 + (*p++ - '0');
+    }
+    *out = n;
+    return digits ? p : nullptr;
+}
+
+/* 解析 Range 请求头(RFC 7233)，结果存入 m_ranges：
+    只支持 bytes 单位；语法错误、区间重叠、超过 MAX_RANGES 个区间，或 If-Range 不匹配时忽略 Range，按 200 发送整个文件；
+    区间全部超出文件时返回 416。 */
+http_conn::HTTP_CODE http_conn::parse_range() {
+    m_range_count = 0;
+    const char* p = get_header(HDR_RANGE);
+    if (!p || strncasecmp(p, "bytes=", 6) != 0) {
+        return FILE_REQUEST;
+    }
+    const char* if_range = get_header(HDR_IF_RANGE);
+    if (if_range && !if_range_match(if_range, m_file_stat)) {
+        return FILE_REQUEST;
+    }
+    long long size = m_file_stat.st_size;
+    p += 6;
+    while (true) {
+        while (*p == ' ' || *p == '\t') {
+            p++;
+        }
+        long long start, end;
+        if (*p == '-') {
+            /* 后缀区间 -n：最后 n 个字节 */
+            long long n;
+            if (!(p = parse_range_number(p + 1, &n))) {
+                m_range_count = 0;
+                return FILE_REQUEST;
+            }
+            start = n >= size ? 0 : size - n;
+            end = n == 0 ? -1 : size - 1;
+        }
+        else {
+            /* a-b 或 a- */
+            if (!(p = parse_range_number(p, &start)) || *p++ != '-') {
+                m_range_count = 0;
+                return FILE_REQUEST;
+            }
+            if (*p >= '0' && *p <= '9') {
+                p = parse_range_number(p, &end);
+                if (!p || end < start) {
+                    m_range_count = 0;
+                    return FILE_REQUEST;
+                }
+            }
+            else {
+                end = size - 1;
+            }
+            if (end >= size) {
+                end = size - 1;
+            }
+        }
+        /* start 超出文件的区间不可满足，跳过 */
+        if (start < size && start <= end) {
+            if (m_range_count == MAX_RANGES) {
+                m_range_count = 0;
+                return FILE_REQUEST;
+            }
+            m_ranges[m_range_count].start = start;
+            m_ranges[m_range_count].end = end;
+            m_range_count++;
+        }
+        while (*p == ' ' || *p == '\t') {
+            p++;
+        }
+        if (*p == ',') {
+            p++;
+            continue;
+        }
+        if (*p != '\0') {
+            m_range_count = 0;
+            return FILE_REQUEST;
+        }
+        break;
+    }
+    if (m_range_count == 0) {
+        return RANGE_NOT_SATISFIABLE;
+    }
+    for (int i = 0; i < m_range_count; i++) {
+        for (int j = i + 1; j < m_range_count; j++) {
+            if (m_ranges[i].start <= m_ranges[j].end && m_ranges[j].start <= m_ranges[i].end) {
+                m_range_count = 0;
+                return FILE_REQUEST;
+            }
+        }
+    }
+    return PARTIAL_CONTENT;
 }
 
 /* 对内存映射区执行 umap 操作, 则解除映射 */
@@ -558,51 +1175,74 @@ void http_conn::unmap() {
 
 /* 写 HTTP 响应 */
 bool http_conn::write() {
-    int temp = 0;
+    ssize_t temp = 0;
+    uint64_t start = Metrics::now_ns();
 
     if (bytes_to_send == 0) {
-        modfd(m_epollfd, m_sockfd, EPOLLIN, m_TRIGMode);
+        arm(EPOLLIN);
         init();
         return true;
     }
 
     while (1) {
+        struct iovec* iv = m_iv + m_iv_idx;
+        int iv_count = m_iv_count - m_iv_idx;
+        /* 从文件映射区发送时只发已驻留的部分；开头就不驻留时交给 I/O 线程预读，完成后事件循环再调用 write */
+        struct iovec window[MAX_IOV];
+        if (m_io_offload && m_file_address) {
+            iv_count = resident_window(window);
+            if (iv_count == 0) {
+                METRIC_OBSERVE(H_WRITE, Metrics::now_ns() - start);
+                return true;
+            }
+            iv = window;
+        }
         /* readv()称为散布读，即将文件中若干连续的数据块读入内存分散的缓冲区中。 */
         /* writev()称为聚集写，即收集内存中分散的若干缓冲区中的数据写至文件的连续区域中。*/
-        temp = writev(m_sockfd, m_iv, m_iv_count);
+        temp = writev(m_sockfd, iv, iv_count);
         if (temp < 0) {
             /* 如果 TCP 写缓冲没有空间， 则等待下一轮 EPOLLOUT 事件 */
             if (errno == EAGAIN) {
-                modfd(m_epollfd, m_sockfd, EPOLLOUT, m_TRIGMode);
+                arm(EPOLLOUT);
+                METRIC_OBSERVE(H_WRITE, Metrics::now_ns() - start);
                 return true;
             }
             unmap();
             return false;
         }
+        METRIC_ADD(M_BYTES_SENT, temp);
         /* 写成功, 则更新 待写 和 已写 的字节量 */
         bytes_to_send -= temp;
         bytes_have_send += temp;
 
-        if (bytes_have_send >= m_iv[0].iov_len) {
-            m_iv[0].iov_len = 0;
-            m_iv[1].iov_base = m_file_address + (bytes_have_send - m_write_idx);
-            m_iv[1].iov_len = bytes_to_send;
-        }
-        else {
-            m_iv[0].iov_base = m_write_buf + bytes_have_send;
-            m_iv[0].iov_len = m_iv[0].iov_len - bytes_have_send;
+        /* 跳过已经发完的内存块，部分发送的内存块把起点后移 */
+        size_t sent = temp;
+        while (sent > 0 && m_iv_idx < m_iv_count) {
+            if (sent >= m_iv[m_iv_idx].iov_len) {
+                sent -= m_iv[m_iv_idx].iov_len;
+                m_iv_idx++;
+            }
+            else {
+                m_iv[m_iv_idx].iov_base = (char*)m_iv[m_iv_idx].iov_base + sent;
+                m_iv[m_iv_idx].iov_len -= sent;
+                sent = 0;
+            }
         }
 
         if (bytes_to_send <= 0) {
+            METRIC_OBSERVE(H_WRITE, Metrics::now_ns() - start);
             unmap();
-            modfd(m_epollfd, m_sockfd, EPOLLIN, m_TRIGMode);
 
             if (m_linger) {  /* 保持连接 */
-                init();  /* 初始化参数 */
+                init();  /* 初始化参数，保留流水线中下一个请求已读入的部分 */
+                /* 已有下一个请求的数据时不会再来读事件，由调用者直接 process()，它会重新注册事件 */
+                if (!has_pending_request()) {
+                    arm(EPOLLIN);
+                }
                 return true;
             }
             else {
-                return true;
+                return false;  /* 短连接，交由定时器回调关闭 */
             }
         }
 
@@ -610,6 +1250,67 @@ bool http_conn::write() {
 }
 
 
+/* 每个请求在开始处理前按客户端 IP 计一次请求速率，同一请求只计一次(分多次读入、已由事件循环计过)。
+    消息体读取途中不计 */
+bool http_conn::charge_request() {
+    if (m_rate_charged || m_check_state != CHECK_STATE_REQUSETLINE) {
+        return true;
+    }
+    m_rate_charged = true;
+    return rate_limiter::get_instance()->allow_request(m_address.sin_addr.s_addr);
+}
+
+/* 把待发送的内存块中最多 RESIDENT_WINDOW 字节复制到 iv，在文件映射区中第一个不驻留的页处截断，返回块数。
+    开头就不驻留时提交预读并返回 0；预读队列已满时不截断，照常发送(可能缺页)。 */
+int http_conn::resident_window(struct iovec* iv) {
+    static const uintptr_t page = sysconf(_SC_PAGESIZE);
+    unsigned char vec[RESIDENT_WINDOW / 4096 + 2];
+    const char* map_end = m_file_address + m_file_stat.st_size;
+    size_t budget = RESIDENT_WINDOW;
+    int count = 0;
+    for (int i = m_iv_idx; i < m_iv_count && budget > 0; i++) {
+        const char* base = (const char*)m_iv[i].iov_base;
+        size_t len = m_iv[i].iov_len < budget ? m_iv[i].iov_len : budget;
+        if (base >= m_file_address && base < map_end) {
+            uintptr_t first = (uintptr_t)base & ~(page - 1);
+            size_t pages = ((uintptr_t)base + len - first + page - 1) / page;
+            if (mincore((void*)first, pages * page, vec) == 0) {
+                size_t k = 0;
+                while (k < pages && (vec[k] & 1)) {
+                    k++;
+                }
+                if (k < pages) {
+                    const char* cold = (const char*)(first + k * page);
+                    size_t warm = cold > base ? cold - base : 0;
+                    if (warm > 0) {
+                        iv[count].iov_base = (void*)base;
+                        iv[count].iov_len = warm;
+                        return count + 1;
+                    }
+                    if (count > 0) {
+                        return count;
+                    }
+                    off_t off = cold - m_file_address;
+                    size_t ahead = map_end - cold < PREFETCH_LEN ? map_end - cold : PREFETCH_LEN;
+                    static uint32_t seq = 0;  /* 只在事件循环线程中递增 */
+                    if (++seq == 0) {
+                        seq = 1;
+                    }
+                    if (io_pool::get_instance()->submit(m_real_file, m_file_stat.st_dev, m_file_stat.st_ino, off, ahead, m_sockfd, seq)) {
+                        m_prefetch_seq = seq;
+                        return 0;
+                    }
+                }
+            }
+        }
+        iv[count].iov_base = (void*)base;
+        iv[count].iov_len = len;
+        count++;
+        budget -= len;
+    }
+    return count;
+}
+
 /* 往读写缓冲区写入待发送的数据 */   /*------被 写状态行、写头、写空行、写请求体 4各调用 （相当于API）*/
 bool http_conn::add_response(const char* format, ...){  /* 可变参数 */
     if (m_write_idx >= WRITE_BUFFER_SIZE) {
@@ -620,7 +1321,7 @@ bool http_conn::add_response(const char* format, ...){  /* 可变参数 */
     /* vsnprintf : 将可变参数 格式化输出 到一个字符数组 */
     /* 将数据 format 从可变参数列表写入输入缓冲区， 返回写入数据的而长度 */
     /* 格式化字符串 *format， 用于指定输出数据的格式  */     /* va_list类型的指针， 用于访问可变参数列表 */
-    int len = vsnprintf(m_write_buf + m_read_idx, WRITE_BUFFER_SIZE - 1 - m_write_idx, format, arg_list);
+    int len = vsnprintf(m_write_buf + m_write_idx, WRITE_BUFFER_SIZE - 1 - m_write_idx, format, arg_list);
     if (len >= (WRITE_BUFFER_SIZE - 1 - m_write_idx)) {
         va_end(arg_list);
         return false;
@@ -637,11 +1338,12 @@ bool http_conn::add_response(const char* format, ...){  /* 可变参数 */
 
 /* 添加状态行 * /    /* HTTP/1.1  200 OK */
 bool http_conn::add_status_line(int status, const char* title) {
+    METRIC_STATUS(status);
     return add_response("%s %d %s\r\n", "HTTP/1.1", status, title);
 }
 
 /* 添加消息报文头 ： 文本长度、连接状态、空行 */
-bool http_conn::add_headers(int content_len) {
+bool http_conn::add_headers(long long content_len) {
     bool ret = true;
     ret = ret && add_content_length(content_len);  /* 表示响应报文长度 */
     ret = ret && add_Linger();  /* 连接状态: 通知浏览器是保持连接还是关闭 */
@@ -649,14 +1351,83 @@ bool http_conn::add_headers(int content_len) {
     return ret;
 }
 
-bool http_conn::add_content_length(int content_len) {
-    return add_response("Content-Length: %d\r\n", content_len);
+bool http_conn::add_content_length(long long content_len) {
+    return add_response("Content-Length: %lld\r\n", content_len);
+}
+
+bool http_conn::add_content_type(const char* type) {
+    return add_response("Content-Type: %s\r\n", type);
 }
 
 bool http_conn::add_Linger() {
     return add_response("Connection: %s\r\n", (m_linger == true) ? "Keep-alive" : "close");
 }
 
+/* 追加一个待发送的内存块 */
+void http_conn::add_iov(const char* base, size_t len) {
+    m_iv[m_iv_count].iov_base = (void*)base;
+    m_iv[m_iv_count].iov_len = len;
+    m_iv_count++;
+    bytes_to_send += len;
+}
+
+/* 206 的 Content-Range 等头部和响应体：
+    单区间直接发送映射区中的一段；多区间按 multipart/byteranges 组织，
+    各分段头部写在请求内存池中，与映射区中的各段交错成 iovec，文件数据不拷贝。 */
+bool http_conn::add_ranges() {
+    long long size = m_file_stat.st_size;
+    if (m_range_count == 1) {
+        const byte_range& r = m_ranges[0];
+        if (!add_response("Content-Range: bytes %lld-%lld/%lld\r\n", r.start, r.end, size) ||
+            !add_headers(r.end - r.start + 1)) {
+            return false;
+        }
+        add_iov(m_write_buf, m_write_idx);
+        add_iov(m_file_address + r.start, r.end - r.start + 1);
+        return true;
+    }
+
+    char boundary[40];
+    snprintf(boundary, sizeof(boundary), "%016llx%08lx", (unsigned long long)Metrics::now_ns(),
+             (unsigned long)m_file_stat.st_ino);
+    /* 各分段头部和结束分隔符从请求内存池分配，发送完之前一直有效 */
+    const char* parts[MAX_RANGES + 1];
+    size_t part_len[MAX_RANGES + 1];
+    long long body_len = 0;
+    for (int i = 0; i < m_range_count; i++) {
+        const byte_range& r = m_ranges[i];
+        parts[i] = m_arena.printf("\r\n--%s\r\nContent-Range: bytes %lld-%lld/%lld\r\n\r\n", boundary, r.start, r.end, size);
+        part_len[i] = strlen(parts[i]);
+        body_len += part_len[i] + r.end - r.start + 1;
+    }
+    parts[m_range_count] = m_arena.printf("\r\n--%s--\r\n", boundary);
+    part_len[m_range_count] = strlen(parts[m_range_count]);
+    body_len += part_len[m_range_count];
+
+    if (!add_response("Content-Type: multipart/byteranges; boundary=%s\r\n", boundary) || !add_headers(body_len)) {
+        return false;
+    }
+    add_iov(m_write_buf, m_write_idx);
+    for (int i = 0; i < m_range_count; i++) {
+        add_iov(parts[i], part_len[i]);
+        add_iov(m_file_address + m_ranges[i].start, m_ranges[i].end - m_ranges[i].start + 1);
+    }
+    add_iov(parts[m_range_count], part_len[m_range_count]);
+    return true;
+}
+
+/* ETag 和 Last-Modified，取自 m_file_stat；可压缩的资源同时带上 Vary */
+bool http_conn::add_validators() {
+    char etag[64];
+    char date[64];
+    format_etag(m_file_stat, m_gzip, etag, sizeof(etag));
+    format_http_date(m_file_stat.st_mtime, date, sizeof(date));
+    if (m_vary && !add_response("Vary: Accept-Encoding\r\n")) {
+        return false;
+    }
+    return add_response("ETag: %s\r\nLast-Modified: %s\r\n", etag, date);
+}
+
 bool http_conn::add_blank_line() {
     return add_response("%s", "\r\n");
 }
@@ -665,8 +1436,54 @@ bool http_conn::add_content(const char* content) {
     return add_response("%s", content);
 }
 
+/* 刚写好的 200 响应放入响应缓存：m_write_buf 以 add_headers 写入的 Connection 行和空行结尾。
+   mtime 距今不足 1 秒的文件 ETag 还是弱的，暂不缓存。
+   缓存键按请求的编码偏好：接受 gzip 的可压缩文件这次却发了原文件(其他线程正在压缩)时不缓存，
+   否则之后接受 gzip 的客户端一直拿到未压缩的版本 */
+void http_conn::cache_response(const char* body, size_t len) {
+    response_cache* rcache = response_cache::get_instance();
+    if (!m_cacheable || !rcache->fits(m_file_stat.st_size) || time(NULL) - m_file_stat.st_mtime < 1) {
+        return;
+    }
+    if (m_vary && m_accept_gzip && !m_gzip) {
+        return;
+    }
+    int tail = m_linger ? sizeof(conn_keep_alive) - 1 : sizeof(conn_close) - 1;
+    rcache->put(m_real_file, m_accept_gzip, m_file_stat, m_write_buf, m_write_idx - tail, body, len);
+}
+
+/* 升级时新进程在接受连接之前调用，键来自旧进程的响应缓存：
+    用一个不关联 socket 的连接对象走一遍 serve_file 和 process_write，响应随之进入缓存，文件也进入页缓存 */
+void http_conn::prewarm(const char* keys, size_t len) {
+    http_conn* c = new http_conn;
+    const char* end = keys + len;
+    size_t key_len;
+    for (const char* key = keys; key < end; key += key_len + 1) {
+        key_len = strnlen(key, end - key);
+        if (key_len < 3 || key_len - 2 >= (size_t)FILENAME_LEN || key[key_len - 2] != '\n') {
+            continue;
+        }
+        c->init();
+        memcpy(c->m_real_file, key, key_len - 2);
+        c->m_real_file[key_len - 2] = '\0';
+        c->m_linger = true;
+        c->m_accept_gzip = key[key_len - 1] == '1' && gzip_cache::get_instance()->enabled();
+        c->m_cacheable = response_cache::get_instance()->enabled();
+        HTTP_CODE ret = c->serve_file();
+        if (ret == FILE_REQUEST) {
+            c->process_write(ret);
+        }
+        c->unmap();
+    }
+    c->init();
+    delete c;
+}
+
 /* 根据服务器处理 HTTP 请求的结果， 决定返回给客户端的内容 */
 bool http_conn::process_write(HTTP_CODE ret) {
+    if (m_draining) {
+        m_linger = false;
+    }
     switch (ret) {
         case INTERNAL_ERRNO: {
             add_status_line(500, error_500_title);
@@ -677,6 +1494,7 @@ bool http_conn::process_write(HTTP_CODE ret) {
             break;
         }
         case BAD_REQUEST: {
+            m_linger = false;  /* 无法确定请求的边界，发完即关闭 */
             add_status_line(400, error_400_title);
             add_headers(strlen(error_400_form));
             if (!add_content(error_400_form)) {
@@ -684,6 +1502,15 @@ bool http_conn::process_write(HTTP_CODE ret) {
             }
             break;
         }
+        case PAYLOAD_TOO_LARGE: {
+            m_linger = false;  /* 未读完的消息体不再读取 */
+            add_status_line(413, error_413_title);
+            add_headers(strlen(error_413_form));
+            if (!add_content(error_413_form)) {
+                return false;
+            }
+            break;
+        }
         case NO_RESOURCE: {
             add_status_line(404, error_404_title);
             add_headers(strlen(error_404_form));
@@ -693,7 +1520,7 @@ bool http_conn::process_write(HTTP_CODE ret) {
             break;
         }
         case FORBIDDEN_REQUEST: {
-            add_status_line(404, error_403_title);
+            add_status_line(403, error_403_title);
             add_headers(strlen(error_403_form));
             if(!add_content(error_403_form)) {
                 return false;
@@ -702,14 +1529,25 @@ bool http_conn::process_write(HTTP_CODE ret) {
         }
         case FILE_REQUEST: {
             add_status_line(200, ok_200_title);
+            add_validators();
+            add_response("Accept-Ranges: bytes\r\n");
+            if (m_gzip) {
+                add_response("Content-Encoding: gzip\r\n");
+                if (!add_headers(m_gzip_body->size())) {
+                    return false;
+                }
+                cache_response(m_gzip_body->data(), m_gzip_body->size());
+                add_iov(m_write_buf, m_write_idx);
+                add_iov(m_gzip_body->data(), m_gzip_body->size());
+                return true;
+            }
             if (m_file_stat.st_size != 0) {
-                add_headers(m_file_stat.st_size);
-                m_iv[0].iov_base = m_write_buf;
-                m_iv[0].iov_len = m_write_idx;
-                m_iv[1].iov_base = m_file_address;
-                m_iv[1].iov_len = m_file_stat.st_size;
-                m_iv_count = 2;
-                bytes_to_send = m_write_idx + m_file_stat.st_size;
+                if (!add_headers(m_file_stat.st_size)) {
+                    return false;
+                }
+                cache_response(m_file_address, m_file_stat.st_size);
+                add_iov(m_write_buf, m_write_idx);
+                add_iov(m_file_address, m_file_stat.st_size);
                 return true;
             }
             else {
@@ -719,31 +1557,197 @@ bool http_conn::process_write(HTTP_CODE ret) {
                     return false;
                 }
             }
+            break;
+        }
+        case PARTIAL_CONTENT: {
+            add_status_line(206, partial_206_title);
+            add_validators();
+            add_response("Accept-Ranges: bytes\r\n");
+            return add_ranges();
+        }
+        case RANGE_NOT_SATISFIABLE: {
+            add_status_line(416, range_416_title);
+            add_response("Content-Range: bytes */%lld\r\n", (long long)m_file_stat.st_size);
+            if (!add_headers(0)) {
+                return false;
+            }
+            break;
+        }
+        /* 304 没有响应体，也不带 Content-Length */
+        case NOT_MODIFIED: {
+            add_status_line(304, not_modified_304_title);
+            add_validators();
+            if (!add_Linger() || !add_blank_line()) {
+                return false;
+            }
+            break;
+        }
+        case UPLOAD_COMPLETE: {
+            if (m_upload.replaced()) {
+                add_status_line(200, ok_200_title);
+            }
+            else {
+                add_status_line(201, created_201_title);
+                add_response("Location: %s\r\n", m_url);
+            }
+            if (!add_headers(0)) {
+                return false;
+            }
+            break;
+        }
+        /* 长连接整块发送；短连接把 Connection 一行换掉，仍是一次 writev */
+        case CACHED_RESPONSE: {
+            const cached_response& c = m_cached;
+            METRIC_STATUS(200);
+            if (m_linger) {
+                add_iov(c.data, c.len);
+            }
+            else {
+                add_iov(c.data, c.conn_off);
+                add_iov(conn_close, sizeof(conn_close) - 1);
+                add_iov(c.data + c.body_off, c.len - c.body_off);
+            }
+            return true;
+        }
+        /* 包中的响应头、Connection 行、响应体，一次 writev */
+        case BUNDLE_RESPONSE: {
+            const bundle_entry& e = *m_bundle_entry;
+            const static_bundle* bundle = static_bundle::get_instance();
+            METRIC_STATUS(200);
+            METRIC_ADD(M_BUNDLE_HITS, 1);
+            bool gzip = m_accept_gzip && e.gz_body_len > 0;
+            const char* head = bundle->data(gzip ? e.gz_head_off : e.head_off);
+            size_t head_len = gzip ? e.gz_head_len : e.head_len;
+            add_iov(head, head_len);
+            if (m_linger) {
+                add_iov(conn_keep_alive, sizeof(conn_keep_alive) - 1);
+            }
+            else {
+                add_iov(conn_close, sizeof(conn_close) - 1);
+            }
+            add_iov(head + head_len, gzip ? e.gz_body_len : e.body_len);
+            return true;
+        }
+        /* 预先渲染的 429，发完关闭连接 */
+        case TOO_MANY_REQUESTS: {
+            METRIC_STATUS(429);
+            m_linger = false;
+            add_iov(too_many_429, sizeof(too_many_429) - 1);
+            return true;
+        }
+        case METRICS_REQUEST: {
+            add_status_line(200, ok_200_title);
+            add_content_type("text/plain; version=0.0.4");
+            add_headers(m_metrics_body.size());
+            add_iov(m_write_buf, m_write_idx);
+            add_iov(m_metrics_body.data(), m_metrics_body.size());
+            return true;
         }
         default: {
             return false;
         }
     }
     /* 除 FILE_REQUEST 状态外， 其余状态只申请一个 iovec， 指的响应报文段缓冲区 */
-    m_iv[0].iov_base = m_write_buf;
-    m_iv[0].iov_len = m_write_idx;
-    m_iv_count = 1;
-    bytes_to_send = m_write_idx;
+    add_iov(m_write_buf, m_write_idx);
     return true;
 }
 
 /* 由线程池中的 工作线程 调用， 这是处理 HTTP 请求的入口地址 */
+/* reactor 模式下响应直接在这里写出，不先注册 EPOLLOUT 再等事件循环通知：小响应一次 writev 就发完，
+    之后只剩一次注册 EPOLLIN；流水线中的后续请求接着处理。写失败时 shutdown 后重新注册，由事件循环收到 EPOLLHUP 后关闭 */
 void http_conn::process() {
-    HTTP_CODE read_ret = process_read();  /* 解析 HTTP 请求， 并返回解析结果 */
-    if (read_ret == NO_REQUEST) {
-        /* 如果是请求不完整， 需要继续读取请求报文， 将 epoll 事件重置等待剩余的请求报文 */
-        modfd(m_epollfd, m_sockfd, EPOLLIN, m_TRIGMode);
-        return;
+    while (true) {
+        uint64_t start = Metrics::now_ns();
+        /* 快速路径已解析并路由过的请求直接读文件；超过请求速率的不再解析 */
+        HTTP_CODE read_ret = !charge_request() ? TOO_MANY_REQUESTS : m_routed ? GET_REQUEST : process_read();  /* 解析 HTTP 请求， 并返回解析结果 */
+        uint64_t parsed = Metrics::now_ns();
+        METRIC_OBSERVE(H_PARSE, parsed - start);
+        if (read_ret == NO_REQUEST) {
+            /* 如果是请求不完整， 需要继续读取请求报文， 将 epoll 事件重置等待剩余的请求报文 */
+            hand_back(EPOLLIN);
+            return;
+        }
+        if (read_ret == GET_REQUEST) {
+            read_ret = do_requset();  /* 得到完整请求后，分析目标文件 */
+        }
+
+        bool write_ret = process_write(read_ret);
+        METRIC_OBSERVE(H_PROCESS, Metrics::now_ns() - parsed);
+        if (!write_ret) {
+            close_conn();
+            hand_back(EPOLLOUT);
+            return;
+        }
+        if (!m_worker_io) {
+            hand_back(EPOLLOUT);
+            return;
+        }
+        if (!write()) {
+            close_conn();
+            arm(EPOLLIN);
+            return;
+        }
+        /* write 已按需注册 EPOLLOUT 或 EPOLLIN；只有读缓冲区里还有下一个请求时才继续 */
+        if (!has_pending_request()) {
+            return;
+        }
     }
+}
+/* 可以在事件循环中解析的 POST 请求：开启了协程，且不是上传(上传的消息体边收边写文件) */
+bool http_conn::form_post() const {
+    if (!coro_loop::get_instance()->enabled() || m_upload.active()) {
+        return false;
+    }
+    if (m_check_state == CHECK_STATE_REQUSETLINE) {
+        return m_read_idx >= 5 && strncmp(m_read_buf, "POST ", 5) == 0 && strncmp(m_read_buf, "POST /upload/", 13) != 0;
+    }
+    return m_method == POST && strncmp(m_url, "/upload/", 8) != 0;
+}
 
-    bool write_ret = process_write(read_ret);
-    if(!write_ret) {
-        close_conn();
+/* proactor 快速路径：由事件循环线程在 read 之后调用。
+    新的 GET 请求在本线程中解析和路由，结果不需要文件 I/O 或数据库时(命中响应缓存、/metrics、错误响应)
+    直接写出，省去入队、唤醒工作线程和线程切换；流水线中紧随其后的请求继续在这里处理。
+    需要读文件时记下已路由(m_routed)交给线程池，工作线程不再重复解析。
+    开启了协程时 POST 表单也在这里解析，完整后启动 serve_form 协程，等数据库时不占用工作线程；
+    其他方法(上传要写文件)和没有开启协程时的表单交给线程池。 */
+http_conn::INLINE_STATUS http_conn::process_inline() {
+    while (true) {
+        /* 第一个请求已由事件循环在分派前计过，这里计流水线中的后续请求 */
+        if (!charge_request()) {
+            return process_write(TOO_MANY_REQUESTS) && write() ? INLINE_DONE : INLINE_CLOSE;
+        }
+        bool get = m_check_state == CHECK_STATE_REQUSETLINE && m_read_idx >= 4 && strncmp(m_read_buf, "GET ", 4) == 0;
+        if (!get && !form_post()) {
+            return INLINE_NONE;
+        }
+        uint64_t start = Metrics::now_ns();
+        HTTP_CODE ret = process_read();
+        uint64_t parsed = Metrics::now_ns();
+        METRIC_OBSERVE(H_PARSE, parsed - start);
+        if (ret == NO_REQUEST) {
+            arm(EPOLLIN);
+            return INLINE_DONE;
+        }
+        if (ret == GET_REQUEST && m_method == POST) {
+            to_worker();
+            spawn(serve_form());
+            return INLINE_DONE;
+        }
+        if (ret == GET_REQUEST) {
+            ret = route_request();
+            if (ret == GET_REQUEST) {
+                m_routed = true;
+                return INLINE_NONE;
+            }
+        }
+        bool write_ret = process_write(ret);
+        METRIC_OBSERVE(H_PROCESS, Metrics::now_ns() - parsed);
+        if (!write_ret || !write()) {
+            return INLINE_CLOSE;
+        }
+        /* 未发完(已注册 EPOLLOUT)，或发完后没有下一个请求(已注册 EPOLLIN) */
+        if (bytes_to_send > 0 || !has_pending_request()) {
+            return INLINE_DONE;
+        }
     }
-    modfd(m_epollfd, m_sockfd, EPOLLOUT, m_TRIGMode);
-}
\ No newline at end of file
+}
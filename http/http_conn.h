@@ -21,19 +21,39 @@
 #include <sys/wait.h>
 #include <sys/uio.h>
 #include <map>
+#include <atomic>
 
 #include "../lock/locker.h"
 #include "../log/log.h"
 #include "../sql_conn_pool/sql_connection_pool.h"
 #include "../timer/lst_timer.h"
+#include "../metrics/metrics.h"
+#include "../coro/task.h"
+#include "../cache/gzip_cache.h"
+#include "../cache/response_cache.h"
+#include "../cache/static_bundle.h"
+#include "../ratelimit/rate_limiter.h"
+#include "http_header.h"
+#include "http_body.h"
+#include "http_upload.h"
+#include "http_arena.h"
 
 class http_conn {
+    friend class micro_bench;  /* 微基准测试直接驱动私有的解析函数 */
+
 public:
     static const int FILENAME_LEN = 200;  /* 文件名的最大长度 */
     static const int READ_BUFFER_SIZE = 2048;  /* 读缓冲区的大小 */
     static const int WRITE_BUFFER_SIZE = 1024;  /* 写缓冲区的大小 */
+    static const int MAX_HEADERS = 64;  /* 单个请求最多记录的请求头个数 */
+    static const int FORM_BODY_LIMIT = 1024;  /* 登录/注册表单消息体的上限，超出返回 413 */
+    static const int MAX_RANGES = 16;  /* Range 请求最多支持的区间个数，超出时忽略 Range 发送整个文件 */
+    static const int MAX_IOV = 2 * MAX_RANGES + 2;  /* 响应头 + 每个区间的分段头和数据 + 结束分隔符 */
+    static const int RESIDENT_WINDOW = 256 * 1024;  /* 事件循环每次 writev 前检查驻留的长度，也是一次 writev 的上限 */
+    static const int PREFETCH_LEN = 1024 * 1024;  /* 一次交给 I/O 线程预读的长度 */
+    static const int ARENA_SIZE = 2048;  /* 请求内存池自带的大小，够放 MAX_RANGES 个分段头 */
 
-    /* HTTP 请求方法， 但本项目仅支持 GET */
+    /* HTTP 请求方法， 本项目支持 GET、POST，以及上传用的 PUT */
     enum METHOD {
         GET = 0,
         POST,
@@ -62,7 +82,23 @@ public:
         FORBIDDEN_REQUEST,
         FILE_REQUEST,
         INTERNAL_ERRNO,  /* 服务器内部错误，该结果在主状态机逻辑 switch 的 default 下，一般不会触发 */
-        COLSED_CONNECTION
+        COLSED_CONNECTION,
+        METRICS_REQUEST,  /* 请求保留路径 /metrics，响应体由内存中的指标渲染，不访问文件系统 */
+        NOT_MODIFIED,  /* 条件请求命中客户端缓存，返回不带响应体的 304 */
+        PARTIAL_CONTENT,  /* Range 请求，返回 206 */
+        RANGE_NOT_SATISFIABLE,  /* Range 请求的区间全部超出文件，返回 416 */
+        PAYLOAD_TOO_LARGE,  /* 消息体超出处理者的上限，返回 413 */
+        UPLOAD_COMPLETE,  /* 上传的文件已写入上传目录，新建返回 201，覆盖返回 200 */
+        CACHED_RESPONSE,  /* 命中小文件响应缓存，直接发送缓存中的完整响应 */
+        BUNDLE_RESPONSE,  /* 命中静态资源包，直接发送包中预先渲染的响应 */
+        TOO_MANY_REQUESTS  /* 客户端超过请求速率，发送预先渲染的 429 并关闭连接 */
+    };
+
+    /* process_inline 的结果 */
+    enum INLINE_STATUS {
+        INLINE_NONE = 0,  /* 需要文件 I/O 或数据库，交给线程池 */
+        INLINE_DONE,  /* 已在事件循环线程中处理完(或等待更多数据)，事件已重新注册 */
+        INLINE_CLOSE  /* 处理失败或短连接已发完，应关闭连接 */
     };
 
     /* 从状态机三种状态：标识解析一行的读取状态 */
@@ -73,23 +109,96 @@ public:
     };
 
 public:
-    http_conn() {}
-    ~http_conn() {}
+    http_conn();
+    ~http_conn();
+    http_conn(const http_conn&) = delete;
+    http_conn& operator=(const http_conn&) = delete;
 
 public:
     /* 初始化新接受的连接 */
-    void init(int sockfd, const sockaddr_in& addr, char* root, int TRIGMode, int close_log, string user, string passwd, string sqlname);
+    void init(int sockfd, const sockaddr_in& addr, char* root, int TRIGMode, int close_log,
+              const string& user, const string& passwd, const string& sqlname);
     void close_conn(bool real_close = true);  /* 关闭连接 */
     void process();  /* 处理客户请求 */
+    INLINE_STATUS process_inline();  /* proactor 快速路径，由事件循环线程在 read 之后调用 */
     bool read();  /* 非阻塞读操作 */
+    bool charge_request();  /* 按客户端 IP 计请求速率，超限返回 false */
     bool write();  /* 非阻塞写操作 */
     sockaddr_in* get_address(){
         return &m_address;
     }
+    /* 当前响应已发完，读缓冲区中还有已收到的下一个请求(流水线)，应直接处理，不会再有读事件；
+       响应还没发完时(等待 EPOLLOUT 或预读)读缓冲区里是当前请求，不算 */
+    bool has_pending_request() const {
+        return bytes_to_send == 0 && m_read_idx > 0;
+    }
 
-    void initmysql_result(connection_pool* connPool);
-    int timer_flag;
-    int improv;
+    /* I/O 线程完成预读后由事件循环调用：是这个连接正在等待的那次预读时返回 true，应继续发送 */
+    bool prefetch_done(uint32_t seq) {
+        if (seq == 0 || seq != m_prefetch_seq) {
+            return false;
+        }
+        m_prefetch_seq = 0;
+        return true;
+    }
+    /* 连接被定时器或对端关闭时，丢弃之后到达的预读通知 */
+    void abort_prefetch() {
+        m_prefetch_seq = 0;
+    }
+
+    /* 连接被定时器或对端关闭时，删除未完成上传的临时文件 */
+    void abort_upload() {
+        m_upload.abort();
+    }
+
+    /* 连接关闭时归还共享响应缓存中的引用，发送到一半的缓存项可以被淘汰了 */
+    void release_cached() {
+        response_cache::get_instance()->release(&m_cached);
+    }
+
+    /* 关注 ev(EPOLLIN 或 EPOLLOUT)。EPOLLONESHOT 模式下已注册的就是 ev 时不再调用 epoll_ctl；
+        常驻注册时什么也不做 */
+    void arm(int ev);
+    /* proactor 工作线程处理完，把连接交还给事件循环 */
+    void hand_back(int ev);
+    /* 事件循环收到这个连接的事件，EPOLLONESHOT 已使注册失效 */
+    void fired() {
+        m_events = 0;
+    }
+    /* 交给工作线程(或协程)前由事件循环调用，hand_back、arm 重新注册事件时清除；
+        这期间定时器不关闭连接，连接对象不会被新连接复用 */
+    void to_worker() {
+        m_in_worker.store(true, std::memory_order_relaxed);
+    }
+    /* 工作线程不再使用连接但也不注册事件(读写失败由事件循环关闭，入队失败)时清除 */
+    void from_worker() {
+        m_in_worker.store(false, std::memory_order_release);
+    }
+    bool in_worker() const {
+        return m_in_worker.load(std::memory_order_acquire);
+    }
+    /* 常驻注册：收到 EPOLLIN 后记下，读到 EAGAIN 才清除，读缓冲区满时保留 */
+    void set_read_ready() {
+        m_read_ready = true;
+    }
+    bool read_ready() const {
+        return m_read_ready;
+    }
+    /* 响应未发完(包括等待预读) */
+    bool sending() const {
+        return bytes_to_send > 0;
+    }
+    bool waiting_prefetch() const {
+        return m_prefetch_seq != 0;
+    }
+    /* 长连接在两个请求之间：没有在工作线程中、没有未发完的响应，也没有收到一半的请求或上传 */
+    bool idle() const {
+        return !in_worker() && !sending() && !waiting_prefetch() && m_read_idx == 0 && !m_upload.active();
+    }
+
+    static void initmysql_result(connection_pool* connPool);
+    /* 按缓存键(路径、换行、0 或 1 表示是否 gzip，以 '\0' 分隔)各渲染一次响应，放入响应缓存和 gzip 缓存 */
+    static void prewarm(const char* keys, size_t len);
 
 private:
     void init();  /* 初始化连接 */
@@ -99,11 +208,31 @@ private:
     /* 下面这一组函数被 process_read 调用以分析 HTTP 请求 */
     HTTP_CODE parse_request_line(char* text);
     HTTP_CODE parse_headers(char* text);
-    HTTP_CODE parse_content(char* text);
+    HTTP_CODE parse_content();
+    HTTP_CODE start_body();
+    HTTP_CODE pump_upload();
     HTTP_CODE do_requset();
+    HTTP_CODE route_request();
+    HTTP_CODE serve_file();
+    const char* check_form(char kind, const char** name, const char** passwd);
+    int insert_user(MYSQL* mysql, const char* name, const char* passwd);
+    const char* finish_register(const char* name, int res);
+    task<> serve_form();
+    bool form_post() const;
     char* get_line() {
         return m_read_buf + m_start_line;
     }
+    /* 取请求头的值(已去掉首尾空白、以 \0 结尾)，同名请求头取第一个，不存在返回 NULL */
+    const char* get_header(HTTP_HEADER id, int* len = nullptr) const {
+        if (m_header_index[id] < 0) {
+            return nullptr;
+        }
+        const http_header_view& h = m_headers[m_header_index[id]];
+        if (len) {
+            *len = h.value_len;
+        }
+        return m_read_buf + h.value_off;
+    }
     LINE_STATUS parse_line();
 
     /* 下面这一组函数被 process_write 调用来填写 HTTP 应答 */
@@ -111,62 +240,127 @@ private:
     bool add_response(const char* format, ...);
     bool add_content(const char* content);
     bool add_status_line(int status, const char* title);
-    bool add_headers(int content_length);
-    bool add_content_length(int content_length);
+    bool add_headers(long long content_length);
+    bool add_content_length(long long content_length);
+    bool add_content_type(const char* type);
+    bool add_validators();
+    bool not_modified();
+    HTTP_CODE parse_range();
+    bool add_ranges();
+    void add_iov(const char* base, size_t len);
+    int resident_window(struct iovec* iv);
     bool add_Linger();
     bool add_blank_line();
+    void cache_response(const char* body, size_t len);
 
 public:
     /* 所有 socket 上的事件都被注册到同一个 epoll 内核事件表中，所以将 epoll 文件描述符设置为静态的*/
     static int m_epollfd;
     static int m_user_count;  /* 统计用户数量 */
-    MYSQL* mysql; 
+    static string m_upload_dir;  /* PUT/POST /upload/<name> 的保存目录，为空表示不接受上传 */
+    static bool m_io_offload;  /* proactor 且有 I/O 线程：事件循环发送文件前检查驻留，不驻留的交给 I/O 线程预读 */
+    /* ET + proactor：连接一次注册 EPOLLIN | EPOLLOUT 边缘触发，不带 EPOLLONESHOT，之后不再修改 */
+    static bool m_persistent;
+    static bool m_worker_io;  /* reactor：工作线程处理完直接写响应，写不完才等 EPOLLOUT */
+    static bool m_draining;  /* 进程正在退出：之后的响应都带 Connection: close，发完即关闭 */
+
+    /* 成员按访问频率排列。对象按缓存行对齐，开头两个缓存行是每次读写事件都要用到的热数据；
+        工作线程写、事件循环线程读的几个标志单独占一个缓存行；
+        其余是只在解析、路由时用到的冷数据；读写缓冲区等大数组放在对象外(buffers)，不占热数据的缓存行 */
     int m_state;  /* 0为读，1为写 */
 
 private:
+    /* ---- 热数据 ---- */
     int m_sockfd;  /* 该 HTTP 连接的 socket */
-    sockaddr_in m_address;  /*该 HTTP 连接的对方的 socket 地址 */
-
-    char m_read_buf[READ_BUFFER_SIZE];  /* 读缓冲区 */  /* 既是数组名，又是数组首地址 */
+    int m_TRIGMode;
     int m_read_idx;  /* 标识读缓冲中已经读入的客户数据的最后一个字节的下一个位置 */
     int m_checked_idx;  /* 当前正在分析的行的起始位置 */
     int m_start_line;  /* 目前正在解析的行的起始位置 */
-    char m_write_buf[WRITE_BUFFER_SIZE];  /* 写缓冲区 */
     int m_write_idx;  /* 写缓冲区中待发送的字节数 */
-
+    int m_iv_count;  /* writev 的内存块数量 */
+    int m_iv_idx;  /* 已发完的内存块由 m_iv_idx 跳过 */
     CHECK_STATE m_check_state;  /* 主状态机当前所处的状态 */
     METHOD m_method;  /* 请求方法 */
-
-    char m_real_file[FILENAME_LEN];  /* 客户请求的目标文件的完整路径，其内容等于 doc_rot + m_url, doc_root 是网站根目录 */
+    uint32_t m_prefetch_seq;  /* 正在等待的预读的序号，0 表示没有 */
+    bool m_linger;  /* HTTP 请求是否要保持连接 */
+    bool m_rate_charged;  /* 当前请求已计入请求速率 */
+    bool m_routed;  /* 事件循环线程已解析并路由，工作线程只需 serve_file */
+    bool m_gzip;  /* 选择了 gzip 版本 */
+    int m_events;  /* 当前注册在 epoll 中的事件(EPOLLIN / EPOLLOUT)，0 表示没有注册(EPOLLONESHOT 已触发) */
+    bool m_read_ready;  /* 常驻注册：socket 中可能还有没读的数据 */
+    char* m_read_buf;  /* 读缓冲区，指向 buffers */
+    char* m_write_buf;  /* 写缓冲区 */
+    struct iovec* m_iv;  /* 我们将采用 writev 来执行操作，writev 函数可以将分散保存在多个缓冲中的数据一并发送 */
+    char* m_file_address;  /* 客户请求的目标文件被 mmap 到内存中的起始位置 */
+    long long bytes_to_send;  /* 64 位，支持超过 2GB 的文件 */
+    long long bytes_have_send;
     char* m_url;  /* 客户请求的目标文件名 */
+
+public:
+    /* ---- 跨线程标志：工作线程置位，事件循环线程读取 ---- */
+    alignas(64) atomic<int> improv;  /* 工作线程已完成读或写 */
+    atomic<int> timer_flag;  /* 读写失败，事件循环应关闭连接；先于 improv 置位 */
+private:
+    atomic<bool> m_in_worker;  /* 工作线程或协程正在使用连接，常驻注册下这期间的事件由事件循环忽略 */
+
+public:
+
+    /* ---- 冷数据 ---- */
+    alignas(64) MYSQL* mysql;
+
+private:
     char* m_version;  /* HTTP 协议版本号， 我们仅支持 HTTP/1.1 */
     char* m_host;  /* 主机名 */
-    int m_content_length;  /* HTTP 请求的消息体的长度 */
-    bool m_linger;  /* HTTP 请求是否要保持连接 */
+    long long m_content_length;  /* HTTP 请求的消息体的长度 */
+    int m_header_count;
+    signed char m_header_index[HDR_NUM];  /* 已知请求头 -> 在 m_headers 中第一次出现的下标，-1 表示没有 */
+    bool m_vary;  /* 目标文件可压缩，响应随 Accept-Encoding 不同，需带 Vary */
+    bool m_accept_gzip;  /* 客户端接受 gzip，也是响应缓存键的一部分 */
+    bool m_cacheable;  /* 无条件、无 Range 的 GET，响应可以放入响应缓存 */
+    int m_range_count;
+    int m_close_log;
+    sockaddr_in m_address;  /*该 HTTP 连接的对方的 socket 地址 */
 
-    char* m_file_address;  /* 客户请求的目标文件被 mmap 到内存中的起始位置 */
-    struct stat m_file_stat;  /* 目标文件的状态，通过它我们可以判断问价是否存在，是否为目录，是否可读，并获取文件大小等信息 */
+    /* Range 请求的区间，闭区间 [start, end] */
+    struct byte_range {
+        long long start;
+        long long end;
+    };
+    /* 对象外的缓冲区，随连接对象一起创建，连接对象由对象池复用，不随请求分配 */
+    struct buffers {
+        char read_buf[READ_BUFFER_SIZE];  /* 读缓冲区 */
+        char write_buf[WRITE_BUFFER_SIZE];  /* 写缓冲区 */
+        char real_file[FILENAME_LEN];
+        struct iovec iv[MAX_IOV];
+        http_header_view headers[MAX_HEADERS];
+        byte_range ranges[MAX_RANGES];
+        char arena[ARENA_SIZE];  /* m_arena 自带的内存 */
+    };
+    buffers* m_buffers;
+    char* m_real_file;  /* 客户请求的目标文件的完整路径，其内容等于 doc_rot + m_url, doc_root 是网站根目录 */
+    http_header_view* m_headers;  /* 全部请求头，按出现顺序 */
+    byte_range* m_ranges;
+    request_arena m_arena;  /* 请求级的临时数据，init() 时复位 */
 
-    /* 我们将采用 writev 来执行操作， 所以定义下面两个成员， 其中 m_iv_count 表示被写内存块的数量 */
-    /* writev 函数可以将分散保存在多个缓冲中的数据一并发送 */
-    struct iovec m_iv[2];
-    int m_iv_count;
+    shared_ptr<const string> m_gzip_body;  /* gzip 版本的响应体，来自 gzip_cache */
+    cached_response m_cached;  /* 命中的缓存响应，发送期间持有引用 */
+    const bundle_entry* m_bundle_entry;  /* 命中的资源包项 */
+    string m_metrics_body;  /* /metrics 的响应体 */
+    struct stat m_file_stat;  /* 目标文件的状态，通过它我们可以判断问价是否存在，是否为目录，是否可读，并获取文件大小等信息 */
 
     int cgi;  /* common gateway interface, 是否启用POST */
     char* m_string;  /* 存储请求体数据 */
-
-    int bytes_to_send;
-    int bytes_have_send;
+    body_reader m_body_reader;  /* 消息体的增量解码 */
+    body_collector m_form_collector;  /* 表单消息体收集到 m_form_body */
+    body_discarder m_body_discarder;  /* 其他消息体读完即丢弃 */
+    string m_form_body;
+    upload_sink m_upload;  /* 上传的消息体写入文件 */
 
     char* doc_root;
 
-    map<string, string> m_users;
-    int m_TRIGMode;
-    int m_close_log;
-
     char sql_user[100];
     char sql_passwd[100];
     char sql_name[100];
 };
 
-#endif
\ No newline at end of file
+#endif
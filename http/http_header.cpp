@@ -0,0 +1,47 @@
+#include <string.h>
+#include "http_header.h"
+
+/* 槽位 -> 编号及名称长度的表在编译期展开生成，空槽位为 HDR_OTHER */
+struct hdr_slot_table {
+    unsigned char ids[HDR_SLOTS];
+    unsigned char lens[HDR_SLOTS];  /* 运行时先比长度，再比名称 */
+};
+
+constexpr int hdr_id_at_slot(int slot, int id) {
+    return id == HDR_NUM ? HDR_OTHER : (hdr_slot_of(id) == slot ? id : hdr_id_at_slot(slot, id + 1));
+}
+
+constexpr int hdr_len_at_slot(int slot) {
+    return hdr_id_at_slot(slot, 0) == HDR_OTHER ? 0 : hdr_strlen(HDR_NAMES[hdr_id_at_slot(slot, 0)]);
+}
+
+/* C++11 没有 std::index_sequence，用一个最小的整数序列展开 0..HDR_SLOTS-1 */
+template <int... I>
+struct hdr_seq {};
+
+template <int N, int... I>
+struct hdr_make_seq : hdr_make_seq<N - 1, N - 1, I...> {};
+
+template <int... I>
+struct hdr_make_seq<0, I...> {
+    typedef hdr_seq<I...> type;
+};
+
+template <int... I>
+constexpr hdr_slot_table hdr_make_table(hdr_seq<I...>) {
+    return hdr_slot_table{{(unsigned char)hdr_id_at_slot(I, 0)...}, {(unsigned char)hdr_len_at_slot(I)...}};
+}
+
+static constexpr hdr_slot_table HDR_TABLE = hdr_make_table(hdr_make_seq<HDR_SLOTS>::type());
+
+HTTP_HEADER http_header_lookup(const char* name, int len) {
+    if (len <= 0) {
+        return HDR_OTHER;
+    }
+    int slot = hdr_hash(name, len);
+    int id = HDR_TABLE.ids[slot];
+    if (HDR_TABLE.lens[slot] != len || strncasecmp(name, HDR_NAMES[id], len) != 0) {
+        return HDR_OTHER;
+    }
+    return (HTTP_HEADER)id;
+}
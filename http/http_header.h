@@ -0,0 +1,93 @@
+#ifndef HTTP_HEADER_H
+#define HTTP_HEADER_H
+
+/* 请求头名称识别：
+    已知的请求头名称在编译期生成一张完美哈希表，运行时只取首字符、末字符和长度计算一次哈希，
+    再与表中唯一的候选名比较一次，O(1) 得到请求头编号。
+    新增请求头只需在 HTTP_HEADER 和 HDR_NAMES 中各加一项；若与已有名称冲突，编译时 static_assert 报错，
+    此时调整 hdr_hash 中的系数即可。
+*/
+
+/* 已知请求头编号，顺序与 HDR_NAMES 一致 */
+enum HTTP_HEADER {
+    HDR_HOST = 0,
+    HDR_CONNECTION,
+    HDR_CONTENT_LENGTH,
+    HDR_CONTENT_TYPE,
+    HDR_TRANSFER_ENCODING,
+    HDR_IF_NONE_MATCH,
+    HDR_IF_MODIFIED_SINCE,
+    HDR_RANGE,
+    HDR_IF_RANGE,
+    HDR_ACCEPT_ENCODING,
+    HDR_COOKIE,
+    HDR_USER_AGENT,
+    HDR_ACCEPT,
+    HDR_REFERER,
+    HDR_EXPECT,
+    HDR_NUM,
+    HDR_OTHER = HDR_NUM      /* 未登记的请求头 */
+};
+
+/* 小写的请求头名称 */
+constexpr const char* HDR_NAMES[HDR_NUM] = {
+    "host",
+    "connection",
+    "content-length",
+    "content-type",
+    "transfer-encoding",
+    "if-none-match",
+    "if-modified-since",
+    "range",
+    "if-range",
+    "accept-encoding",
+    "cookie",
+    "user-agent",
+    "accept",
+    "referer",
+    "expect",
+};
+
+const int HDR_SLOTS = 32;  /* 哈希表大小，必须是 2 的幂 */
+
+constexpr int hdr_lower(char c) {
+    return (c >= 'A' && c <= 'Z') ? c + ('a' - 'A') : c;
+}
+
+/* 只用首字符、末字符和长度，name 不需要以 \0 结尾 */
+constexpr int hdr_hash(const char* name, int len) {
+    return (hdr_lower(name[0]) + 4 * hdr_lower(name[len - 1]) + 9 * len) & (HDR_SLOTS - 1);
+}
+
+constexpr int hdr_strlen(const char* s) {
+    return *s ? 1 + hdr_strlen(s + 1) : 0;
+}
+
+constexpr int hdr_slot_of(int id) {
+    return hdr_hash(HDR_NAMES[id], hdr_strlen(HDR_NAMES[id]));
+}
+
+/* 编号 [from, HDR_NUM) 中与 id 落在同一槽位的个数 */
+constexpr int hdr_collisions(int id, int from) {
+    return from == HDR_NUM ? 0 : (from != id && hdr_slot_of(from) == hdr_slot_of(id)) + hdr_collisions(id, from + 1);
+}
+
+constexpr bool hdr_hash_is_perfect(int id) {
+    return id == HDR_NUM ? true : hdr_collisions(id, 0) == 0 && hdr_hash_is_perfect(id + 1);
+}
+
+static_assert(hdr_hash_is_perfect(0), "header name hash collision: adjust hdr_hash");
+
+/* 一个请求头在读缓冲区中的位置，只记偏移和长度，不拷贝 */
+struct http_header_view {
+    int name_off;
+    int name_len;
+    int value_off;            /* 值已去掉首尾空白，并在原位以 \0 结尾 */
+    int value_len;
+    HTTP_HEADER id;
+};
+
+/* 请求头名称 -> 编号，未登记的名称返回 HDR_OTHER；大小写不敏感 */
+HTTP_HEADER http_header_lookup(const char* name, int len);
+
+#endif
@@ -0,0 +1,179 @@
+#include "http_scan.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HTTP_SCAN_X86 1
+#endif
+
+/* 字符分类表：1 表示行扫描命中，2 表示词元扫描命中 */
+enum {
+    SCAN_LINE = 1,
+    SCAN_TOKEN = 2
+};
+
+static unsigned char g_scan_class[256];
+
+static void init_class_table() {
+    for (int c = 0; c < 256; c++) {
+        unsigned char cls = 0;
+        if ((c < 0x20 && c != '\t') || c == 0x7f) {
+            cls |= SCAN_LINE | SCAN_TOKEN;
+        }
+        if (c == ' ' || c == '\t') {
+            cls |= SCAN_TOKEN;
+        }
+        g_scan_class[c] = cls;
+    }
+}
+
+/************************** 标量实现 **************************/
+
+static int line_scalar(const char* p, int len) {
+    for (int i = 0; i < len; i++) {
+        if (g_scan_class[(unsigned char)p[i]] & SCAN_LINE) {
+            return i;
+        }
+    }
+    return len;
+}
+
+static int token_scalar(const char* p, int len) {
+    for (int i = 0; i < len; i++) {
+        if (g_scan_class[(unsigned char)p[i]] & SCAN_TOKEN) {
+            return i;
+        }
+    }
+    return len;
+}
+
+#ifdef HTTP_SCAN_X86
+
+/************************** SSE4.2 实现 **************************/
+
+/* pcmpestri 的区间表，每两个字节为一个闭区间 */
+static const char LINE_RANGES[16] = "\x00\x08\x0a\x1f\x7f\x7f";   /* 除 \t 外的控制字符、DEL */
+static const char TOKEN_RANGES[16] = "\x00\x20\x7f\x7f";          /* 控制字符、空格、DEL */
+
+#define SSE42_MODE (_SIDD_UBYTE_OPS | _SIDD_CMP_RANGES | _SIDD_LEAST_SIGNIFICANT)
+
+__attribute__((target("sse4.2")))
+static int line_sse42(const char* p, int len) {
+    __m128i ranges = _mm_loadu_si128((const __m128i*)LINE_RANGES);
+    int i = 0;
+    for (; i + 16 <= len; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(p + i));
+        int idx = _mm_cmpestri(ranges, 6, v, 16, SSE42_MODE);
+        if (idx != 16) {
+            return i + idx;
+        }
+    }
+    return i + line_scalar(p + i, len - i);
+}
+
+__attribute__((target("sse4.2")))
+static int token_sse42(const char* p, int len) {
+    __m128i ranges = _mm_loadu_si128((const __m128i*)TOKEN_RANGES);
+    int i = 0;
+    for (; i + 16 <= len; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(p + i));
+        int idx = _mm_cmpestri(ranges, 4, v, 16, SSE42_MODE);
+        if (idx != 16) {
+            return i + idx;
+        }
+    }
+    return i + token_scalar(p + i, len - i);
+}
+
+/************************** AVX2 实现 **************************/
+
+/* 无符号比较 c <= limit 用 min(c, limit) == c 实现；剩余不足 32 字节时再用一次 16 字节的 SSE2 */
+
+__attribute__((target("avx2")))
+static int line_avx2(const char* p, int len) {
+    const __m256i ctl = _mm256_set1_epi8(0x1f);
+    const __m256i tab = _mm256_set1_epi8('\t');
+    const __m256i del = _mm256_set1_epi8(0x7f);
+    int i = 0;
+    for (; i + 32 <= len; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i*)(p + i));
+        __m256i hit = _mm256_cmpeq_epi8(_mm256_min_epu8(v, ctl), v);
+        hit = _mm256_andnot_si256(_mm256_cmpeq_epi8(v, tab), hit);
+        hit = _mm256_or_si256(hit, _mm256_cmpeq_epi8(v, del));
+        unsigned mask = (unsigned)_mm256_movemask_epi8(hit);
+        if (mask) {
+            return i + __builtin_ctz(mask);
+        }
+    }
+    if (i + 16 <= len) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(p + i));
+        __m128i hit = _mm_cmpeq_epi8(_mm_min_epu8(v, _mm_set1_epi8(0x1f)), v);
+        hit = _mm_andnot_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('\t')), hit);
+        hit = _mm_or_si128(hit, _mm_cmpeq_epi8(v, _mm_set1_epi8(0x7f)));
+        unsigned mask = (unsigned)_mm_movemask_epi8(hit);
+        if (mask) {
+            return i + __builtin_ctz(mask);
+        }
+        i += 16;
+    }
+    return i + line_scalar(p + i, len - i);
+}
+
+__attribute__((target("avx2")))
+static int token_avx2(const char* p, int len) {
+    const __m256i sp = _mm256_set1_epi8(0x20);
+    const __m256i del = _mm256_set1_epi8(0x7f);
+    int i = 0;
+    for (; i + 32 <= len; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i*)(p + i));
+        __m256i hit = _mm256_cmpeq_epi8(_mm256_min_epu8(v, sp), v);
+        hit = _mm256_or_si256(hit, _mm256_cmpeq_epi8(v, del));
+        unsigned mask = (unsigned)_mm256_movemask_epi8(hit);
+        if (mask) {
+            return i + __builtin_ctz(mask);
+        }
+    }
+    if (i + 16 <= len) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(p + i));
+        __m128i hit = _mm_cmpeq_epi8(_mm_min_epu8(v, _mm_set1_epi8(0x20)), v);
+        hit = _mm_or_si128(hit, _mm_cmpeq_epi8(v, _mm_set1_epi8(0x7f)));
+        unsigned mask = (unsigned)_mm_movemask_epi8(hit);
+        if (mask) {
+            return i + __builtin_ctz(mask);
+        }
+        i += 16;
+    }
+    return i + token_scalar(p + i, len - i);
+}
+
+#endif
+
+static const http_scanner SCANNER_SCALAR = {"scalar", line_scalar, token_scalar};
+#ifdef HTTP_SCAN_X86
+static const http_scanner SCANNER_SSE42 = {"sse4.2", line_sse42, token_sse42};
+static const http_scanner SCANNER_AVX2 = {"avx2", line_avx2, token_avx2};
+#endif
+
+int http_scanners(const http_scanner* list[HTTP_SCANNER_MAX]) {
+    int n = 0;
+    list[n++] = &SCANNER_SCALAR;
+#ifdef HTTP_SCAN_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse4.2")) {
+        list[n++] = &SCANNER_SSE42;
+    }
+    if (__builtin_cpu_supports("avx2")) {
+        list[n++] = &SCANNER_AVX2;
+    }
+#endif
+    return n;
+}
+
+/* 运行时分派：选可用实现中最后(最快)的一个 */
+static const http_scanner* select_scanner() {
+    init_class_table();
+    const http_scanner* list[HTTP_SCANNER_MAX];
+    int n = http_scanners(list);
+    return list[n - 1];
+}
+
+const http_scanner* g_http_scanner = select_scanner();
@@ -0,0 +1,35 @@
+#ifndef HTTP_SCAN_H
+#define HTTP_SCAN_H
+
+/* 请求报文扫描：
+    一次遍历同时找出行尾(\r \n)、词元边界(空格 \t)和非法字符(除 \t 外的控制字符、DEL)。
+    x86 上按 CPU 特性在启动时选择 AVX2 / SSE4.2(pcmpestri) / 标量实现，其他平台只有标量实现。
+    各实现的返回值完全一致，可由 micro_bench --fuzz 对拍验证。
+*/
+
+/* 一组扫描函数，都返回 [p, p + len) 中第一个命中字符的下标，没有命中返回 len */
+struct http_scanner {
+    const char* name;
+    /* 行扫描：命中 \r、\n 以及非法字符 */
+    int (*line)(const char* p, int len);
+    /* 词元扫描：在行扫描的基础上再命中空格和 \t */
+    int (*token)(const char* p, int len);
+};
+
+/* 启动时按 CPU 特性选出的实现 */
+extern const http_scanner* g_http_scanner;
+
+inline int http_scan_line(const char* p, int len) {
+    return g_http_scanner->line(p, len);
+}
+
+inline int http_scan_token(const char* p, int len) {
+    return g_http_scanner->token(p, len);
+}
+
+const int HTTP_SCANNER_MAX = 3;
+
+/* 把当前 CPU 上可用的全部实现填入 list 并返回个数，下标 0 为标量实现；用于对拍和基准测试 */
+int http_scanners(const http_scanner* list[HTTP_SCANNER_MAX]);
+
+#endif
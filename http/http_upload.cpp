@@ -0,0 +1,236 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+
+#include "http_upload.h"
+
+/************************** buffer_pool **************************/
+
+char* buffer_pool::acquire() {
+    m_lock.lock();
+    if (!m_idle.empty()) {
+        char* buf = m_idle.front();
+        m_idle.pop_front();
+        m_lock.unlock();
+        return buf;
+    }
+    m_lock.unlock();
+    return new char[BUFFER_SIZE];
+}
+
+void buffer_pool::release(char* buf) {
+    m_lock.lock();
+    if ((int)m_idle.size() < MAX_IDLE) {
+        m_idle.push_back(buf);
+        buf = nullptr;
+    }
+    m_lock.unlock();
+    delete[] buf;
+}
+
+buffer_pool::~buffer_pool() {
+    for (list<char*>::iterator it = m_idle.begin(); it != m_idle.end(); ++it) {
+        delete[] *it;
+    }
+}
+
+/************************** upload_sink **************************/
+
+static const int PIPE_SIZE = 1024 * 1024;  /* 尝试把管道容量调到 1MB，失败时用默认的 64KB */
+
+upload_sink::upload_sink()
+    : m_fd(-1), m_pipe_bytes(0), m_remain(0), m_offset(0), m_use_splice(true), m_replaced(false), m_buffer(nullptr) {
+    m_pipe[0] = m_pipe[1] = -1;
+}
+
+upload_sink::~upload_sink() {
+    abort();
+}
+
+bool upload_sink::open(const char* dir, const char* name) {
+    abort();
+    m_path = string(dir) + "/" + name;
+    char suffix[64];
+    snprintf(suffix, sizeof(suffix), ".%d.%p.tmp", getpid(), (void*)this);
+    m_tmp_path = string(dir) + "/." + name + suffix;
+    m_fd = ::open(m_tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (m_fd < 0) {
+        return false;
+    }
+    struct stat st;
+    m_replaced = stat(m_path.c_str(), &st) == 0;
+    m_pipe_bytes = 0;
+    m_remain = 0;
+    m_offset = 0;
+    m_use_splice = true;
+    return true;
+}
+
+bool upload_sink::write_all(const char* data, size_t len) {
+    while (len > 0) {
+        ssize_t n = pwrite(m_fd, data, len, m_offset);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        data += n;
+        len -= n;
+        m_offset += n;
+    }
+    return true;
+}
+
+bool upload_sink::on_data(const char* data, int len) {
+    return write_all(data, len);
+}
+
+void upload_sink::start_splice(long long remaining) {
+    m_remain = remaining;
+}
+
+bool upload_sink::open_pipe() {
+    if (m_pipe[0] >= 0) {
+        return true;
+    }
+    if (pipe2(m_pipe, O_NONBLOCK | O_CLOEXEC) < 0) {
+        m_pipe[0] = m_pipe[1] = -1;
+        return false;
+    }
+    fcntl(m_pipe[1], F_SETPIPE_SZ, PIPE_SIZE);
+    return true;
+}
+
+/* splice 不可用时的退路：recv 到借来的缓冲区再写文件 */
+UPLOAD_STATUS upload_sink::pump_buffered(int sockfd) {
+    if (!m_buffer) {
+        m_buffer = buffer_pool::get_instance()->acquire();
+    }
+    while (m_remain > 0) {
+        size_t want = m_remain < buffer_pool::BUFFER_SIZE ? (size_t)m_remain : buffer_pool::BUFFER_SIZE;
+        ssize_t n = recv(sockfd, m_buffer, want, 0);
+        if (n == 0) {
+            return UPLOAD_ERROR;
+        }
+        if (n < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                return UPLOAD_AGAIN;
+            }
+            if (errno == EINTR) {
+                continue;
+            }
+            return UPLOAD_ERROR;
+        }
+        if (!write_all(m_buffer, n)) {
+            return UPLOAD_ERROR;
+        }
+        m_remain -= n;
+    }
+    return UPLOAD_DONE;
+}
+
+UPLOAD_STATUS upload_sink::pump(int sockfd) {
+    if (m_use_splice && !open_pipe()) {
+        m_use_splice = false;
+    }
+    while (m_remain > 0) {
+        if (!m_use_splice) {
+            return pump_buffered(sockfd);
+        }
+        /* socket -> 管道：只搬还没进管道的部分 */
+        bool drained = false;
+        ssize_t n = splice(sockfd, NULL, m_pipe[1], NULL, m_remain - m_pipe_bytes, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        if (n == 0) {
+            return UPLOAD_ERROR;  /* 对端提前关闭 */
+        }
+        if (n < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                drained = true;
+            }
+            else if ((errno == EINVAL || errno == ENOSYS) && m_pipe_bytes == 0) {
+                m_use_splice = false;  /* 这种 socket 不支持 splice */
+                continue;
+            }
+            else if (errno != EINTR) {
+                return UPLOAD_ERROR;
+            }
+        }
+        else {
+            m_pipe_bytes += n;
+        }
+        /* 管道 -> 文件：排空后才会再读 socket */
+        while (m_pipe_bytes > 0) {
+            ssize_t m = splice(m_pipe[0], NULL, m_fd, &m_offset, m_pipe_bytes, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+            if (m < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                if (errno != EINVAL && errno != ENOSYS) {
+                    return UPLOAD_ERROR;
+                }
+                /* 文件系统不支持 splice 写入：管道中剩余的数据经缓冲区写入，之后改用 recv + write */
+                if (!m_buffer) {
+                    m_buffer = buffer_pool::get_instance()->acquire();
+                }
+                while (m_pipe_bytes > 0) {
+                    ssize_t r = read(m_pipe[0], m_buffer, buffer_pool::BUFFER_SIZE);
+                    if (r <= 0 || !write_all(m_buffer, r)) {
+                        return UPLOAD_ERROR;
+                    }
+                    m_pipe_bytes -= r;
+                    m_remain -= r;
+                }
+                m_use_splice = false;
+                break;
+            }
+            m_pipe_bytes -= m;
+            m_remain -= m;
+        }
+        if (drained && m_remain > 0) {
+            return UPLOAD_AGAIN;
+        }
+    }
+    release();
+    return UPLOAD_DONE;
+}
+
+/* 归还缓冲区、关闭管道，文件保持打开 */
+void upload_sink::release() {
+    if (m_buffer) {
+        buffer_pool::get_instance()->release(m_buffer);
+        m_buffer = nullptr;
+    }
+    if (m_pipe[0] >= 0) {
+        close(m_pipe[0]);
+        close(m_pipe[1]);
+        m_pipe[0] = m_pipe[1] = -1;
+    }
+    m_pipe_bytes = 0;
+}
+
+bool upload_sink::commit() {
+    release();
+    if (m_fd < 0) {
+        return false;
+    }
+    bool ok = close(m_fd) == 0 && rename(m_tmp_path.c_str(), m_path.c_str()) == 0;
+    m_fd = -1;
+    if (!ok) {
+        unlink(m_tmp_path.c_str());
+    }
+    return ok;
+}
+
+void upload_sink::abort() {
+    release();
+    if (m_fd >= 0) {
+        close(m_fd);
+        m_fd = -1;
+        unlink(m_tmp_path.c_str());
+    }
+    m_remain = 0;
+}
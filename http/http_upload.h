@@ -0,0 +1,105 @@
+#ifndef HTTP_UPLOAD_H
+#define HTTP_UPLOAD_H
+
+#include <list>
+#include <string>
+#include <sys/types.h>
+
+#include "../lock/locker.h"
+#include "http_body.h"
+
+using namespace std;
+
+/* 上传缓冲区池：splice 不可用时退回用户态拷贝，缓冲区从池中借用，上传结束归还，
+   避免每个上传连接常驻一块大缓冲区 */
+class buffer_pool {
+public:
+    static const int BUFFER_SIZE = 64 * 1024;
+    static const int MAX_IDLE = 64;  /* 池中最多保留的空闲缓冲区数 */
+
+    /* 局部静态变量单例模式 */
+    static buffer_pool* get_instance() {
+        static buffer_pool instance;
+        return &instance;
+    }
+
+    char* acquire();
+    void release(char* buf);
+
+private:
+    buffer_pool() {}
+    ~buffer_pool();
+
+    locker m_lock;
+    list<char*> m_idle;
+};
+
+/* pump 的返回值 */
+enum UPLOAD_STATUS {
+    UPLOAD_DONE = 0,   /* 消息体已全部写入文件 */
+    UPLOAD_AGAIN,      /* socket 已读空，等待下一次可读 */
+    UPLOAD_ERROR       /* 对端提前关闭或写文件失败 */
+};
+
+/* 把上传的消息体写入上传目录下的文件：
+    先写入同目录下的临时文件，完整收到后 rename 为正式文件名，中途失败删除临时文件。
+    Content-Length 的消息体由 pump 经管道 splice 从 socket 直接搬到文件，数据不经过用户态；
+    读缓冲区中已经读入的部分和 chunked 解码后的数据经 on_data 写入。
+    背压：每次只从 socket 搬入管道能容纳的量，并在再次读 socket 之前把管道排空到文件，
+    磁盘跟不上时 socket 不再被读取，由 TCP 窗口限制客户端；socket 读空(EAGAIN)时返回 UPLOAD_AGAIN，
+    由调用者重新注册 EPOLLIN。
+*/
+class upload_sink : public body_handler {
+public:
+    upload_sink();
+    ~upload_sink();
+
+    /* 在 dir 下为 name 创建临时文件 */
+    bool open(const char* dir, const char* name);
+    bool active() const {
+        return m_fd >= 0;
+    }
+
+    /* body_handler：经用户态写入的数据 */
+    bool on_data(const char* data, int len);
+
+    /* 之后的 remaining 字节直接从 socket 搬运 */
+    void start_splice(long long remaining);
+    bool splicing() const {
+        return active() && m_remain > 0;
+    }
+    UPLOAD_STATUS pump(int sockfd);
+
+    /* 完成：临时文件改名为正式文件；失败时同 abort */
+    bool commit();
+    /* 放弃：关闭并删除临时文件 */
+    void abort();
+
+    long long written() const {
+        return m_offset;
+    }
+    /* 是否覆盖了已有文件，决定返回 200 还是 201 */
+    bool replaced() const {
+        return m_replaced;
+    }
+
+private:
+    bool write_all(const char* data, size_t len);
+    bool open_pipe();
+    UPLOAD_STATUS pump_buffered(int sockfd);
+    void release();
+
+private:
+    int m_fd;                /* 临时文件 */
+    int m_pipe[2];           /* splice 用的管道 */
+    long long m_pipe_bytes;  /* 管道中尚未写入文件的字节数 */
+    long long m_remain;      /* 还需从 socket 搬运的字节数 */
+    off_t m_offset;          /* 已写入文件的字节数 */
+    bool m_use_splice;       /* splice 不被支持时退回 recv + write */
+    bool m_replaced;
+    char* m_buffer;          /* 退回用户态拷贝时从 buffer_pool 借用 */
+    string m_tmp_path;
+    string m_path;
+};
+
+#endif
@@ -0,0 +1,26 @@
+#ifndef HTTP_VALIDATORS_H
+#define HTTP_VALIDATORS_H
+
+#include <stdio.h>
+#include <time.h>
+#include <sys/stat.h>
+
+/* 资源校验器：
+    ETag 由 inode、文件大小和纳秒级 mtime 组成；mtime 距今不足 1 秒时文件可能在同一秒内再次被修改，
+    此时给出弱 ETag(W/ 前缀)；gzip 版本的 ETag 加 -gz 后缀。Last-Modified 为 mtime 的 HTTP-date。
+    服务器和打包工具 mkbundle 共用，同一文件无论从文件系统还是从资源包发送，校验器都相同。
+*/
+inline int format_etag(const struct stat& st, bool gzip, char* buf, int size) {
+    bool weak = time(NULL) - st.st_mtime < 1;
+    return snprintf(buf, size, "%s\"%lx-%llx-%lx.%lx%s\"", weak ? "W/" : "", (unsigned long)st.st_ino,
+                    (unsigned long long)st.st_size, (unsigned long)st.st_mtim.tv_sec, (unsigned long)st.st_mtim.tv_nsec,
+                    gzip ? "-gz" : "");
+}
+
+inline void format_http_date(time_t t, char* buf, int size) {
+    struct tm tm;
+    gmtime_r(&t, &tm);
+    strftime(buf, size, "%a, %d %b %Y %H:%M:%S GMT", &tm);
+}
+
+#endif
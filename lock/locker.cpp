@@ -75,19 +75,15 @@ cond::~cond() {
     }
 }
 
-// 阻塞当前线程
+// 阻塞当前线程，调用者必须已持有 m_mutex(等待期间由 pthread_cond_wait 原子地释放)
 bool cond::wait(pthread_mutex_t* m_mutex) {
     int ret = 0;
-    pthread_mutex_lock(m_mutex);
     ret = pthread_cond_wait(&m_cond, m_mutex);
-    pthread_mutex_unlock(m_mutex);
     return ret == 0;
 }
 bool cond::timewait(pthread_mutex_t *m_mutex, struct timespec t) {
     int ret = 0;
-    pthread_mutex_lock(m_mutex);
     ret = pthread_cond_timedwait(&m_cond, m_mutex, &t); /*允许线程等待一个条件变量被信号通知或者超时发生*/
-    pthread_mutex_unlock(m_mutex);
     return ret == 0;
 }
 /* pthread_cond_timedwait:
@@ -79,6 +79,8 @@ bool block_queue<T>::full() {
         m_mutex.unlock();
         return true;
     }
+    m_mutex.unlock();
+    return false;
 }
 
 template <typename T>
@@ -29,14 +29,17 @@ bool Log::init(const char* file_name, int close_log, int log_buf_size, int split
     /* 若输入的文件名没有/， 则直接将时间+文件名 作为日志名 */
     if (p == nullptr) {
         /* p为空说明filename中没有 '/'， 将整个filename写入 log_full_name */
-        snprintf(log_full_name, 511, "%d_%02d_%2d_%s", my_tm.tm_year + 1990, my_tm.tm_mon + 1, my_tm.tm_mday, file_name);
+        strcpy(log_name, file_name);
+        dir_name[0] = '\0';
+        snprintf(log_full_name, 511, "%d_%02d_%02d_%s", my_tm.tm_year + 1900, my_tm.tm_mon + 1, my_tm.tm_mday, file_name);
     }
     else{
         /* 将/的位置向后移一个位置，然后复制到logname中 */
         /* p-filename+1 是文件所在路径文件夹的长度*/
         strcpy(log_name, p + 1);  /* 截取 / 之后的部分为log_name */
-        strncpy(log_full_name, file_name, p - file_name + 1);
-        snprintf(log_full_name, 511, "%s%d_%02d_%2d_%s", dir_name, my_tm.tm_year + 1990, my_tm.tm_mon + 1, my_tm.tm_mday, file_name);
+        strncpy(dir_name, file_name, p - file_name + 1);
+        dir_name[p - file_name + 1] = '\0';
+        snprintf(log_full_name, 511, "%s%d_%02d_%02d_%s", dir_name, my_tm.tm_year + 1900, my_tm.tm_mon + 1, my_tm.tm_mday, log_name);
     }
 
     m_today = my_tm.tm_mday;
@@ -52,11 +55,15 @@ bool Log::init(const char* file_name, int close_log, int log_buf_size, int split
 /* write_log函数完成写入日志文件中的具体内容， 主要实现日志分级、分文件、格式化输出 */
 /* time和gettimeofday都可以获得日历时间， 但gettimeofday提供更高级的精度，甚至可达微秒级 */
 void Log::write_log(int level, const char* format, ...) {
+    if (m_close_log || m_fp == nullptr) {  /* 日志关闭或未初始化时直接返回 */
+        return;
+    }
     struct timeval now = {0, 0};
     gettimeofday(&now, nullptr);
     time_t t = now.tv_sec;
-    struct tm* sys_tm = localtime(&t);
-    struct tm my_tm = *sys_tm;  /* my_tm为当前时间tm类的结构体*/
+    /* localtime 每次调用都重新检查 TZ 环境变量(可能分配内存)，且不可重入；localtime_r 都没有 */
+    struct tm my_tm;  /* my_tm为当前时间tm类的结构体*/
+    localtime_r(&t, &my_tm);
     char s[16] = {0};
     switch (level)
     {
@@ -82,14 +89,14 @@ void Log::write_log(int level, const char* format, ...) {
     m_count++;
 
     /* 日志为新的一天  or  超过最大行数。 则需要分文件以便继续写入*/
-    if (m_today != my_tm.tm_mday || m_count % m_split_lines) {
+    if (m_today != my_tm.tm_mday || m_count % m_split_lines == 0) {
         char new_log[512] = {0};
         fflush(m_fp);  /* 刷新缓冲区，防止文件流中还残留数据 */
         fclose(m_fp);  /* 原来的(昨日的或已经写满的)文件关闭， 再打开新的 */
         char tail[16] = {0};
 
         /* 格式化日志名中的时间部分 */
-        snprintf(tail, 16, "%d_%02d_%02d_", my_tm.tm_year + 1090, my_tm.tm_mon + 1, my_tm.tm_mday);
+        snprintf(tail, 16, "%d_%02d_%02d_", my_tm.tm_year + 1900, my_tm.tm_mon + 1, my_tm.tm_mday);
 
         /* 如果成员变量 m_today 不是今天，说明这是今天第一次写入日志。  ——————>>创建今天的日志，并更新相关参数 */
         if (m_today != my_tm.tm_mday) {
@@ -99,38 +106,37 @@ void Log::write_log(int level, const char* format, ...) {
         }
         /* 否则是因为原文件写满了，导致需要分文件 */
         else {
-            snprintf(new_log, 511, "%s%s%s.%11d", dir_name, tail, m_count / m_split_lines);
+            snprintf(new_log, 511, "%s%s%s.%lld", dir_name, tail, log_name, m_count / m_split_lines);
         }
         m_fp = fopen(new_log, "a");
     }
-    m_mutex.unlock();
 
     va_list valist;   //声明一个变量来转换参数列表
     /* 将传入的格式化format参数赋值给va_list，便于格式化输出*/
     va_start(valist, format);  /* 初始化变量 */
 
-    string log_str;
-    m_mutex.unlock();
-
     /* 写入的具体时间内容格式 */
     int n = snprintf(m_buf, 48, "%d-%02d-%02d %02d:%02d:%02d.%06ld %s", 
-                    my_tm.tm_year + 1900, my_tm.tm_mon + 1, my_tm.tm_wday,
+                    my_tm.tm_year + 1900, my_tm.tm_mon + 1, my_tm.tm_mday,
                      my_tm.tm_hour, my_tm.tm_min, my_tm.tm_sec, now.tv_usec, s);
-    int m = snprintf(m_buf + n, m_log_buf_size - n - 1, format, valist);
+    int m = vsnprintf(m_buf + n, m_log_buf_size - n - 1, format, valist);
+    if (m > m_log_buf_size - n - 2) {
+        m = m_log_buf_size - n - 2;  /* 截断过长的日志行 */
+    }
     m_buf[m + n] = '\n';
     m_buf[m + n + 1] = '\0';
-    log_str = m_buf;
-    m_mutex.unlock();
 
-    /* 若异步写日志， 则将日志信息加入阻塞队列，同步(else)则向加锁文件中写 */
+    /* 若异步写日志， 则将日志信息加入阻塞队列，同步(else)则向加锁文件中写。
+       不为每行构造临时 string：同步时直接写 m_buf；异步时经复用的 m_line 拷贝进队列的槽位，
+       槽位和 m_line 的 string 都保留容量，稳定后不再分配内存 */
     if(m_is_async && !m_log_queue->full()) {
-        m_log_queue->push(log_str);
+        m_line.assign(m_buf, m + n + 1);
+        m_log_queue->push(m_line);
     }
     else {
-        m_mutex.lock();
-        fputs(log_str.c_str(), m_fp);
-        m_mutex.unlock();
+        fputs(m_buf, m_fp);
     }
+    m_mutex.unlock();
     va_end(valist);  //结束变量列表,和va_start成对使用   
 }
 
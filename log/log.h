@@ -53,6 +53,8 @@ private:
     Log() {
         m_count = 0;
         m_is_async = false;
+        m_fp = nullptr;
+        m_close_log = 1;  /* init 之前视为关闭 */
     }
     virtual ~Log() {
         if (m_fp != nullptr) {
@@ -82,6 +84,7 @@ private:
     int m_today;  /*将日志按天分类，记录当前是哪一天*/
     FILE* m_fp;  /* 打开 log 的文件指针*/
     char* m_buf;
+    string m_line;  /* 异步模式下入队前的一行，复用容量 */
     block_queue<string>* m_log_queue;  /* 阻塞队列 */
     bool m_is_async;  /* 是否为同步标志位 */
     locker m_mutex;
@@ -11,12 +11,19 @@ int main(int argc, char* argv[]) {
     config.parse_arg(argc, argv);
 
     WebServer server;
+    server.set_command(argv);  /* 平滑升级时以同样的命令行启动新程序 */
 
     /* 初始化 */
     server.init(config.port, user, passwd, dataBaseName, config.logWrite,
                 config.opt_linger, config.trigMode, config.sql_num, config.thread_num,
-                config.close_log, config.actor_model);
+                config.close_log, config.actor_model, config.upload_dir,
+                config.gzip_cache_mb, config.cache_file_kb, config.cache_mb,
+                config.bundle, config.io_threads, config.max_queue,
+                config.conn_rate, config.req_rate, config.max_conns,
+                config.backlog, config.defer_accept, config.fastopen, config.cpus,
+                config.workers, config.drain_sec, config.co_threads);
 
+    server.prefork();   /* 多进程模式下主进程在这里监管工作进程，不返回 */
     server.log_write(); /* 日志 */
     server.sql_pool();  /* 数据库 */
     server.thread_pool(); /* 线程池 */
@@ -0,0 +1,186 @@
+#include "metrics.h"
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+/* 槽位池放在静态存储区，程序启动时即为全 0 */
+static metrics_pool g_pool;
+
+thread_local metrics_slot* Metrics::t_slot = nullptr;
+
+Metrics::Metrics() {
+    m_pool = &g_pool;
+}
+
+/* 线程第一次记录指标时领取槽位，只在领取时做一次原子比较交换 */
+metrics_slot* Metrics::register_slot() {
+    int pid = getpid();
+    for (int i = 0; i < M_MAX_SLOTS; i++) {
+        int expected = 0;
+        if (m_pool->owner[i].load(memory_order_relaxed) == 0 && m_pool->owner[i].compare_exchange_strong(expected, pid)) {
+            int n = m_pool->count.load();
+            while (n < i + 1 && !m_pool->count.compare_exchange_weak(n, i + 1)) {
+            }
+            return &m_pool->slots[i];
+        }
+    }
+    return &m_pool->slots[M_MAX_SLOTS - 1];  /* 槽位用尽，共享最后一个槽位(原子加保证仍然正确) */
+}
+
+/* 只复制已领取的槽位，其余保持映射的全 0；调用线程改用新池中同一个槽位 */
+bool Metrics::share() {
+    metrics_pool* pool = (metrics_pool*)mmap(NULL, sizeof(metrics_pool), PROT_READ | PROT_WRITE,
+                                             MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (pool == MAP_FAILED) {
+        return false;
+    }
+    int n = m_pool->count.load();
+    pool->count.store(n);
+    memcpy((void*)pool->owner, (const void*)m_pool->owner, sizeof(pool->owner));
+    memcpy((void*)pool->slots, (const void*)m_pool->slots, n * sizeof(metrics_slot));
+    if (t_slot) {
+        t_slot = &pool->slots[t_slot - m_pool->slots];
+    }
+    m_pool = pool;
+    return true;
+}
+
+/* 计数器和直方图保留，总数不会因进程重启而回退 */
+void Metrics::release(int pid) {
+    static const METRIC_COUNTER process_gauges[] = {M_ACTIVE_CONNS, M_POOL_QUEUE_DEPTH, M_GZIP_CACHE_BYTES,
+                                                    M_ACCEPT_PAUSED, M_CONN_OBJECTS};
+    int n = m_pool->count.load();
+    for (int i = 0; i < n; i++) {
+        if (m_pool->owner[i].load() != pid) {
+            continue;
+        }
+        for (size_t g = 0; g < sizeof(process_gauges) / sizeof(process_gauges[0]); g++) {
+            m_pool->slots[i].counters[process_gauges[g]].store(0, memory_order_relaxed);
+        }
+        m_pool->owner[i].store(0);
+    }
+}
+
+int64_t Metrics::counter(METRIC_COUNTER id) {
+    int n = m_pool->count.load();
+    if (n > M_MAX_SLOTS) {
+        n = M_MAX_SLOTS;
+    }
+    int64_t total = 0;
+    for (int i = 0; i < n; i++) {
+        total += m_pool->slots[i].counters[id].load(memory_order_relaxed);
+    }
+    return total;
+}
+
+void Metrics::render_counter(string& out, METRIC_COUNTER id, const char* name, const char* type, const char* help) {
+    char line[512];
+    snprintf(line, sizeof(line), "# HELP %s %s\n# TYPE %s %s\n%s %lld\n", name, help, name, type, name, (long long)counter(id));
+    out += line;
+}
+
+/* 直方图按 2 的幂输出 le 边界(1us ~ 68s)，每个边界恰好是某个子桶的起点 */
+void Metrics::render_histogram(string& out, METRIC_HISTOGRAM id, const char* name, const char* help) {
+    int n = m_pool->count.load();
+    if (n > M_MAX_SLOTS) {
+        n = M_MAX_SLOTS;
+    }
+    uint64_t buckets[H_BUCKETS];
+    uint64_t sum = 0;
+    memset(buckets, 0, sizeof(buckets));
+    for (int i = 0; i < n; i++) {
+        metrics_histogram& h = m_pool->slots[i].hists[id];
+        for (int b = 0; b < H_BUCKETS; b++) {
+            buckets[b] += h.buckets[b].load(memory_order_relaxed);
+        }
+        sum += h.sum.load(memory_order_relaxed);
+    }
+
+    char line[256];
+    snprintf(line, sizeof(line), "# HELP %s %s\n# TYPE %s histogram\n", name, help, name);
+    out += line;
+
+    uint64_t cumulative = 0;
+    int b = 0;
+    for (int k = 10; k <= 36; k++) {
+        int limit = (k - H_SUB_BITS + 1) * H_SUB_BUCKETS;  /* bucket_index(2^k) */
+        for (; b < limit; b++) {
+            cumulative += buckets[b];
+        }
+        snprintf(line, sizeof(line), "%s_bucket{le=\"%.9g\"} %llu\n", name, (double)(1ULL << k) / 1e9, (unsigned long long)cumulative);
+        out += line;
+    }
+    for (; b < H_BUCKETS; b++) {
+        cumulative += buckets[b];
+    }
+    snprintf(line, sizeof(line), "%s_bucket{le=\"+Inf\"} %llu\n%s_sum %.9f\n%s_count %llu\n",
+             name, (unsigned long long)cumulative, name, (double)sum / 1e9, name, (unsigned long long)cumulative);
+    out += line;
+}
+
+void Metrics::render(string& out) {
+    out.clear();
+    char line[256];
+
+    render_counter(out, M_ACCEPTS, "webserver_accepts_total", "counter", "Accepted connections.");
+    render_counter(out, M_ACTIVE_CONNS, "webserver_active_connections", "gauge", "Currently open connections.");
+    render_counter(out, M_BYTES_SENT, "webserver_sent_bytes_total", "counter", "Bytes written to client sockets.");
+    render_counter(out, M_POOL_QUEUE_DEPTH, "webserver_threadpool_queue_depth", "gauge", "Requests waiting in the thread pool queue.");
+    render_counter(out, M_GZIP_HITS, "webserver_gzip_cache_hits_total", "counter", "Compressed-variant cache hits.");
+    render_counter(out, M_GZIP_MISSES, "webserver_gzip_cache_misses_total", "counter", "Compressed-variant cache misses (.gz sibling read or file compressed).");
+    render_counter(out, M_GZIP_EVICTIONS, "webserver_gzip_cache_evictions_total", "counter", "Compressed variants evicted to stay within the memory budget.");
+    render_counter(out, M_GZIP_CACHE_BYTES, "webserver_gzip_cache_bytes", "gauge", "Memory held by the compressed-variant cache.");
+    render_counter(out, M_RCACHE_HITS, "webserver_response_cache_hits_total", "counter", "Small-file response cache hits.");
+    render_counter(out, M_RCACHE_MISSES, "webserver_response_cache_misses_total", "counter", "Small-file response cache misses, including entries invalidated on revalidation.");
+    render_counter(out, M_RCACHE_EVICTIONS, "webserver_response_cache_evictions_total", "counter", "Responses evicted to stay within the memory budget.");
+    render_counter(out, M_RCACHE_BYTES, "webserver_response_cache_bytes", "gauge", "Memory held by the small-file response cache.");
+    render_counter(out, M_RCACHE_ENTRIES, "webserver_response_cache_entries", "gauge", "Responses held by the small-file response cache.");
+    render_counter(out, M_RCACHE_REBUILDS, "webserver_response_cache_rebuilds_total", "counter", "Response cache index rebuilds after a worker died holding the cache lock (-w only).");
+    render_counter(out, M_BUNDLE_HITS, "webserver_bundle_hits_total", "counter", "Responses served from the static bundle.");
+    render_counter(out, M_PREFETCH_JOBS, "webserver_prefetch_total", "counter", "Cold file ranges read into the page cache by the I/O pool.");
+    render_counter(out, M_PREFETCH_BYTES, "webserver_prefetch_bytes_total", "counter", "Bytes read into the page cache by the I/O pool.");
+    render_counter(out, M_SHED, "webserver_shed_total", "counter", "Requests and connections answered with 503 because the work queue or connection table was full.");
+    render_counter(out, M_ACCEPT_PAUSES, "webserver_accept_pauses_total", "counter", "Times accepting was paused because the work queue crossed its high-water mark.");
+    render_counter(out, M_ACCEPT_PAUSED, "webserver_accept_paused", "gauge", "1 while accepting is paused for backpressure.");
+    render_counter(out, M_RATELIMIT_CONNS, "webserver_ratelimit_connections_rejected_total", "counter", "Connections refused with 429 by the per-IP connection rate or concurrency limit.");
+    render_counter(out, M_RATELIMIT_REQUESTS, "webserver_ratelimit_requests_rejected_total", "counter", "Requests refused with 429 by the per-IP request rate limit.");
+    render_counter(out, M_RATELIMIT_TABLE_FULL, "webserver_ratelimit_table_full_total", "counter", "Connections admitted without limiting because the rate-limit table had no free slot.");
+    render_counter(out, M_CONN_OBJECTS, "webserver_connection_objects", "gauge", "Connection objects allocated by the slab pool, in use or free.");
+    render_counter(out, M_EPOLL_CTL, "webserver_epoll_ctl_total", "counter", "epoll_ctl calls issued to re-register interest on client connections.");
+    render_counter(out, M_EPOLL_CTL_SKIPPED, "webserver_epoll_ctl_skipped_total", "counter", "Interest changes skipped because the same events were already registered.");
+    render_counter(out, M_ACCEPT_REMOTE_CPU, "webserver_accepts_remote_cpu_total", "counter", "Connections whose SYN was handled on a CPU outside this event loop's set (-A only).");
+    render_counter(out, M_WORKERS, "webserver_workers", "gauge", "Live worker processes (-w only).");
+    render_counter(out, M_WORKER_RESTARTS, "webserver_worker_restarts_total", "counter", "Worker processes restarted by the master after they died (-w only).");
+    /* 命中率：启动以来的累计值 */
+    int64_t hits = counter(M_RCACHE_HITS);
+    int64_t lookups = hits + counter(M_RCACHE_MISSES);
+    snprintf(line, sizeof(line), "# HELP webserver_response_cache_hit_ratio Small-file response cache hit ratio since start.\n"
+                                 "# TYPE webserver_response_cache_hit_ratio gauge\nwebserver_response_cache_hit_ratio %.4f\n",
+             lookups ? (double)hits / lookups : 0.0);
+    out += line;
+
+    /* 按状态码统计的响应数，只输出出现过的状态码 */
+    int n = m_pool->count.load();
+    if (n > M_MAX_SLOTS) {
+        n = M_MAX_SLOTS;
+    }
+    out += "# HELP webserver_http_responses_total Responses by status code.\n"
+           "# TYPE webserver_http_responses_total counter\n";
+    for (int code = 0; code < M_STATUS_NUM; code++) {
+        uint64_t total = 0;
+        for (int i = 0; i < n; i++) {
+            total += m_pool->slots[i].status[code].load(memory_order_relaxed);
+        }
+        if (total) {
+            snprintf(line, sizeof(line), "webserver_http_responses_total{code=\"%d\"} %llu\n", code, (unsigned long long)total);
+            out += line;
+        }
+    }
+
+    render_histogram(out, H_POOL_WAIT, "webserver_threadpool_wait_seconds", "Time a request waits in the thread pool queue.");
+    render_histogram(out, H_DB_ACQUIRE, "webserver_db_acquire_seconds", "Time spent acquiring a connection from the MySQL pool.");
+    render_histogram(out, H_PARSE, "webserver_parse_seconds", "Request parse time (process_read).");
+    render_histogram(out, H_PROCESS, "webserver_process_seconds", "Request handling time (do_requset + process_write).");
+    render_histogram(out, H_WRITE, "webserver_write_seconds", "Time spent in one http_conn::write call.");
+    render_histogram(out, H_PREFETCH, "webserver_prefetch_seconds", "Time from submitting a cold file range to the I/O pool until it is resident.");
+}
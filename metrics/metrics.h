@@ -0,0 +1,182 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <atomic>
+#include <string>
+
+using namespace std;
+
+/* 运行指标：
+    每个线程第一次记录时从槽位池中领取一个私有槽位，之后只写自己的槽位(无锁、无竞争的缓存行)。
+    /metrics 被请求时才把所有槽位累加，渲染成 Prometheus 文本格式。
+    多进程模式下槽位池在 fork 之前移到共享内存，任何一个工作进程渲染的都是所有进程的总和。
+    记录一次计数只是一次 relaxed 原子加，记录一次耗时多一次 clock_gettime(vDSO)，都在几纳秒量级，可以常开。
+*/
+
+/* 计数器/仪表编号 */
+enum METRIC_COUNTER {
+    M_ACCEPTS = 0,           /* 累计 accept 的连接数 */
+    M_ACTIVE_CONNS,          /* 当前活跃连接数(仪表，可增可减) */
+    M_BYTES_SENT,            /* 累计发送字节数 */
+    M_POOL_QUEUE_DEPTH,      /* 线程池请求队列深度(仪表) */
+    M_GZIP_HITS,             /* gzip 缓存命中次数 */
+    M_GZIP_MISSES,           /* gzip 缓存未命中(读取预压缩文件或现场压缩)次数 */
+    M_GZIP_EVICTIONS,        /* gzip 缓存淘汰的项数 */
+    M_GZIP_CACHE_BYTES,      /* gzip 缓存占用的内存(仪表) */
+    M_RCACHE_HITS,           /* 小文件响应缓存命中次数 */
+    M_RCACHE_MISSES,         /* 小文件响应缓存未命中(含校验失效)次数 */
+    M_RCACHE_EVICTIONS,      /* 小文件响应缓存淘汰的项数 */
+    M_RCACHE_BYTES,          /* 小文件响应缓存占用的内存(仪表) */
+    M_RCACHE_ENTRIES,        /* 小文件响应缓存的项数(仪表) */
+    M_RCACHE_REBUILDS,       /* 持锁的工作进程崩溃后主进程重建小文件响应缓存索引的次数 */
+    M_BUNDLE_HITS,           /* 由静态资源包发送的响应数 */
+    M_PREFETCH_JOBS,         /* I/O 线程完成的文件预读次数 */
+    M_PREFETCH_BYTES,        /* I/O 线程预读的字节数 */
+    M_SHED,                  /* 因线程池队列已满或连接数已满以 503 拒绝的次数 */
+    M_ACCEPT_PAUSES,         /* 因队列超过高水位暂停 accept 的次数 */
+    M_ACCEPT_PAUSED,         /* 当前是否暂停 accept(仪表，0 或 1) */
+    M_RATELIMIT_CONNS,       /* 因同一 IP 的连接速率或同时连接数超限拒绝的连接数 */
+    M_RATELIMIT_REQUESTS,    /* 因同一 IP 的请求速率超限拒绝的请求数 */
+    M_RATELIMIT_TABLE_FULL,  /* 限流表探测窗口已满而放行的连接数 */
+    M_CONN_OBJECTS,          /* 对象池中已分配的连接对象数(仪表，只增不减) */
+    M_EPOLL_CTL,             /* 连接上重新注册事件调用 epoll_ctl 的次数 */
+    M_EPOLL_CTL_SKIPPED,     /* 要注册的事件已经注册而省去的 epoll_ctl 次数 */
+    M_ACCEPT_REMOTE_CPU,     /* 固定 CPU 时，由不属于本事件循环的 CPU 收到的连接数 */
+    M_WORKERS,               /* 多进程模式下存活的工作进程数(仪表) */
+    M_WORKER_RESTARTS,       /* 主进程重新拉起的工作进程数 */
+    M_COUNTER_NUM
+};
+
+/* 直方图编号，单位统一为纳秒 */
+enum METRIC_HISTOGRAM {
+    H_POOL_WAIT = 0,         /* 请求在线程池队列中的等待时间 */
+    H_DB_ACQUIRE,            /* 从数据库连接池取连接的等待时间 */
+    H_PARSE,                 /* process_read 解析耗时 */
+    H_PROCESS,               /* do_requset + process_write 耗时 */
+    H_WRITE,                 /* 一次 write() 发送耗时 */
+    H_PREFETCH,              /* 文件预读从提交到完成的时间，即事件循环不再等待的磁盘延迟 */
+    H_HISTOGRAM_NUM
+};
+
+/* HDR 风格的对数-线性分桶：每个 2 的幂区间再均分为 2^H_SUB_BITS 个子桶，相对误差约 12.5% */
+const int H_SUB_BITS = 3;
+const int H_SUB_BUCKETS = 1 << H_SUB_BITS;
+const int H_BUCKETS = 41 * H_SUB_BUCKETS;   /* 覆盖到 2^40 ns(约 18 分钟)，更大的值落入最后一个桶 */
+const int M_STATUS_NUM = 600;               /* 按状态码直接下标 */
+const int M_MAX_SLOTS = 256;                /* 最多 256 个线程各占一个槽位，超出的线程共享最后一个 */
+
+struct metrics_histogram {
+    atomic<uint64_t> buckets[H_BUCKETS];
+    atomic<uint64_t> sum;                   /* 所有样本之和，用于 _sum */
+};
+
+/* 单个线程的私有槽位，按缓存行对齐，避免相邻线程的伪共享 */
+struct alignas(64) metrics_slot {
+    atomic<int64_t> counters[M_COUNTER_NUM];
+    atomic<uint64_t> status[M_STATUS_NUM];
+    metrics_histogram hists[H_HISTOGRAM_NUM];
+};
+
+/* 槽位池；进程退出后它的槽位可以被新进程领取，计数在原值上继续累加 */
+struct metrics_pool {
+    atomic<int> count;                      /* 曾经领取过的槽位数，累加时只看这么多 */
+    atomic<int> owner[M_MAX_SLOTS];         /* 领取槽位的进程号，0 表示空闲 */
+    metrics_slot slots[M_MAX_SLOTS];
+};
+
+/* 下面的宏是其他模块记录指标的入口，与日志的 LOG_INFO 等宏用法一致 */
+#define METRIC_ADD(id, n) Metrics::add(id, n)
+#define METRIC_OBSERVE(id, ns) Metrics::observe(id, ns)
+#define METRIC_STATUS(code) Metrics::status(code)
+
+class Metrics {
+public:
+    /* 局部静态变量单例模式 */
+    static Metrics* get_instance() {
+        static Metrics instance;
+        return &instance;
+    }
+
+    /* 单调时钟，纳秒 */
+    static uint64_t now_ns() {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+    }
+
+    static void add(METRIC_COUNTER id, int64_t n) {
+        local()->counters[id].fetch_add(n, memory_order_relaxed);
+    }
+
+    static void status(int code) {
+        if (code < 0 || code >= M_STATUS_NUM) {
+            code = 0;
+        }
+        local()->status[code].fetch_add(1, memory_order_relaxed);
+    }
+
+    static void observe(METRIC_HISTOGRAM id, uint64_t ns) {
+        metrics_histogram& h = local()->hists[id];
+        h.buckets[bucket_index(ns)].fetch_add(1, memory_order_relaxed);
+        h.sum.fetch_add(ns, memory_order_relaxed);
+    }
+
+    /* 值 -> 桶下标：小于 2^H_SUB_BITS 的值直接落桶，其余取最高位所在区间再取其后 H_SUB_BITS 位 */
+    static int bucket_index(uint64_t v) {
+        if (v < (uint64_t)H_SUB_BUCKETS) {
+            return (int)v;
+        }
+        int msb = 63 - __builtin_clzll(v);
+        int shift = msb - H_SUB_BITS;
+        int idx = (shift + 1) * H_SUB_BUCKETS + (int)((v >> shift) & (H_SUB_BUCKETS - 1));
+        return idx < H_BUCKETS ? idx : H_BUCKETS - 1;
+    }
+
+    /* 桶下标 -> 该桶覆盖区间的下界，bucket_index 的逆运算 */
+    static uint64_t bucket_lower(int idx) {
+        if (idx < H_SUB_BUCKETS) {
+            return (uint64_t)idx;
+        }
+        int shift = idx / H_SUB_BUCKETS - 1;
+        return (uint64_t)(H_SUB_BUCKETS + idx % H_SUB_BUCKETS) << shift;
+    }
+
+    /* 将所有槽位累加后渲染为 Prometheus 文本格式 */
+    void render(string& out);
+
+    /* 读取某个计数器在所有槽位上的总和 */
+    int64_t counter(METRIC_COUNTER id);
+
+    /* 把槽位池移到共享内存，在 fork 之前、只有一个线程时调用 */
+    bool share();
+    /* fork 出的子进程调用：不再写父进程的槽位 */
+    void forked() {
+        t_slot = nullptr;
+    }
+    /* 进程 pid 已退出：只描述它自身状态的仪表清零，释放它的槽位，由主进程调用 */
+    void release(int pid);
+
+private:
+    Metrics();
+    ~Metrics() {}
+
+    static metrics_slot* local() {
+        if (t_slot == nullptr) {
+            t_slot = get_instance()->register_slot();
+        }
+        return t_slot;
+    }
+    metrics_slot* register_slot();
+
+    void render_counter(string& out, METRIC_COUNTER id, const char* name, const char* type, const char* help);
+    void render_histogram(string& out, METRIC_HISTOGRAM id, const char* name, const char* help);
+
+private:
+    static thread_local metrics_slot* t_slot;  /* 当前线程的槽位 */
+    metrics_pool* m_pool;                      /* 槽位池 */
+};
+
+#endif
@@ -0,0 +1,232 @@
+#include <time.h>
+#include <sys/mman.h>
+
+#include "rate_limiter.h"
+#include "../metrics/metrics.h"
+
+/* 表和每进程的连接数放在同一块匿名共享映射里，fork 出的工作进程共用；映射的内容全为 0，所有槽都是空的 */
+void rate_limiter::init(int conn_rate, int req_rate, int max_conns, int procs) {
+    m_conn_rate = conn_rate > 0 ? (conn_rate < MAX_RATE ? conn_rate : MAX_RATE) : 0;
+    m_req_rate = req_rate > 0 ? (req_rate < MAX_RATE ? req_rate : MAX_RATE) : 0;
+    m_max_conns = max_conns > 0 ? max_conns : 0;
+    m_enabled = m_conn_rate || m_req_rate || m_max_conns;
+    if (m_enabled && !m_table) {
+        m_procs = procs > 0 ? procs : 1;
+        size_t table_size = sizeof(rate_entry) << TABLE_BITS;
+        size_t owned_size = sizeof(atomic<uint32_t>) * ((size_t)m_procs << TABLE_BITS);
+        void* base = mmap(NULL, table_size + owned_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+        if (base == MAP_FAILED) {
+            m_enabled = false;
+            return;
+        }
+        m_table = (rate_entry*)base;
+        m_owned = (atomic<uint32_t>*)((char*)base + table_size);
+        m_proc = 0;
+        /* 时钟起点在 fork 之前确定，各进程的时间可以直接比较 */
+        m_start = 0;
+        m_start = now_ms();
+    }
+}
+
+void rate_limiter::set_process(int proc) {
+    m_proc = proc >= 0 && proc < m_procs ? proc : 0;
+}
+
+/* 退出的进程不会再改它的那一列，不需要和它同步 */
+void rate_limiter::release_process(int proc) {
+    if (!m_enabled || proc < 0 || proc >= m_procs) {
+        return;
+    }
+    for (int i = 0; i < (1 << TABLE_BITS); i++) {
+        uint32_t n = owned(proc, &m_table[i]).exchange(0, memory_order_relaxed);
+        if (n) {
+            m_table[i].conns.fetch_sub(n, memory_order_relaxed);
+        }
+    }
+}
+
+/* 粗粒度单调时钟(vDSO，几纳秒)，毫秒 */
+uint32_t rate_limiter::now_ms() const {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+    return (uint32_t)((uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000 - m_start);
+}
+
+/* 补充并扣掉一个令牌；桶容量为一秒的令牌数。令牌以千分之一为单位，每毫秒补充 rate 个单位 */
+bool rate_limiter::take(atomic<uint64_t>& bucket, uint32_t rate, uint32_t now) {
+    uint64_t old = bucket.load(memory_order_relaxed);
+    while (true) {
+        uint32_t last = old >> 32;
+        uint64_t tokens = (uint32_t)old;
+        /* 其他线程可能用稍晚的时间更新过，时间不回退 */
+        if ((int32_t)(now - last) > 0) {
+            tokens += (uint64_t)(now - last) * rate;
+            last = now;
+        }
+        uint64_t cap = (uint64_t)rate * 1000;
+        if (tokens > cap) {
+            tokens = cap;
+        }
+        bool ok = tokens >= 1000;
+        if (ok) {
+            tokens -= 1000;
+        }
+        uint64_t next = ((uint64_t)last << 32) | tokens;
+        if (next == old || bucket.compare_exchange_weak(old, next, memory_order_relaxed)) {
+            return ok;
+        }
+    }
+}
+
+rate_limiter::rate_entry* rate_limiter::find(uint32_t ip) const {
+    uint32_t mask = (1 << TABLE_BITS) - 1;
+    uint32_t slot = slot_of(ip);
+    for (int i = 0; i < MAX_PROBE; i++) {
+        rate_entry& e = m_table[(slot + i) & mask];
+        uint32_t key = e.ip.load(memory_order_acquire);
+        if (key == ip) {
+            return &e;
+        }
+        if (key == 0) {
+            break;
+        }
+    }
+    return nullptr;
+}
+
+/* 表项不删除，只原地复用，探测链不会断。抢占表项时输给了别的线程或进程就重新查找，对方插入的可能正是这个 IP */
+rate_limiter::rate_entry* rate_limiter::find_or_insert(uint32_t ip, uint32_t now) {
+    uint32_t mask = (1 << TABLE_BITS) - 1;
+    uint32_t slot = slot_of(ip);
+    while (true) {
+        rate_entry* reuse = nullptr;
+        uint32_t reuse_key = 0;
+        for (int i = 0; i < MAX_PROBE; i++) {
+            rate_entry& e = m_table[(slot + i) & mask];
+            uint32_t key = e.ip.load(memory_order_acquire);
+            if (key == ip) {
+                return &e;
+            }
+            if (key == 0) {
+                reuse = &e;
+                reuse_key = 0;
+                break;
+            }
+            if (!reuse && e.conns.load(memory_order_relaxed) == 0) {
+                uint32_t idle = now - (uint32_t)(e.conn_bucket.load(memory_order_relaxed) >> 32);
+                uint32_t req_idle = now - (uint32_t)(e.req_bucket.load(memory_order_relaxed) >> 32);
+                if ((int32_t)idle > (int32_t)IDLE_MS && (int32_t)req_idle > (int32_t)IDLE_MS) {
+                    reuse = &e;
+                    reuse_key = key;
+                }
+            }
+        }
+        if (!reuse) {
+            return nullptr;
+        }
+        if (claim(reuse, reuse_key, ip, now)) {
+            return reuse;
+        }
+    }
+}
+
+/* 占用空槽(key 为 0)或把空闲表项从 key 换给 ip，失败返回 nullptr。
+    复用时先把连接数从 0 换成 RECLAIMING，换 IP 期间原来的 IP 不能再计入连接；
+    换到之后再确认 IP 没变，否则表项已经被别人复用过了 */
+rate_limiter::rate_entry* rate_limiter::claim(rate_entry* e, uint32_t key, uint32_t ip, uint32_t now) {
+    if (key == 0) {
+        if (!e->ip.compare_exchange_strong(key, ip, memory_order_acq_rel)) {
+            return nullptr;
+        }
+    }
+    else {
+        uint32_t zero = 0;
+        if (!e->conns.compare_exchange_strong(zero, RECLAIMING, memory_order_acquire)) {
+            return nullptr;
+        }
+        if (e->ip.load(memory_order_relaxed) != key) {
+            e->conns.store(0, memory_order_release);
+            return nullptr;
+        }
+        e->ip.store(ip, memory_order_release);
+    }
+    e->conn_bucket.store(((uint64_t)now << 32) | ((uint64_t)m_conn_rate * 1000), memory_order_relaxed);
+    e->req_bucket.store(((uint64_t)now << 32) | ((uint64_t)m_req_rate * 1000), memory_order_relaxed);
+    if (key != 0) {
+        e->conns.store(0, memory_order_release);
+    }
+    return e;
+}
+
+bool rate_limiter::admit_connection(uint32_t ip) {
+    if (!m_enabled) {
+        return true;
+    }
+    uint32_t now = now_ms();
+    rate_entry* e;
+    while (true) {
+        e = find_or_insert(ip, now);
+        if (!e) {
+            METRIC_ADD(M_RATELIMIT_TABLE_FULL, 1);
+            return true;
+        }
+        /* 先在限额内占一个连接(超过时不消耗连接令牌)，其他进程同时计入也不会超 */
+        uint32_t n = e->conns.load(memory_order_relaxed);
+        while (n != RECLAIMING && (!m_max_conns || n < m_max_conns) &&
+               !e->conns.compare_exchange_weak(n, n + 1, memory_order_acquire)) {
+        }
+        if (n == RECLAIMING) {
+            continue;  /* 表项正在换给别的 IP */
+        }
+        bool full = m_max_conns && n >= m_max_conns;
+        /* 计入之后表项不会再被复用；计入之前已经被复用的，撤销后重新查找 */
+        if (e->ip.load(memory_order_acquire) != ip) {
+            if (!full) {
+                e->conns.fetch_sub(1, memory_order_relaxed);
+            }
+            continue;
+        }
+        if (full) {
+            METRIC_ADD(M_RATELIMIT_CONNS, 1);
+            return false;
+        }
+        break;
+    }
+    if (m_conn_rate && !take(e->conn_bucket, m_conn_rate, now)) {
+        e->conns.fetch_sub(1, memory_order_relaxed);
+        METRIC_ADD(M_RATELIMIT_CONNS, 1);
+        return false;
+    }
+    owned(m_proc, e).fetch_add(1, memory_order_relaxed);
+    return true;
+}
+
+void rate_limiter::release_connection(uint32_t ip) {
+    if (!m_enabled) {
+        return;
+    }
+    rate_entry* e = find(ip);
+    if (!e) {
+        return;
+    }
+    /* 只减本进程计入过的，与 release_process 不会重复 */
+    atomic<uint32_t>& own = owned(m_proc, e);
+    uint32_t n = own.load(memory_order_relaxed);
+    while (n > 0 && !own.compare_exchange_weak(n, n - 1, memory_order_relaxed)) {
+    }
+    if (n > 0) {
+        e->conns.fetch_sub(1, memory_order_relaxed);
+    }
+}
+
+bool rate_limiter::allow_request(uint32_t ip) {
+    if (!m_req_rate) {
+        return true;
+    }
+    rate_entry* e = find(ip);
+    if (!e || take(e->req_bucket, m_req_rate, now_ms())) {
+        return true;
+    }
+    METRIC_ADD(M_RATELIMIT_REQUESTS, 1);
+    return false;
+}
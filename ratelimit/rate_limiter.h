@@ -0,0 +1,93 @@
+#ifndef RATE_LIMITER_H
+#define RATE_LIMITER_H
+
+#include <stdint.h>
+#include <atomic>
+
+using namespace std;
+
+/* 超限时的应答：预先渲染好，发完即关闭连接 */
+const char too_many_429[] = "HTTP/1.1 429 Too Many Requests\r\nRetry-After: 1\r\nContent-Type: text/plain\r\n"
+                            "Content-Length: 18\r\nConnection: close\r\n\r\nToo Many Requests\n";
+
+/* 按客户端 IP 限流：每秒新建连接数、每秒请求数、同时在线的连接数，0 表示不限。
+    每个 IP 一项，放在固定大小的开放寻址表(线性探测)里，不随客户端数量分配内存。
+    令牌桶把"上次补充的时间(毫秒)"和"剩余令牌(千分之一个)"打包在一个 64 位原子量里，
+    用到时才按经过的时间补充(惰性补充)，一次 CAS 完成补充和扣减，查表和扣令牌都不加锁。
+    表放在 init 建立的共享内存里，多进程时所有工作进程共用，限额对整个服务器生效而不是每个进程各算一份；
+    占用空槽、复用表项、增减连接数也都用 CAS，不依赖只有一个事件循环线程。
+    有连接的表项不会被回收，空闲超过一分钟的表项在探测窗口满时被新 IP 复用；
+    窗口里找不到位置时放行，不因为表满而拒绝服务。
+    每个进程另有一列自己计入的连接数，工作进程崩溃后主进程据此减掉它没来得及释放的连接。 */
+class rate_limiter {
+public:
+    static const int TABLE_BITS = 16;  /* 65536 项，每项 32 字节，共 2MB */
+    static const int MAX_PROBE = 32;  /* 线性探测的最大步数 */
+    static const uint32_t IDLE_MS = 60 * 1000;  /* 没有连接且这么久没有活动的表项可以复用 */
+    static const int MAX_RATE = 1000000;
+
+    /* 局部静态变量单例模式 */
+    static rate_limiter* get_instance() {
+        static rate_limiter instance;
+        return &instance;
+    }
+
+    /* 在 fork 之前调用，procs 为共用这张表的进程数 */
+    void init(int conn_rate, int req_rate, int max_conns, int procs);
+    /* 工作进程启动时调用：之后计入和释放的连接记在第 proc 列 */
+    void set_process(int proc);
+    /* 主进程在工作进程退出后调用：减掉它计入而未释放的连接 */
+    void release_process(int proc);
+    bool enabled() const {
+        return m_enabled;
+    }
+
+    /* accept 之后调用：超过连接速率或同时连接数时返回 false，否则计入一个连接 */
+    bool admit_connection(uint32_t ip);
+    /* 关闭连接时调用，与 admit_connection 成对 */
+    void release_connection(uint32_t ip);
+    /* 任何线程：开始处理一个请求前调用，超过请求速率时返回 false */
+    bool allow_request(uint32_t ip);
+
+private:
+    rate_limiter()
+        : m_enabled(false), m_conn_rate(0), m_req_rate(0), m_max_conns(0), m_table(nullptr), m_owned(nullptr),
+          m_procs(0), m_proc(0), m_start(0) {}
+    /* 共享内存随进程退出释放 */
+    ~rate_limiter() {}
+
+    /* 表项复用期间的连接数：admit_connection 看到它时重新查表 */
+    static const uint32_t RECLAIMING = 0xffffffffu;
+
+    struct alignas(32) rate_entry {
+        atomic<uint32_t> ip;           /* 网络字节序的 IPv4 地址，0 表示空槽 */
+        atomic<uint32_t> conns;        /* 所有进程的连接数之和 */
+        atomic<uint64_t> conn_bucket;  /* 连接速率令牌桶：高 32 位为时间，低 32 位为令牌 */
+        atomic<uint64_t> req_bucket;   /* 请求速率令牌桶 */
+    };
+
+    uint32_t now_ms() const;
+    static uint32_t slot_of(uint32_t ip) {
+        return (ip * 2654435761u) >> (32 - TABLE_BITS);
+    }
+    static bool take(atomic<uint64_t>& bucket, uint32_t rate, uint32_t now);
+    rate_entry* find(uint32_t ip) const;
+    rate_entry* find_or_insert(uint32_t ip, uint32_t now);
+    rate_entry* claim(rate_entry* e, uint32_t key, uint32_t ip, uint32_t now);
+    atomic<uint32_t>& owned(int proc, const rate_entry* e) const {
+        return m_owned[((size_t)proc << TABLE_BITS) + (e - m_table)];
+    }
+
+private:
+    bool m_enabled;
+    uint32_t m_conn_rate;
+    uint32_t m_req_rate;
+    uint32_t m_max_conns;
+    rate_entry* m_table;        /* 共享内存 */
+    atomic<uint32_t>* m_owned;  /* 共享内存：m_procs 列，每列每个表项一个本进程计入的连接数 */
+    int m_procs;
+    int m_proc;                 /* 本进程的列 */
+    uint64_t m_start;  /* 毫秒时钟的起点，时间字段只有 32 位 */
+};
+
+#endif
@@ -13,7 +13,7 @@ connection_pool* connection_pool::GetInstance() {
 /* 初始化构造 */
 void connection_pool::init(string Url, string User, string PassWord, string DataBaseName, int Port, int MaxConn, int close_log) {
     m_url = Url;
-    m_User = m_User;
+    m_User = User;
     m_PassWord = PassWord;
     m_DataBaseName = DataBaseName;
     m_Port = Port;
@@ -64,6 +64,7 @@ MYSQL* connection_pool::GetConnection() {
         return nullptr;
     }
 
+    uint64_t start = Metrics::now_ns();
     // 取出连接，信号量原子减1，为0则阻塞等待
     reserver.wait();  /* list 是临界资源，以连接池中的资源个数为"SV"？线程间互斥访问 */
                         /* 与之对应的，当归还的时候才 V 操作 */
@@ -75,6 +76,7 @@ MYSQL* connection_pool::GetConnection() {
     m_CurConn++;
 
     lock.unlock();
+    METRIC_OBSERVE(H_DB_ACQUIRE, Metrics::now_ns() - start);
     return con;
 }
 
@@ -11,6 +11,7 @@
 
 #include "../lock/locker.h"
 #include "../log/log.h"
+#include "../metrics/metrics.h"
 
 using namespace std;
 
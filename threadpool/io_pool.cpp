@@ -0,0 +1,107 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "io_pool.h"
+#include "../metrics/metrics.h"
+
+bool io_pool::init(int threads) {
+    if (threads <= 0 || pipe2(m_notify, O_CLOEXEC) < 0) {
+        return false;
+    }
+    fcntl(m_notify[0], F_SETFL, fcntl(m_notify[0], F_GETFL) | O_NONBLOCK);
+    for (int i = 0; i < threads; i++) {
+        pthread_t tid;
+        if (pthread_create(&tid, nullptr, worker, this) != 0) {
+            break;
+        }
+        pthread_detach(tid);
+        m_threads++;
+    }
+    return m_threads > 0;
+}
+
+bool io_pool::submit(const char* path, dev_t dev, ino_t ino, off_t off, size_t len, int sockfd, uint32_t seq) {
+    io_job job;
+    job.path = path;
+    job.dev = dev;
+    job.ino = ino;
+    job.off = off;
+    job.len = len;
+    job.done.sockfd = sockfd;
+    job.done.seq = seq;
+    job.submitted = Metrics::now_ns();
+
+    m_lock.lock();
+    if (m_jobs.size() >= (size_t)MAX_JOBS) {
+        m_lock.unlock();
+        return false;
+    }
+    m_jobs.push_back(job);
+    m_lock.unlock();
+    m_pending.post();
+    return true;
+}
+
+int io_pool::completions(io_done* out, int max) {
+    ssize_t n = read(m_notify[0], out, max * sizeof(io_done));
+    if (n <= 0) {
+        return 0;
+    }
+    /* 每条通知小于 PIPE_BUF，写入是原子的，读到的总是整条 */
+    return n / sizeof(io_done);
+}
+
+void* io_pool::worker(void* arg) {
+    io_pool* pool = (io_pool*)arg;
+    pool->run();
+    return pool;
+}
+
+void io_pool::run() {
+    while (true) {
+        m_pending.wait();
+        m_lock.lock();
+        if (m_jobs.empty()) {
+            m_lock.unlock();
+            continue;
+        }
+        io_job job = m_jobs.front();
+        m_jobs.pop_front();
+        m_lock.unlock();
+
+        prefetch(job);
+        METRIC_OBSERVE(H_PREFETCH, Metrics::now_ns() - job.submitted);
+        /* 写端是阻塞的，事件循环来不及读时在这里等，通知不会丢 */
+        while (write(m_notify[1], &job.done, sizeof(job.done)) < 0 && errno == EINTR) {
+        }
+    }
+}
+
+/* 文件已被替换(inode 不同)或打不开时什么也不做，事件循环照常发送，最多缺页一次 */
+void io_pool::prefetch(const io_job& job) {
+    int fd = open(job.path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return;
+    }
+    struct stat st;
+    if (fstat(fd, &st) == 0 && st.st_dev == job.dev && st.st_ino == job.ino) {
+        /* readahead 一次提交整段读请求，随后的 pread 等它们完成 */
+        readahead(fd, job.off, job.len);
+        char buf[64 * 1024];
+        off_t off = job.off;
+        off_t end = job.off + job.len;
+        while (off < end) {
+            ssize_t n = pread(fd, buf, end - off < (off_t)sizeof(buf) ? end - off : sizeof(buf), off);
+            if (n <= 0) {
+                break;
+            }
+            off += n;
+        }
+        METRIC_ADD(M_PREFETCH_JOBS, 1);
+        METRIC_ADD(M_PREFETCH_BYTES, off - job.off);
+    }
+    close(fd);
+}
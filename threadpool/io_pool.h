@@ -0,0 +1,79 @@
+#ifndef IO_POOL_H
+#define IO_POOL_H
+
+#include <stdint.h>
+#include <sys/types.h>
+#include <list>
+#include <string>
+
+#include "../lock/locker.h"
+
+using namespace std;
+
+/* 预读完成的通知：哪个连接的哪一次预读 */
+struct io_done {
+    int sockfd;
+    uint32_t seq;
+};
+
+/* 文件预读线程池：
+    proactor 模式下 http_conn::write 在事件循环线程中直接从文件映射区 writev，文件不在页缓存中时
+    缺页会让整个事件循环等磁盘。write 在发送前用 mincore 检查映射区是否驻留，不驻留的部分交给这里：
+    I/O 线程按路径重新打开文件(确认还是同一个 inode)，readahead 发起读，再 pread 一遍等数据进入页缓存，
+    然后把 (sockfd, seq) 写进通知管道。事件循环监听管道的读端，收到后再发送，这时已不会缺页。
+    预读只依赖路径和 inode，不引用连接的任何状态；连接在预读期间关闭时，通知因 seq 不匹配被丢弃。
+*/
+class io_pool {
+public:
+    static const int MAX_JOBS = 1024;  /* 排队的预读任务上限，超出时调用者直接发送 */
+
+    /* 局部静态变量单例模式 */
+    static io_pool* get_instance() {
+        static io_pool instance;
+        return &instance;
+    }
+
+    /* 创建通知管道和 threads 个 I/O 线程，失败返回 false */
+    bool init(int threads);
+    bool enabled() const {
+        return m_threads > 0;
+    }
+    /* 通知管道的读端(非阻塞)，由事件循环注册到 epoll */
+    int notify_fd() const {
+        return m_notify[0];
+    }
+
+    /* 预读文件 path(设备号 dev、inode ino)的 [off, off + len)，完成后通知 (sockfd, seq)；队列满返回 false */
+    bool submit(const char* path, dev_t dev, ino_t ino, off_t off, size_t len, int sockfd, uint32_t seq);
+    /* 事件循环线程调用：取出已完成的通知，返回个数，没有时返回 0 */
+    int completions(io_done* out, int max);
+
+private:
+    io_pool() : m_threads(0) {
+        m_notify[0] = m_notify[1] = -1;
+    }
+    ~io_pool() {}
+
+    struct io_job {
+        string path;
+        dev_t dev;
+        ino_t ino;
+        off_t off;
+        size_t len;
+        io_done done;
+        uint64_t submitted;
+    };
+
+    static void* worker(void* arg);
+    void run();
+    void prefetch(const io_job& job);
+
+private:
+    int m_threads;
+    int m_notify[2];
+    list<io_job> m_jobs;
+    locker m_lock;
+    sem m_pending;
+};
+
+#endif
@@ -5,9 +5,11 @@
 #include <list>
 #include <exception>
 #include <pthread.h>
+#include <atomic>
 
 #include "../lock/locker.h"
 #include "../sql_conn_pool/sql_connection_pool.h"
+#include "../metrics/metrics.h"
 
 
 /* 线程池： 
@@ -20,8 +22,15 @@ class threadpool {
 public:
     threadpool(int actor_model, connection_pool* connPool, int thread_number=8, int max_requsets = 10000);
     ~threadpool();
-    bool append(T* requset, int state);
+    bool append(T* requset, int state);  /* 队列已满时返回 false，调用者负责拒绝该请求 */
     bool append_p(T* requset);
+    /* 队列中等待的请求数，事件循环据此暂停/恢复 accept，不加锁 */
+    int depth() const {
+        return m_depth.load(std::memory_order_relaxed);
+    }
+    int max_requests() const {
+        return m_max_requsets;
+    }
 
 private:
     /* 工作线程入口*/ 
@@ -47,7 +56,8 @@ private:
     int m_thread_number;            /* 线程池的线程数 */
     int m_max_requsets;             /* 请求队列中允许的最大请求数 */
     pthread_t* m_threads;           /* 描述线程池的数组，其大小为 m_thread_number */
-    std::list<T*> m_workqueue;      /* 请求队列 */    /* 是线程间共享的, 操作它要上锁*/
+    std::list<std::pair<T*, uint64_t> > m_workqueue;  /* 请求队列(请求, 入队时间) */    /* 是线程间共享的, 操作它要上锁*/
+    std::atomic<int> m_depth;       /* m_workqueue 的长度，持锁修改，供事件循环无锁读取 */
     locker m_queuelocker;           /* 用来保护请求队列的互斥锁 */
     sem m_queuestate;               /* 是否有任务需要处理 */
     connection_pool* m_connPool;    /* 数据库  地址？ */
@@ -57,7 +67,7 @@ private:
 /* 构造函数： 初值化列表 */
 template <typename T>
 threadpool<T>::threadpool(int actor_model, connection_pool* connPool, int thread_number, int max_requests)
-                         : m_actor_model(actor_model), m_thread_number(thread_number), m_max_requsets(max_requests) {
+                         : m_actor_model(actor_model), m_thread_number(thread_number), m_max_requsets(max_requests), m_depth(0), m_connPool(connPool) {
     if (thread_number <= 0|| max_requests <= 0)
     {
         throw std::exception();
@@ -96,7 +106,7 @@ threadpool<T>::threadpool(int actor_model, connection_pool* connPool, int thread
 
 template <typename T>
 threadpool<T>::~threadpool() {
-    delete m_threads;
+    delete[] m_threads;
 }
 
 template <typename T>
@@ -108,8 +118,10 @@ bool threadpool<T>::append(T* requset, int state) {
         return false;
     }
     requset->m_state = state;  /* 判断读写位 */
-    m_workqueue.push_back(requset);
+    m_workqueue.push_back(std::make_pair(requset, Metrics::now_ns()));
+    m_depth.store(m_workqueue.size(), std::memory_order_relaxed);
     m_queuelocker.unlock();
+    METRIC_ADD(M_POOL_QUEUE_DEPTH, 1);
     m_queuestate.post();  /* V 操作：标识(请求队列上)有无任务需要处理 */
     return true;
 }
@@ -122,8 +134,10 @@ bool threadpool<T>::append_p(T* requset) {
         m_queuelocker.unlock();
         return false;
     }
-    m_workqueue.push_back(requset);
+    m_workqueue.push_back(std::make_pair(requset, Metrics::now_ns()));
+    m_depth.store(m_workqueue.size(), std::memory_order_relaxed);
     m_queuelocker.unlock();
+    METRIC_ADD(M_POOL_QUEUE_DEPTH, 1);
     m_queuestate.post();
     return true;
 }
@@ -145,9 +159,13 @@ void threadpool<T>::run() {
             m_queuelocker.unlock();
             continue;  /* 回到while继续判断，即等待生产者生产 */
         }
-        T* request = m_workqueue.front();
+        T* request = m_workqueue.front().first;
+        uint64_t enqueued = m_workqueue.front().second;
         m_workqueue.pop_front();
+        m_depth.store(m_workqueue.size(), std::memory_order_relaxed);
         m_queuelocker.unlock();
+        METRIC_ADD(M_POOL_QUEUE_DEPTH, -1);
+        METRIC_OBSERVE(H_POOL_WAIT, Metrics::now_ns() - enqueued);
         if(!request){  /* 感觉是逻辑上写重了 */
             continue;
         }
@@ -162,16 +180,24 @@ void threadpool<T>::run() {
                     request->process();
                 }
                 else {
+                    request->timer_flag = 1;  /* 事件循环看到 improv 时必须已能看到 timer_flag */
+                    request->from_worker();
                     request->improv = 1;
-                    request->timer_flag = 1;
                 }
             }
             /* 写 */
             else {
                 if (request->write()) {
                     request->improv = 1;
+                    /* 流水线中的下一个请求已经在读缓冲区里，接着处理 */
+                    if (request->has_pending_request()) {
+                        connectionRAII mysqlcon(&request->mysql, m_connPool);
+                        request->process();
+                    }
                 }
                 else {
+                    request->timer_flag = 1;
+                    request->from_worker();
                     request->improv = 1;
                 }
             }
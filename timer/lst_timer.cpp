@@ -1,5 +1,6 @@
 #include "lst_timer.h"
 #include "../http/http_conn.h"
+#include "../http/conn_table.h"
 
 sort_timer_lst::sort_timer_lst() {
     head = nullptr;
@@ -23,7 +24,7 @@ void sort_timer_lst::add_timer(util_timer* timer) {
     }
     /* 如果此时升序链表内没有定时器 */
     if (!head) {
-        head = tail = nullptr;
+        head = tail = timer;
         return;
     }
     /* 若添加的定时器超时时间比头节点超时时间还小，则其成为链头 */
@@ -103,6 +104,15 @@ void sort_timer_lst::tick() {  /* 被Utils的time_handler调用 */
             break;
         }
         /* 否则说明有定时器到期 */
+        /* 连接还在工作线程(proactor 和 reactor)或挂起的协程手里时不能关闭：fd 和连接对象马上会被新连接复用，
+            处理完的响应就会写给另一个客户端。推迟到下一次 tick 再检查，重新注册事件交还事件循环之后照常超时 */
+        connection* c = conn_table::get_instance()->get(tmp->user_data->sockfd);
+        if (c && &c->data == tmp->user_data && c->conn.in_worker()) {
+            tmp->expire = cur + 1;
+            adjust_timer(tmp);
+            tmp = head;
+            continue;
+        }
         tmp->cb_func(tmp->user_data);
         head = head->next;
         if (head) {
@@ -223,5 +233,14 @@ void cb_func(client_data* user_data) {
     epoll_ctl(Utils::u_epollfd, EPOLL_CTL_DEL, user_data->sockfd, 0);
     assert(user_data);
     close(user_data->sockfd);
-    http_conn::m_user_count--;  
+    http_conn::m_user_count--;
+    METRIC_ADD(M_ACTIVE_CONNS, -1);
+    rate_limiter::get_instance()->release_connection(user_data->address.sin_addr.s_addr);
+    /* 空闲超时和事件循环关闭连接都经过这里：删除未完成上传的临时文件 */
+    connection* c = conn_table::get_instance()->get(user_data->sockfd);
+    if (c && &c->data == user_data) {
+        c->conn.abort_upload();
+    }
+    /* 连接对象还给对象池，user_data 随之失效，必须最后做 */
+    conn_table::get_instance()->release(user_data->sockfd, user_data);
 }
\ No newline at end of file
@@ -56,6 +56,10 @@ public:
     void adjust_timer(util_timer* timer);    /* 当定时器任务发生变化时，调整定时器在链表中的位置 */
     void del_timer(util_timer* timer);
     void tick();
+    /* 最早到期的定时器，沿 next 可遍历所有连接 */
+    util_timer* first() const {
+        return head;
+    }
 private:
     /* 私有成员函数， 被公有 add_timer 和 adjust_timer 调用，主要用于调整链表内部结构 */
     void add_timer(util_timer* timer, util_timer* lst_head);
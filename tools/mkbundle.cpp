@@ -0,0 +1,258 @@
+/* 静态资源打包工具：把网站根目录打包成服务器 -B 选项加载的资源包，格式见 cache/static_bundle.h
+    用法：mkbundle <网站根目录> <输出文件>
+    响应与服务器从文件系统发送时逐字节相同；可压缩的文件另存 gzip 版本(优先用较新的 <file>.gz，
+    否则与服务器以相同参数压缩，没有变小则不存)。先写临时文件，完成后改名，可以在服务器运行时重新打包。
+*/
+#include <errno.h>
+#include <fcntl.h>
+#include <ftw.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "../cache/static_bundle.h"
+#include "../cache/gzip_cache.h"
+#include "../http/http_validators.h"
+
+using namespace std;
+
+struct bundle_item {
+    string path;        /* 相对网站根目录，以 / 开头 */
+    string file;        /* 文件的完整路径 */
+    struct stat st;
+    string head;
+    string gz_head;
+    string gz_body;
+    bundle_entry entry;
+};
+
+static string g_root;
+static vector<bundle_item> g_items;
+
+static int collect(const char* fpath, const struct stat* sb, int typeflag, struct FTW* /* ftwbuf */) {
+    if (typeflag != FTW_F) {
+        return 0;
+    }
+    bundle_item item;
+    item.file = fpath;
+    item.path = item.file.substr(g_root.size());
+    /* 没有 FTW_PHYS 时 nftw 用 stat 跟随符号链接，与服务器一致；其他用户不可读或空文件服务器不走这条路径 */
+    item.st = *sb;
+    if (!S_ISREG(item.st.st_mode) || !(item.st.st_mode & S_IROTH) || item.st.st_size == 0) {
+        return 0;
+    }
+    g_items.push_back(item);
+    return 0;
+}
+
+/* 与 http_conn::process_write 的 FILE_REQUEST 相同，到 Content-Length 为止 */
+static string render_head(const struct stat& st, bool vary, bool gzip, long long length) {
+    char etag[64];
+    char date[64];
+    char buf[512];
+    format_etag(st, gzip, etag, sizeof(etag));
+    format_http_date(st.st_mtime, date, sizeof(date));
+    snprintf(buf, sizeof(buf), "HTTP/1.1 200 OK\r\n%sETag: %s\r\nLast-Modified: %s\r\nAccept-Ranges: bytes\r\n%sContent-Length: %lld\r\n",
+             vary ? "Vary: Accept-Encoding\r\n" : "", etag, date, gzip ? "Content-Encoding: gzip\r\n" : "", length);
+    return buf;
+}
+
+/* 为每个桶找一个种子，使所有路径落在互不相同的槽位上 */
+static bool build_index(uint32_t buckets, vector<uint32_t>& seeds, vector<int>& slot_of) {
+    uint32_t n = g_items.size();
+    vector<vector<int> > members(buckets);
+    for (uint32_t i = 0; i < n; i++) {
+        const string& p = g_items[i].path;
+        members[bundle_hash(p.data(), p.size(), 0) % buckets].push_back(i);
+    }
+    vector<uint32_t> order(buckets);
+    for (uint32_t b = 0; b < buckets; b++) {
+        order[b] = b;
+    }
+    /* 大桶先放，空槽位多时更容易找到种子 */
+    sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) { return members[a].size() > members[b].size(); });
+
+    vector<bool> used(n, false);
+    seeds.assign(buckets, 1);
+    slot_of.assign(n, -1);
+    vector<uint32_t> slots;
+    for (uint32_t k = 0; k < buckets; k++) {
+        const vector<int>& m = members[order[k]];
+        if (m.empty()) {
+            break;
+        }
+        uint32_t seed = 1;
+        for (; seed < (1u << 22); seed++) {
+            slots.clear();
+            bool ok = true;
+            for (size_t j = 0; j < m.size() && ok; j++) {
+                const string& p = g_items[m[j]].path;
+                uint32_t s = bundle_hash(p.data(), p.size(), seed) % n;
+                ok = !used[s] && find(slots.begin(), slots.end(), s) == slots.end();
+                slots.push_back(s);
+            }
+            if (ok) {
+                break;
+            }
+        }
+        if (seed == (1u << 22)) {
+            return false;
+        }
+        seeds[order[k]] = seed;
+        for (size_t j = 0; j < m.size(); j++) {
+            used[slots[j]] = true;
+            slot_of[m[j]] = slots[j];
+        }
+    }
+    return true;
+}
+
+static bool write_all(int fd, const void* data, size_t len) {
+    const char* p = (const char*)data;
+    while (len > 0) {
+        ssize_t n = write(fd, p, len);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        p += n;
+        len -= n;
+    }
+    return true;
+}
+
+/* 把文件原样复制到包中，长度必须与打包开始时 stat 的一致 */
+static bool copy_file(int out, const bundle_item& item) {
+    int fd = open(item.file.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    char buf[64 * 1024];
+    long long left = item.st.st_size;
+    while (left > 0) {
+        ssize_t n = read(fd, buf, left < (long long)sizeof(buf) ? left : sizeof(buf));
+        if (n <= 0 || !write_all(out, buf, n)) {
+            close(fd);
+            return false;
+        }
+        left -= n;
+    }
+    close(fd);
+    return true;
+}
+
+int main(int argc, char* argv[]) {
+    if (argc != 3) {
+        fprintf(stderr, "usage: %s <docroot> <bundle>\n", argv[0]);
+        return 1;
+    }
+    g_root = argv[1];
+    while (g_root.size() > 1 && g_root[g_root.size() - 1] == '/') {
+        g_root.erase(g_root.size() - 1);
+    }
+    if (nftw(g_root.c_str(), collect, 64, 0) != 0 || g_items.empty()) {
+        fprintf(stderr, "mkbundle: no files under %s\n", g_root.c_str());
+        return 1;
+    }
+    /* 刚修改过的文件 ETag 是弱的，等它们满 1 秒，与服务器之后从文件系统给出的 ETag 一致 */
+    time_t newest = 0;
+    for (size_t i = 0; i < g_items.size(); i++) {
+        newest = max(newest, g_items[i].st.st_mtime);
+    }
+    if (time(NULL) - newest < 1) {
+        sleep(1);
+    }
+    sort(g_items.begin(), g_items.end(), [](const bundle_item& a, const bundle_item& b) { return a.path < b.path; });
+
+    /* 渲染响应头，准备 gzip 版本 */
+    uint64_t raw_bytes = 0, gz_count = 0;
+    for (size_t i = 0; i < g_items.size(); i++) {
+        bundle_item& item = g_items[i];
+        bool vary = gzip_cache::compressible(item.file.c_str(), item.st.st_size);
+        /* 与服务器 gzip_cache 的取法相同 */
+        if (vary && !gzip_cache::load_sibling(item.file.c_str(), item.st, item.gz_body) &&
+            (!gzip_cache::compress(item.file.c_str(), item.st.st_size, item.gz_body) || item.gz_body.size() >= (size_t)item.st.st_size)) {
+            item.gz_body.clear();
+        }
+        item.head = render_head(item.st, vary, false, item.st.st_size);
+        if (!item.gz_body.empty()) {
+            item.gz_head = render_head(item.st, vary, true, item.gz_body.size());
+            gz_count++;
+        }
+        raw_bytes += item.st.st_size;
+    }
+
+    /* 布局：header | seeds | entries | 数据 */
+    uint32_t count = g_items.size();
+    uint32_t buckets = count / 4 + 1;
+    vector<uint32_t> seeds;
+    vector<int> slot_of;
+    while (!build_index(buckets, seeds, slot_of)) {
+        buckets *= 2;
+    }
+    bundle_header header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, BUNDLE_MAGIC, sizeof(BUNDLE_MAGIC));
+    header.version = BUNDLE_VERSION;
+    header.count = count;
+    header.buckets = buckets;
+    header.seeds_off = sizeof(bundle_header);
+    header.entries_off = (header.seeds_off + buckets * sizeof(uint32_t) + 7) & ~7ULL;
+    uint64_t off = header.entries_off + (uint64_t)count * sizeof(bundle_entry);
+    vector<bundle_entry> entries(count);
+    for (uint32_t i = 0; i < count; i++) {
+        bundle_item& item = g_items[i];
+        bundle_entry& e = item.entry;
+        memset(&e, 0, sizeof(e));
+        e.flags = gzip_cache::compressible(item.file.c_str(), item.st.st_size) ? BUNDLE_VARY : 0;
+        e.path_off = off;
+        e.path_len = item.path.size();
+        off += e.path_len;
+        e.head_off = off;
+        e.head_len = item.head.size();
+        e.body_len = item.st.st_size;
+        off += e.head_len + e.body_len;
+        e.gz_head_off = off;
+        e.gz_head_len = item.gz_head.size();
+        e.gz_body_len = item.gz_body.size();
+        off += e.gz_head_len + e.gz_body_len;
+        entries[slot_of[i]] = e;
+    }
+    header.size = off;
+
+    string tmp = string(argv[2]) + ".tmp";
+    int out = open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (out < 0) {
+        fprintf(stderr, "mkbundle: cannot create %s: %s\n", tmp.c_str(), strerror(errno));
+        return 1;
+    }
+    static const char zeros[8] = {0};
+    bool ok = write_all(out, &header, sizeof(header)) && write_all(out, &seeds[0], buckets * sizeof(uint32_t)) &&
+              write_all(out, zeros, header.entries_off - header.seeds_off - buckets * sizeof(uint32_t)) &&
+              write_all(out, &entries[0], count * sizeof(bundle_entry));
+    for (uint32_t i = 0; i < count && ok; i++) {
+        const bundle_item& item = g_items[i];
+        ok = write_all(out, item.path.data(), item.path.size()) && write_all(out, item.head.data(), item.head.size()) &&
+             copy_file(out, item) && write_all(out, item.gz_head.data(), item.gz_head.size()) &&
+             write_all(out, item.gz_body.data(), item.gz_body.size());
+        if (!ok) {
+            fprintf(stderr, "mkbundle: failed to copy %s\n", item.file.c_str());
+        }
+    }
+    ok = close(out) == 0 && ok;
+    if (!ok || rename(tmp.c_str(), argv[2]) != 0) {
+        unlink(tmp.c_str());
+        fprintf(stderr, "mkbundle: failed to write %s\n", argv[2]);
+        return 1;
+    }
+    printf("%u files (%llu bytes, %llu gzip variants), %u buckets, bundle %llu bytes\n", count,
+           (unsigned long long)raw_bytes, (unsigned long long)gz_count, buckets, (unsigned long long)header.size);
+    return 0;
+}